@@ -0,0 +1,105 @@
+#include <dcache/cache_hash.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+/// Replays a trace of addresses against each hash policy and reports how well it uses the lines of a direct-mapped cache
+/// Usage: hash_quality_bench [trace_file] [lines] [nodes]
+/// - trace_file: one raw rdma_ptr per line (see RemoteCacheImpl::dump_trace). If omitted, a slab-like trace is synthesized
+/// - lines: the requested number of lines in the cache (default 2000)
+/// - nodes: the number of nodes the trace was recorded across (default 1)
+
+/// The raw rdma_ptr layout: id in bits [48, 63), address in the bottom 48 bits
+static inline uint16_t raw_id(uint64_t raw){
+    return (raw >> 48) & 0x7FFF;
+}
+static inline uint64_t raw_address(uint64_t raw){
+    return raw & ((1ULL << 48) - 1);
+}
+
+/// Objects allocated out of slabs of 64-byte aligned objects (like the IHT ELists and PLists), read with a skew
+static std::vector<uint64_t> synthesize_trace(int nodes){
+    std::mt19937_64 gen(0);
+    std::vector<uint64_t> objects;
+    uint64_t base = 0x7f0000000000;
+    for(int n = 0; n < nodes; n++){
+        for(int slab = 0; slab < 16; slab++){
+            uint64_t slab_base = base + (slab * 0x100000);
+            for(int i = 0; i < 256; i++){
+                // a mix of single line and multi line objects (i.e. ELists and PLists)
+                objects.push_back(((uint64_t) n << 48) | (slab_base + (i * 64 * (1 + (i % 4)))));
+            }
+        }
+    }
+    std::vector<uint64_t> trace;
+    std::geometric_distribution<int> skew(0.0005);
+    for(int i = 0; i < 1000000; i++){
+        trace.push_back(objects[skew(gen) % objects.size()]);
+    }
+    return trace;
+}
+
+template <typename Hash>
+void replay(const std::vector<uint64_t>& trace, int requested, int nodes){
+    uint64_t lines = Hash::lines(requested);
+    std::vector<uint64_t> offsets;
+    for(int i = 0; i < nodes; i++) offsets.push_back((uint64_t) (((double) lines / nodes) * i) % lines);
+
+    // Simulate a direct mapped cache (what RemoteCache does without priority)
+    std::vector<uint64_t> cache(lines, 0);
+    std::vector<uint64_t> occupancy(lines, 0);
+    uint64_t hits = 0, conflicts = 0, cold = 0;
+    for(uint64_t raw : trace){
+        uint16_t id = raw_id(raw);
+        uint64_t line = Hash::index(raw_address(raw), id < offsets.size() ? offsets[id] : 0, lines);
+        if (cache[line] == raw) hits++;
+        else if (cache[line] == 0) cold++;
+        else conflicts++;
+        if (cache[line] != raw) occupancy[line]++;
+        cache[line] = raw;
+    }
+    uint64_t used = 0, max_load = 0;
+    for(uint64_t o : occupancy){
+        if (o != 0) used++;
+        if (o > max_load) max_load = o;
+    }
+
+    // Time the index computation alone
+    uint64_t sink = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for(uint64_t raw : trace){
+        sink += Hash::index(raw_address(raw), offsets[raw_id(raw) % offsets.size()], lines);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double ns = (double) std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / trace.size();
+
+    printf("%-16s lines=%-6lu used=%-6lu (%.1f%%) max_fills=%-6lu hit_rate=%.4f conflicts=%-8lu cold=%-6lu ns/hash=%.2f (%lu)\n",
+        Hash::name, lines, used, 100.0 * used / lines, max_load, (double) hits / trace.size(), conflicts, cold, ns, sink % 2);
+}
+
+int main(int argc, char** argv){
+    int lines = argc > 2 ? std::stoi(argv[2]) : 2000;
+    int nodes = argc > 3 ? std::stoi(argv[3]) : 1;
+    std::vector<uint64_t> trace;
+    if (argc > 1){
+        std::ifstream in(argv[1]);
+        uint64_t raw;
+        while (in >> raw) trace.push_back(raw);
+        printf("Replaying %lu addresses from %s\n", trace.size(), argv[1]);
+    } else {
+        trace = synthesize_trace(nodes);
+        printf("Replaying %lu synthesized addresses\n", trace.size());
+    }
+    if (trace.empty()) return 1;
+
+    replay<Mix13Modulo>(trace, lines, nodes);
+    replay<Mix13Mask>(trace, lines, nodes);
+    replay<Mix13FastRange>(trace, lines, nodes);
+    replay<SlabIndex>(trace, lines, nodes);
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include "../../iht/cached/ds/node_layout.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+/// Compares the B+tree node layouts: the cost of searching a node against the cost of checking it wasn't torn
+/// Usage: node_layout_bench [nodes]
+/// - nodes: how many nodes (and leaves) of each size are searched, so they don't all fit in the CPU cache (default 20000)
+/// For each layout and degree, reports the node sizes and ns per operation for
+/// - search: count_less of a random key (what traverse does at every level)
+/// - key_at: a linear pass over the keys (what the updates do)
+/// - validate: is_valid of a node (what reliable_read does after every read)
+
+static const int OPS = 2000000;
+
+template <typename F>
+double time_ns(F f){
+    auto start = std::chrono::high_resolution_clock::now();
+    f();
+    auto end = std::chrono::high_resolution_clock::now();
+    return (double) std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / OPS;
+}
+
+/// Fill a node with sorted random keys and seal it
+template <typename Node, int SIZE>
+void fill(Node& node, std::mt19937& gen){
+    std::vector<int32_t> keys(SIZE);
+    for(int32_t& k : keys) k = gen() % 1000000;
+    std::sort(keys.begin(), keys.end());
+    for(int i = 0; i < SIZE; i++) node.set_key(i, keys[i]);
+    node.seal();
+}
+
+template <typename Node, int SIZE>
+void measure(const char* kind, std::vector<Node>& nodes){
+    std::mt19937 gen(1);
+    std::vector<uint32_t> picks(OPS);
+    std::vector<int32_t> keys(OPS);
+    for(int i = 0; i < OPS; i++){
+        picks[i] = gen() % nodes.size();
+        keys[i] = gen() % 1000000;
+    }
+    uint64_t sink = 0;
+    double search = time_ns([&](){
+        for(int i = 0; i < OPS; i++) sink += nodes[picks[i]].count_less(keys[i]);
+    });
+    double key_at = time_ns([&](){
+        for(int i = 0; i < OPS; i++){
+            const Node& n = nodes[picks[i]];
+            for(int j = 0; j < SIZE; j++) sink += n.key_at(j);
+        }
+    });
+    double validate = time_ns([&](){
+        for(int i = 0; i < OPS; i++) sink += nodes[picks[i]].is_valid(false);
+    });
+    printf("  %-6s bytes=%-5lu search=%6.2f key_at=%6.2f validate=%6.2f (%lu)\n", kind, sizeof(Node), search, key_at, validate, sink % 2);
+}
+
+template <typename Layout, int DEGREE>
+void run(const char* name, int count){
+    constexpr int SIZE = DEGREE * 2 + 1;
+    using Inner = typename Layout::template Inner<int32_t, SIZE>;
+    using Leaf = typename Layout::template Leaf<int32_t, int32_t, SIZE>;
+    std::mt19937 gen(0);
+    std::vector<Inner> inners(count);
+    std::vector<Leaf> leaves(count);
+    for(Inner& n : inners){
+        for(int i = 0; i <= SIZE; i++) n.set_ptr(i, gen());
+        fill<Inner, SIZE>(n, gen);
+    }
+    for(Leaf& l : leaves){
+        l.set_range(INT_MIN, INT_MAX);
+        l.set_next(0);
+        for(int i = 0; i < SIZE; i++) l.set_value(i, gen());
+        fill<Leaf, SIZE>(l, gen);
+    }
+    printf("%s degree=%d\n", name, DEGREE);
+    measure<Inner, SIZE>("inner", inners);
+    measure<Leaf, SIZE>("leaf", leaves);
+}
+
+template <typename Layout>
+void run_all(std::string name, int count){
+    run<Layout, 4>(name.c_str(), count);
+    run<Layout, 12>(name.c_str(), count);
+    run<Layout, 32>(name.c_str(), count);
+}
+
+int main(int argc, char** argv){
+    int count = argc > 1 ? std::stoi(argv[1]) : 20000;
+    run_all<node_layout::LineVersions>(node_layout::LineVersions::name, count);
+    run_all<node_layout::Checksum<key_hash::Crc32cHash>>(std::string(node_layout::Checksum<>::name) + " " + key_hash::Crc32cHash::name, count);
+    run_all<node_layout::Checksum<key_hash::WyHash>>(std::string(node_layout::Checksum<>::name) + " " + key_hash::WyHash::name, count);
+    run_all<node_layout::HeaderFooter>(node_layout::HeaderFooter::name, count);
+    return 0;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+
+/// Hash policies for mapping a remote address to a line in the RemoteCache
+/// Each policy provides
+/// - lines(requested): the number of lines the cache should actually allocate for a requested size
+/// - index(address, offset, lines): the line for an (unmarked) address, given the per-node offset (offset < lines)
+/// - name: used for printing
+/// Every object we cache is aligned to 64 bytes, so the bottom 6 bits of an address carry no information
+
+/// mix13 finalizer (also used by the IHT)
+inline uint64_t mix13(uint64_t hashed){
+    hashed ^= (hashed >> 33);
+    hashed *= 0xff51afd7ed558ccd;
+    hashed ^= (hashed >> 33);
+    hashed *= 0xc4ceb9fe1a85ec53;
+    hashed ^= (hashed >> 33);
+    return hashed;
+}
+
+/// Map a 64-bit hash uniformly into [0, n) with a multiply and shift instead of a division (Lemire's fastrange)
+/// Relies on the high bits of hashed being well mixed
+inline uint64_t fastrange(uint64_t hashed, uint64_t n){
+    return (uint64_t) (((__uint128_t) hashed * (__uint128_t) n) >> 64);
+}
+
+/// Round up to the next power of two
+inline int next_pow2(int requested){
+    int lines = 1;
+    while (lines < requested) lines <<= 1;
+    return lines;
+}
+
+/// The original hash. mix13 on the object index and a 64-bit modulo
+struct Mix13Modulo {
+    static constexpr const char* name = "mix13_mod";
+
+    static int lines(int requested){
+        return requested;
+    }
+
+    static inline uint64_t index(uint64_t address, uint64_t offset, uint64_t lines){
+        return (mix13(address >> 6) + offset) % lines;
+    }
+};
+
+/// mix13 on the object index, masked into a power-of-two number of lines
+struct Mix13Mask {
+    static constexpr const char* name = "mix13_mask";
+
+    static int lines(int requested){
+        return next_pow2(requested);
+    }
+
+    static inline uint64_t index(uint64_t address, uint64_t offset, uint64_t lines){
+        return (mix13(address >> 6) + offset) & (lines - 1);
+    }
+};
+
+/// mix13 on the object index, reduced with fastrange (any number of lines)
+struct Mix13FastRange {
+    static constexpr const char* name = "mix13_fastrange";
+
+    static int lines(int requested){
+        return requested;
+    }
+
+    static inline uint64_t index(uint64_t address, uint64_t offset, uint64_t lines){
+        uint64_t line = fastrange(mix13(address >> 6), lines) + offset;
+        // offset < lines, so at most a single wrap around
+        return line >= lines ? line - lines : line;
+    }
+};
+
+/// The low bits of the slab allocator's object index (no mixing)
+/// Objects that were allocated next to each other land on neighboring lines, so a working set smaller than the cache never conflicts
+/// Bad if the allocation stride is a multiple of the number of lines
+struct SlabIndex {
+    static constexpr const char* name = "slab_index";
+
+    static int lines(int requested){
+        return next_pow2(requested);
+    }
+
+    static inline uint64_t index(uint64_t address, uint64_t offset, uint64_t lines){
+        return ((address >> 6) + offset) & (lines - 1);
+    }
+};
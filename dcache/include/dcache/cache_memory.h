@@ -0,0 +1,226 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <dirent.h>
+#include <fstream>
+#include <linux/mempolicy.h>
+#include <mutex>
+#include <remus/logging/logging.h>
+#include <remus/rdma/rdma_ptr.h>
+#include <sched.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+/// Where the RemoteCache places its memory
+/// The CacheLine array and the cached copies must be in RDMA registered memory (peers CAS the lines, reads land in the copies)
+/// So those stay in the pool, and the options control
+/// - the local-only memory of the cache (the lock of every line), which is placed in an arena on 2MB pages bound to a NUMA node
+/// - a slab reserved from the pool for the cached copies, so the copies are dense instead of spread across the RDMA heap
+/// - the number of replicas of the cache in the process. Threads use the replica of their NUMA node
+///   (so the lines they lock on a hit stay on their socket) and writes invalidate every replica
+struct CacheOptions {
+    /// don't bind the arena to a node
+    static constexpr int NO_NUMA = -1;
+    /// bind to the node of the RDMA NIC
+    static constexpr int NIC_NUMA = -2;
+    /// bind to the node of the thread constructing the cache
+    static constexpr int LOCAL_NUMA = -3;
+
+    /// Back the local memory with 2MB pages (hugetlbfs if reserved, otherwise transparent huge pages)
+    bool huge_pages = false;
+    /// The NUMA node to bind the local memory to (or one of NO_NUMA, NIC_NUMA, LOCAL_NUMA)
+    int numa_node = NO_NUMA;
+    /// Bytes to reserve from the pool for cached copies (0 to allocate every copy from the pool)
+    uint64_t copy_slab_bytes = 0;
+    /// Replicas of the cache (i.e. one per NUMA node). Replica i's locks are bound to node i. Every node in the clique must use the same number
+    int replicas = 1;
+};
+
+constexpr uint64_t HUGE_PAGE_SIZE = 1 << 21;
+
+/// The NUMA node of the first RDMA device (or -1 if unknown)
+inline int nic_numa_node(){
+    DIR* dir = opendir("/sys/class/infiniband");
+    if (dir == nullptr) return -1;
+    int node = -1;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr){
+        if (entry->d_name[0] == '.') continue;
+        std::ifstream in(std::string("/sys/class/infiniband/") + entry->d_name + "/device/numa_node");
+        if (in >> node) break;
+    }
+    closedir(dir);
+    return node;
+}
+
+/// The NUMA node of the calling thread (or -1 if unknown)
+inline int local_numa_node(){
+    unsigned int cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) return -1;
+    return node;
+}
+
+/// The NUMA node of the calling thread, looked up once per thread
+inline int thread_numa_node(){
+    thread_local int node = std::max(local_numa_node(), 0);
+    return node;
+}
+
+/// Resolve NIC_NUMA and LOCAL_NUMA to a node
+inline int resolve_numa_node(int numa_node){
+    if (numa_node == CacheOptions::NIC_NUMA) return nic_numa_node();
+    if (numa_node == CacheOptions::LOCAL_NUMA) return local_numa_node();
+    return numa_node;
+}
+
+/// A fixed size, local-only region of memory on huge pages and bound to a NUMA node
+/// Objects are bump allocated and live as long as the arena
+class LocalArena {
+    uint8_t* base = nullptr;
+    uint64_t capacity = 0;
+    uint64_t head = 0;
+
+public:
+    LocalArena() = default;
+    LocalArena(const LocalArena&) = delete;
+    LocalArena& operator=(const LocalArena&) = delete;
+
+    /// Map the arena. Falls back to normal pages if huge pages aren't available
+    LocalArena(uint64_t bytes, CacheOptions options) {
+        uint64_t page = options.huge_pages ? HUGE_PAGE_SIZE : 4096;
+        capacity = ((bytes + page - 1) / page) * page;
+        void* region = MAP_FAILED;
+        if (options.huge_pages){
+            region = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (region == MAP_FAILED) REMUS_WARN("No reserved huge pages, using transparent huge pages");
+        }
+        if (region == MAP_FAILED){
+            region = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            REMUS_ASSERT(region != MAP_FAILED, "Failed to map {} bytes for the cache", capacity);
+            if (options.huge_pages) madvise(region, capacity, MADV_HUGEPAGE);
+        }
+        base = (uint8_t*) region;
+
+        int node = resolve_numa_node(options.numa_node);
+        if (node >= 0){
+            // bind before first touch so every page is faulted in on the node
+            unsigned long nodemask = 1UL << node;
+            if (syscall(SYS_mbind, base, capacity, MPOL_BIND, &nodemask, sizeof(nodemask) * 8, 0) != 0){
+                REMUS_WARN("Failed to bind the cache to NUMA node {}", node);
+            }
+        }
+    }
+
+    ~LocalArena(){
+        if (base != nullptr) munmap(base, capacity);
+    }
+
+    /// Bump allocate an array of T (aligned to 64 bytes)
+    template <typename T>
+    T* allocate(int n){
+        uint64_t bytes = ((sizeof(T) * n + 63) / 64) * 64;
+        REMUS_ASSERT(head + bytes <= capacity, "LocalArena is full");
+        T* result = (T*) (base + head);
+        head += bytes;
+        return result;
+    }
+};
+
+/// A slab of RDMA memory reserved from the pool that the cached copies are allocated out of
+/// Power-of-two size classes from 64 bytes to 64KB. Requests that don't fit (or a full slab) return nullptr so the caller falls back to the pool
+/// The pool can't allocate more than 1MB at once, so the slab is reserved in chunks
+template <typename Pool>
+class CopySlab {
+    static constexpr int MIN_CLASS = 6;
+    static constexpr int MAX_CLASS = 16;
+    static constexpr uint64_t CHUNK_SIZE = 1 << 19;
+
+    /// the chunks, sorted by address. The pool only aligns to the type, so over-allocate to align the copies to 64 bytes
+    struct Chunk {
+        uint8_t* reserved; // what the pool returned
+        uint8_t* base; // aligned to 64 bytes
+    };
+    std::vector<Chunk> chunks;
+    uint64_t capacity = 0;
+    std::atomic<uint64_t> head;
+    /// The free copies of a size class and their lock, on their own cache line so threads using different classes don't share it
+    struct alignas(64) SizeClass {
+        std::mutex lock;
+        std::vector<uint8_t*> freelist;
+    };
+    std::array<SizeClass, MAX_CLASS - MIN_CLASS + 1> classes;
+
+    static inline int size_class(uint64_t bytes){
+        int c = MIN_CLASS;
+        while ((1ULL << c) < bytes) c++;
+        return c;
+    }
+
+public:
+    CopySlab() : head(0) {}
+
+    /// Reserve (at least) bytes from the pool
+    void reserve(Pool* pool, uint64_t bytes){
+        for(uint64_t i = 0; i < bytes; i += CHUNK_SIZE){
+            uint8_t* reserved = (uint8_t*) pool->template Allocate<uint8_t>(CHUNK_SIZE + 64).address();
+            chunks.push_back(Chunk{reserved, (uint8_t*) ((((uint64_t) reserved) + 63) & ~63ULL)});
+        }
+        std::sort(chunks.begin(), chunks.end(), [](const Chunk& a, const Chunk& b){ return a.base < b.base; });
+        capacity = chunks.size() * CHUNK_SIZE;
+    }
+
+    /// Return the slab to the pool
+    void release(Pool* pool, uint16_t self_id){
+        for(Chunk& c : chunks){
+            pool->template Deallocate<uint8_t>(remus::rdma::rdma_ptr<uint8_t>(self_id, c.reserved), CHUNK_SIZE + 64);
+        }
+        chunks.clear();
+        capacity = 0;
+    }
+
+    /// If the address is a copy from this slab
+    inline bool owns(uint64_t address){
+        if (chunks.empty()) return false;
+        auto it = std::upper_bound(chunks.begin(), chunks.end(), address, [](uint64_t a, const Chunk& c){ return a < (uint64_t) c.base; });
+        if (it == chunks.begin()) return false;
+        it--;
+        return address < (uint64_t) it->base + CHUNK_SIZE;
+    }
+
+    /// Allocate bytes out of the slab, or nullptr if the slab can't serve it
+    uint8_t* allocate(uint64_t bytes){
+        if (chunks.empty()) return nullptr;
+        int c = size_class(bytes);
+        if (c > MAX_CLASS) return nullptr;
+        {
+            SizeClass& size = classes[c - MIN_CLASS];
+            std::lock_guard<std::mutex> guard(size.lock);
+            std::vector<uint8_t*>& list = size.freelist;
+            if (!list.empty()){
+                uint8_t* result = list.back();
+                list.pop_back();
+                return result;
+            }
+        }
+        while (true){
+            uint64_t offset = head.fetch_add(1ULL << c);
+            if (offset + (1ULL << c) > capacity) return nullptr; // full (leave head past the end)
+            if ((offset % CHUNK_SIZE) + (1ULL << c) > CHUNK_SIZE) continue; // would straddle two chunks, skip the tail of the chunk
+            return chunks[offset / CHUNK_SIZE].base + (offset % CHUNK_SIZE);
+        }
+    }
+
+    /// Free a copy allocated with allocate(bytes)
+    void deallocate(uint8_t* ptr, uint64_t bytes){
+        int c = size_class(bytes);
+        SizeClass& size = classes[c - MIN_CLASS];
+        std::lock_guard<std::mutex> guard(size.lock);
+        size.freelist.push_back(ptr);
+    }
+};
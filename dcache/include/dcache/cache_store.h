@@ -1,7 +1,10 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <cstdint>
+#include <cstring>
+#include <memory>
 #include <remus/logging/logging.h>
 #include <remus/rdma/memory_pool.h>
 #include <remus/rdma/rdma.h>
@@ -9,6 +12,8 @@
 #include <vector>
 
 #include "object_pool.h"
+#include "cache_hash.h"
+#include "cache_memory.h"
 #include "cached_ptr.h"
 #include "mark_ptr.h"
 #include "metrics.h"
@@ -20,6 +25,7 @@ using namespace remus::rdma;
 // #define EXPERIMENTAL true // (only used if USE_RW_LOCK is true, invalidate locally by acquiring shared-lock instead of exclusive-lock)
 #define ASYNC_INVALIDATE true // async invalidate other cache lines
 #define PRIORITY true
+// #define RECORD_TRACE true // record the addresses read through the cache (see dump_trace and dcache/bench/hash_quality.cc)
 
 #ifdef USE_RW_LOCK
 #include <shared_mutex>
@@ -27,6 +33,8 @@ using namespace remus::rdma;
 #include <mutex>
 #endif
 
+#include <fstream>
+
 typedef std::atomic<int> ref_t;
 
 class Object {};
@@ -40,6 +48,21 @@ struct DeallocTask {
     DeallocTask(rdma_ptr<Object> ptr, int size, ref_t* counter) : local_ptr(ptr), size(size), ref_counter(counter) {}
 };
 
+/// A write buffered in a write scope, waiting for Commit
+struct PendingWrite {
+    uint64_t ptr; // the raw (possibly marked) destination
+    int bytes;
+    void* value; // the latest value written (sizeof(T) bytes)
+    internal::RDMAWriteBehavior write_behavior; // of the latest write
+    std::function<void(internal::RDMAWriteBehavior)> commit; // write the value through the cache and free it
+};
+
+/// Thread-local state of a write scope
+struct WriteScope {
+    int depth = 0;
+    vector<PendingWrite> pending;
+};
+
 inline ref_t* ref_generator(){
     ref_t* ref = new ref_t(0);
     return ref;
@@ -69,33 +92,108 @@ struct alignas(64) CacheLine {
 
 static_assert(offsetof(CacheLine, address) == 0);
 
-template <typename Pool = rdma_capability_thread>
+/// The root of a cache. Lists the line arrays of every replica so peers can invalidate all of them
+struct alignas(64) CacheDirectory {
+    static constexpr int MAX_REPLICAS = 7;
+    uint64_t replicas;
+    uint64_t roots[MAX_REPLICAS];
+};
+
+/// Hash is a policy from cache_hash.h that decides which line an address maps to
+template <typename Pool = rdma_capability_thread, typename Hash = Mix13Modulo>
 class RemoteCacheImpl {
 private:
-    rdma_ptr<CacheLine> origin_address;
+    rdma_ptr<CacheDirectory> directory;
+    /// The line arrays of the peers' replicas
     vector<rdma_ptr<CacheLine>> remote_caches;
-    CacheLine* lines;
+    /// One line array per replica (replicas are on the same node and kept coherent by a local fan-out)
+    vector<rdma_ptr<CacheLine>> origin_addresses;
+    vector<CacheLine*> replicas;
     int number_of_lines;
+    /// Number of nodes in the clique (not replicas)
+    int node_count = 1;
 
     std::mutex init_lock;
+    vector<rdma_ptr<CacheDirectory>> peer_directories;
     vector<rdma_ptr<uint64_t>> prealloc_cas_result;
     uint16_t self_id;
+    /// Per-node offset into the lines (so each node's objects start in a different region of the cache)
+    /// Precomputed in init to keep the division off of the hot path. hash reads it without the init lock, so a new table is published atomically
+    /// and the tables it replaced are kept until the cache is destroyed (a reader may still be using one)
+    std::atomic<const vector<uint64_t>*> node_offsets;
+    vector<std::unique_ptr<const vector<uint64_t>>> offset_tables;
+
+    /// Publish the offsets for a number of nodes (called with the init lock held)
+    void publish_offsets(int nodes){
+        vector<uint64_t>* offsets = new vector<uint64_t>();
+        for(int i = 0; i < nodes; i++){
+            offsets->push_back(node_offset(i, nodes));
+        }
+        offset_tables.emplace_back(offsets);
+        node_offsets.store(offsets, std::memory_order_release);
+    }
+
+    #ifdef RECORD_TRACE
+    static thread_local vector<uint64_t> trace;
+    #endif
+    static thread_local WriteScope write_scope;
+
+    /// Find the pending write to ptr (or nullptr if ptr is not buffered)
+    inline PendingWrite* find_pending(uint64_t raw){
+        for(PendingWrite& p : write_scope.pending){
+            if (p.ptr == raw) return &p;
+        }
+        return nullptr;
+    }
+
+    /// Write a single buffered write through the cache and remove it from the scope
+    void flush_pending(uint64_t raw){
+        for(auto it = write_scope.pending.begin(); it != write_scope.pending.end(); it++){
+            if (it->ptr != raw) continue;
+            PendingWrite p = std::move(*it);
+            write_scope.pending.erase(it);
+            int depth = write_scope.depth;
+            write_scope.depth = 0; // write through
+            p.commit(internal::RDMAWriteWithAck);
+            write_scope.depth = depth;
+            return;
+        }
+    }
 
     template <typename T>
-    uint64_t hash(rdma_ptr<T> ptr){
-        uint64_t ids_n = remote_caches.size() + 1;
-        uint64_t offset = ((double) number_of_lines / ids_n) * ptr.id();
-        uint64_t hashed = ptr.address() / 64;
+    inline uint64_t hash(rdma_ptr<T> ptr){
+        uint16_t id = ptr.id();
+        const vector<uint64_t>& offsets = *node_offsets.load(std::memory_order_acquire);
+        uint64_t offset = id < offsets.size() ? offsets[id] : node_offset(id, offsets.size());
+        return Hash::index(ptr.address(), offset, number_of_lines);
+    }
+
+    uint64_t node_offset(uint16_t id, uint64_t ids_n){
+        return (uint64_t) (((double) number_of_lines / ids_n) * id) % number_of_lines;
+    }
+
+    #ifdef USE_RW_LOCK
+    typedef std::shared_mutex line_mutex;
+    #else
+    typedef std::mutex line_mutex;
+    #endif
+    /// Local memory for the line locks of each replica (only if CacheOptions asked for huge pages, a NUMA node or replicas)
+    vector<LocalArena*> arenas;
+    /// RDMA memory for the cached copies (only if CacheOptions reserved a slab)
+    CopySlab<Pool> copies;
 
-        // mix13
-        hashed ^= (hashed >> 33);
-        hashed *= 0xff51afd7ed558ccd;
-        hashed ^= (hashed >> 33);
-        hashed *= 0xc4ceb9fe1a85ec53;
-        hashed ^= (hashed >> 33);
+    /// Memory to read a copy into (nullptr lets the pool allocate it)
+    template <typename T>
+    inline rdma_ptr<T> alloc_copy(int size){
+        uint8_t* slot = copies.allocate(sizeof(T) * size);
+        if (slot == nullptr) return nullptr;
+        return rdma_ptr<T>(self_id, (T*) slot);
+    }
 
-        // we know information about the addresses, can we get closer to ideal
-        return (hashed + offset) % number_of_lines;
+    /// Free a copy (from the slab or from the pool)
+    inline void free_copy(rdma_ptr<Object> ptr, int size){
+        if (copies.owns(ptr.address())) copies.deallocate((uint8_t*) ptr.address(), size);
+        else pool->template Deallocate<Object>(ptr, size);
     }
 
     // Attempt to free some elements
@@ -106,7 +204,7 @@ private:
                 dealloc_pool.release(t); // add it back for later
                 return;
             }
-            pool->template Deallocate<Object>(t.local_ptr, t.size);
+            free_copy(t.local_ptr, t.size);
             reference_pool.release(t.ref_counter);
         }
     }
@@ -118,7 +216,7 @@ private:
         if(reference_counter->load() == 0){
             // Then deallocate immediately
             if (ptr != nullptr)
-                pool->template Deallocate<Object>(ptr, size);
+                free_copy(ptr, size);
             reference_pool.release(reference_counter);
         } else {
             // Send it to the pool to release if a real deallocation
@@ -129,39 +227,53 @@ private:
         }
     }
 
+    /// The lines of the replica for the calling thread's NUMA node
+    inline CacheLine* thread_lines(){
+        if (replicas.size() == 1) return replicas[0];
+        return replicas[thread_numa_node() % replicas.size()];
+    }
+
     int calculate_bytes(){
         int count = 0;
-        for(int i = 0; i < number_of_lines; i++){
-            if (lines[i].address != 0) {
-                count += lines[i].size;
+        for(CacheLine* lines : replicas){
+            for(int i = 0; i < number_of_lines; i++){
+                if (lines[i].address != 0) {
+                    count += lines[i].size;
+                }
             }
         }
         return count;
     }
 
     template <class T>
-    void invalidate(CacheLine* l, rdma_ptr<T> ptr, internal::RDMAWriteBehavior write_behavior = internal::RDMAWriteWithAck){
-        // Invalidate locally
-        #ifdef EXPERIMENTAL
-        l->mu->lock_shared();
-        #else
-        l->mu->lock();
-        #endif
-        if ((l->address & ~mask) == ptr.raw()){
-            // todo?
-            l->address = l->address | mask;
+    void invalidate(rdma_ptr<T> ptr, internal::RDMAWriteBehavior write_behavior = internal::RDMAWriteWithAck){
+        // every replica and every peer maps the ptr to the same line
+        uint64_t line = hash(ptr);
+
+        // Invalidate locally (in every replica)
+        for(CacheLine* lines : replicas){
+            CacheLine* l = &lines[line];
+            #ifdef EXPERIMENTAL
+            l->mu->lock_shared();
+            #else
+            l->mu->lock();
+            #endif
+            if ((l->address & ~mask) == ptr.raw()){
+                // todo?
+                l->address = l->address | mask;
+            }
+            #ifdef EXPERIMENTAL
+            l->mu->unlock_shared();
+            #else
+            l->mu->unlock();
+            #endif
         }
-        #ifdef EXPERIMENTAL
-        l->mu->unlock_shared();
-        #else
-        l->mu->unlock();
-        #endif
 
         // Invalidate the other caches
         uint64_t ids[remote_caches.size()];
         for(int i = 0; i < remote_caches.size(); i++){
             // CAS the remote cache's address to have the mask
-            rdma_ptr<uint64_t> cache_line = static_cast<rdma_ptr<uint64_t>>(remote_caches[i][hash(ptr)]);
+            rdma_ptr<uint64_t> cache_line = static_cast<rdma_ptr<uint64_t>>(remote_caches[i][line]);
             #ifdef ASYNC_INVALIDATE
             if (write_behavior == remus::rdma::internal::RDMAWriteWithAck){
                 // batched compare and swap
@@ -197,24 +309,41 @@ public:
     /// Construct a remote cache object for RDMA
     /// - initializer: The pool to initialize with 
     /// - self_id: The id of the node the cache is running on. 
-    /// - number_of_lines: The initial number of lines in the cache. This can change dynamically
-    RemoteCacheImpl(Pool* intializer, uint16_t self_id, int number_of_lines = 2000) : self_id(self_id) {
+    /// - number_of_lines: The initial number of lines in the cache. This can change dynamically. The hash policy may round it up
+    /// - options: Page size, NUMA placement and replication of the cache's memory (see CacheOptions)
+    RemoteCacheImpl(Pool* intializer, uint16_t self_id, int number_of_lines = 2000, CacheOptions options = CacheOptions()) : self_id(self_id) {
         static_assert(sizeof(Object) == 1, "Precondition");
-        this->number_of_lines = number_of_lines;
-        origin_address = intializer->template Allocate<CacheLine>(number_of_lines);
-        REMUS_INFO("CacheLine start: {}, CacheLine end: {}", origin_address, origin_address + number_of_lines);
-        lines = (CacheLine*) origin_address.address();
-        for(int i = 0; i < number_of_lines; i++){
-            lines[i].address = 0;
-            lines[i].priority = INT_MAX; // want to always replace this empty line
-            lines[i].local_ptr = nullptr;
-            lines[i].ref_counter = reference_pool.fetch();
-            lines[i].ref_counter->store(0);
-            #ifdef USE_RW_LOCK
-            lines[i].mu = new std::shared_mutex();
-            #else
-            lines[i].mu = new std::mutex();
-            #endif
+        REMUS_ASSERT(options.replicas >= 1 && options.replicas <= CacheDirectory::MAX_REPLICAS, "Invalid number of replicas {}", options.replicas);
+        this->number_of_lines = Hash::lines(number_of_lines);
+        number_of_lines = this->number_of_lines;
+        publish_offsets(1);
+        directory = intializer->template Allocate<CacheDirectory>();
+        directory->replicas = options.replicas;
+        copies.reserve(intializer, options.copy_slab_bytes);
+        for(int r = 0; r < options.replicas; r++){
+            rdma_ptr<CacheLine> origin_address = intializer->template Allocate<CacheLine>(number_of_lines);
+            REMUS_INFO("CacheLine start: {}, CacheLine end: {}", origin_address, origin_address + number_of_lines);
+            CacheLine* lines = (CacheLine*) origin_address.address();
+            origin_addresses.push_back(origin_address);
+            replicas.push_back(lines);
+            directory->roots[r] = origin_address.raw();
+
+            line_mutex* mutexes = nullptr;
+            if (options.huge_pages || options.numa_node != CacheOptions::NO_NUMA || options.replicas > 1){
+                // keep the line locks together on (huge) pages of the requested node (a replica's locks are on the replica's node)
+                CacheOptions replica_options = options;
+                if (options.replicas > 1) replica_options.numa_node = r;
+                arenas.push_back(new LocalArena(sizeof(line_mutex) * number_of_lines, replica_options));
+                mutexes = arenas.back()->template allocate<line_mutex>(number_of_lines);
+            }
+            for(int i = 0; i < number_of_lines; i++){
+                lines[i].address = 0;
+                lines[i].priority = INT_MAX; // want to always replace this empty line
+                lines[i].local_ptr = nullptr;
+                lines[i].ref_counter = reference_pool.fetch();
+                lines[i].ref_counter->store(0);
+                lines[i].mu = mutexes == nullptr ? new line_mutex() : new (&mutexes[i]) line_mutex();
+            }
         }
         reset_metrics();
     }
@@ -230,51 +359,71 @@ public:
 
     /// Ideally, the remote cache is deconstructed in a higher scope so that no pending reference counters still refer to any elements
     ~RemoteCacheImpl(){
-        for(int i = 0; i < number_of_lines; i++){
-            // Deallocate forcefully, even if we have references to the object
-            if (lines[i].ref_counter != nullptr){
-                int c = lines[i].ref_counter->load();
-                REMUS_ASSERT(c <= 1, "RemoteCache deconstructor called before CachedObjects left scope {}", c);
+        for(int r = 0; r < replicas.size(); r++){
+            CacheLine* lines = replicas[r];
+            for(int i = 0; i < number_of_lines; i++){
+                // Deallocate forcefully, even if we have references to the object
+                if (lines[i].ref_counter != nullptr){
+                    int c = lines[i].ref_counter->load();
+                    REMUS_ASSERT(c <= 1, "RemoteCache deconstructor called before CachedObjects left scope {}", c);
+                }
+                if (lines[i].local_ptr != nullptr)
+                    free_copy(lines[i].local_ptr, lines[i].size);
+                delete lines[i].ref_counter; // delete the ptr to the atomic int
+            }
+            if (!arenas.empty()){
+                for(int i = 0; i < number_of_lines; i++) lines[i].mu->~line_mutex();
+                delete arenas[r];
             }
-            if (lines[i].local_ptr != nullptr)
-                pool->template Deallocate<Object>(lines[i].local_ptr, lines[i].size);
-            delete lines[i].ref_counter; // delete the ptr to the atomic int
+            pool->Deallocate(origin_addresses[r], number_of_lines);
         }
-        pool->Deallocate(origin_address, number_of_lines);
+        copies.release(pool, self_id);
+        pool->Deallocate(directory);
 
         for(int i = 0; i < prealloc_cas_result.size(); i++){
-            pool->template Deallocate<uint64_t>(prealloc_cas_result.at(i), 8);
+            pool->template Deallocate<uint64_t>(prealloc_cas_result.at(i));
         }
     }
 
-    /// Get the root of the constructed cache
+    /// Get the root of the constructed cache (its directory)
     uint64_t root(){
-        return origin_address.raw();
+        return directory.raw();
     }
 
     /// Initialize the cache with the roots of the other caches
     void init(vector<uint64_t> peer_roots, int expected_length){
         init_lock.lock();
         for(int i = 0; i < peer_roots.size(); i++){
-            rdma_ptr<CacheLine> p = rdma_ptr<CacheLine>(peer_roots[i]);
+            rdma_ptr<CacheDirectory> p = rdma_ptr<CacheDirectory>(peer_roots[i]);
             // don't mess with local cache
             if (p.raw() == root()) continue;
             if (pool->is_local(p)) continue;
 
             // avoid duplicates
             bool is_dupl = false;
-            for(int i = 0; i < remote_caches.size(); i++){
-                if (remote_caches[i] == p) is_dupl = true;
+            for(int i = 0; i < peer_directories.size(); i++){
+                if (peer_directories[i] == p) is_dupl = true;
             }
             if (!is_dupl){
-                remote_caches.push_back(p);
-                prealloc_cas_result.push_back(pool->template Allocate<uint64_t>());
+                peer_directories.push_back(p);
+                // Read the peer's directory to find all of its replicas
+                rdma_ptr<CacheDirectory> peer = pool->template Read<CacheDirectory>(p);
+                for(int r = 0; r < peer->replicas; r++){
+                    remote_caches.push_back(rdma_ptr<CacheLine>(peer->roots[r]));
+                    prealloc_cas_result.push_back(pool->template Allocate<uint64_t>());
+                }
+                pool->template Deallocate<CacheDirectory>(peer);
             }
         }
+        // Recompute the offsets if we learned of new nodes (node ids are 0..n-1). Every thread calls init, usually with the same peers
+        if (node_count != peer_directories.size() + 1){
+            node_count = peer_directories.size() + 1;
+            publish_offsets(node_count);
+        }
         init_lock.unlock();
         // +1 to include themselves
-        REMUS_INFO("Number of peers in CacheClique {}", remote_caches.size() + 1);
-        if (remote_caches.size() != expected_length){
+        REMUS_INFO("Number of peers in CacheClique {} ({} replicas)", peer_directories.size() + 1, remote_caches.size() + replicas.size());
+        if (peer_directories.size() != expected_length){
             REMUS_ERROR("Incorrect # of remote caches");
             abort();
         }
@@ -288,7 +437,7 @@ public:
             DeallocTask t = dealloc_pool.fetch();
             REMUS_ASSERT(t.ref_counter->load() <= 1, "free_all_tmp_objects called before CachedObjects left scope {}", t.ref_counter->load());
             if (t.local_ptr == nullptr) continue;
-            pool->template Deallocate<Object>(t.local_ptr, t.size);
+            free_copy(t.local_ptr, t.size);
             delete t.ref_counter;
         }
     }
@@ -296,8 +445,10 @@ public:
     /// Not thread safe. Use aside from operations
     int count_empty_lines(){
         int count = 0;
-        for(int i = 0; i < number_of_lines; i++){
-            if (lines[i].address == 0) count++;
+        for(CacheLine* lines : replicas){
+            for(int i = 0; i < number_of_lines; i++){
+                if (lines[i].address == 0) count++;
+            }
         }
         metrics.empty_lines = count;
         return count;
@@ -308,7 +459,7 @@ public:
         int empty_lines = count_empty_lines();
         int size_of_cache = calculate_bytes();
         REMUS_INFO("{}{}", indication, metrics.as_string());
-        REMUS_INFO("Cache ({} lines) consumes {} KB", number_of_lines - empty_lines, (double) size_of_cache / 1000.0);
+        REMUS_INFO("Cache ({} lines) consumes {} KB", number_of_lines * replicas.size() - empty_lines, (double) size_of_cache / 1000.0);
     }
 
     /// Resets the thread-local metrics
@@ -316,6 +467,107 @@ public:
         metrics = CacheMetrics();
     }
 
+    /// The number of lines in the cache (after the hash policy rounded it)
+    int size(){
+        return number_of_lines;
+    }
+
+    /// The bytes of the copies held by the lines (in every replica). Not thread safe
+    int occupancy(){
+        return calculate_bytes();
+    }
+
+    /// Not thread safe. Use aside from operations (i.e. at shutdown)
+    /// Save the address, size and priority of every valid line to a file, so a restarted node can prefetch them (see prefetch_lines)
+    /// Also saves the root of the structure the lines are of and the directory of every node, which identify the run the addresses are valid in
+    /// @param structure the root pointer of the structure (the lines are only prefetched into the same structure)
+    void dump_lines(std::string filename, uint64_t structure){
+        std::ofstream out(filename, std::ios::trunc);
+        out << "structure " << structure << "\n";
+        out << "node " << self_id << " " << root() << "\n";
+        for(rdma_ptr<CacheDirectory> peer : peer_directories){
+            out << "node " << peer.id() << " " << peer.raw() << "\n";
+        }
+        int count = 0;
+        for(CacheLine* lines : replicas){
+            for(int i = 0; i < number_of_lines; i++){
+                if (lines[i].address == 0 || (lines[i].address & mask)) continue;
+                out << "line " << lines[i].address << " " << lines[i].size << " " << lines[i].priority << "\n";
+                count++;
+            }
+        }
+        out.close();
+        REMUS_INFO("Saved {} lines to {}", count, filename);
+    }
+
+    /// Read a saved line into the cache (letting the reference go, the line keeps the copy)
+    /// The pool aligns a copy to the type read, so it's read in the largest unit dividing it, to be aligned like the object that was cached
+    void prefetch_line(rdma_ptr<Object> ptr, int size, int priority){
+        struct alignas(64) block_t { uint8_t bytes[64]; };
+        if (size % sizeof(block_t) == 0){
+            ExtendedRead<block_t>(mark_ptr(static_cast<rdma_ptr<block_t>>(ptr)), size / sizeof(block_t), nullptr, priority);
+        } else if (size % sizeof(uint64_t) == 0){
+            ExtendedRead<uint64_t>(mark_ptr(static_cast<rdma_ptr<uint64_t>>(ptr)), size / sizeof(uint64_t), nullptr, priority);
+        } else {
+            ExtendedRead<Object>(mark_ptr(ptr), size, nullptr, priority);
+        }
+    }
+
+    /// Prefetch the lines saved by dump_lines (call once the structure is initialized and populated, before the clients start)
+    /// Nothing is prefetched unless the snapshot is of the same structure (a new structure reuses the addresses for different objects).
+    /// Then only lines from nodes whose cache has the same directory as when dumped are prefetched. A node that restarted has a new directory and its addresses name different objects.
+    /// Each line is read through the normal protocol, so later writes invalidate it as usual.
+    /// Threads can split the work by prefetching every stride-th line starting at index
+    /// @param structure the root pointer of the structure being run
+    /// Returns the number of lines prefetched
+    int prefetch_lines(std::string filename, uint64_t structure, int index = 0, int stride = 1){
+        std::ifstream in(filename);
+        if (!in.is_open()) return 0;
+        std::string kind;
+        uint64_t saved = 0;
+        if (!(in >> kind >> saved) || kind != "structure" || saved != structure){
+            REMUS_INFO("Not prefetching {}, it is a snapshot of another structure", filename);
+            return 0;
+        }
+        // which nodes are unchanged since the dump
+        vector<uint64_t> current = {root()};
+        for(rdma_ptr<CacheDirectory> peer : peer_directories) current.push_back(peer.raw());
+        vector<uint16_t> valid_ids;
+
+        int count = 0, n = 0;
+        while (in >> kind){
+            if (kind == "node"){
+                uint64_t id, dir;
+                in >> id >> dir;
+                for(uint64_t c : current){
+                    if (c == dir && id != self_id) valid_ids.push_back(id);
+                }
+            } else {
+                uint64_t address;
+                int size, priority;
+                in >> address >> size >> priority;
+                rdma_ptr<Object> ptr = rdma_ptr<Object>(address);
+                if (std::find(valid_ids.begin(), valid_ids.end(), ptr.id()) == valid_ids.end()) continue;
+                if (n++ % stride != index) continue;
+                prefetch_line(ptr, size, priority);
+                count++;
+            }
+        }
+        REMUS_INFO("Prefetched {} lines from {}", count, filename);
+        return count;
+    }
+
+    #ifdef RECORD_TRACE
+    /// Append the addresses this thread read through the cache to a file (one raw rdma_ptr per line)
+    /// Can be replayed with dcache/bench/hash_quality.cc
+    void dump_trace(std::string filename){
+        std::ofstream out(filename, std::ios::app);
+        for(uint64_t raw : trace) out << raw << "\n";
+        out.close();
+        trace.clear();
+    }
+    #endif
+
     /// Read data in. Lower priority is prioritized (root is 0 priority!)
     template <typename T>
     inline CachedObject<T> Read(rdma_ptr<T> ptr, rdma_ptr<T> prealloc = nullptr, int priority = 0){
@@ -327,6 +579,25 @@ public:
         REMUS_ASSERT_DEBUG(ptr_m != nullptr, "Cant read nullptr");
         // Periodically call try_free_some to cleanup limbo lists
         try_free_some();
+        #ifdef RECORD_TRACE
+        if (is_marked(ptr_m)) trace.push_back(unmark_ptr(ptr_m).raw());
+        #endif
+        if (write_scope.depth != 0 && !write_scope.pending.empty()){
+            PendingWrite* p = find_pending(ptr_m.raw());
+            if (p != nullptr && p->bytes == sizeof(T) * size){
+                // read our own buffered write
+                rdma_ptr<T> result = prealloc == nullptr ? pool->template Allocate<T>(size) : prealloc;
+                memcpy((T*) result.address(), p->value, p->bytes);
+                metrics.allocation++;
+                return CachedObject<T>(ptr_m, result, [=](){
+                    if (result != prealloc){ // don't accidentally deallocate prealloc
+                        pool->template Deallocate<T>(result, size);
+                    }
+                });
+            } else if (p != nullptr) {
+                flush_pending(ptr_m.raw()); // reading a different extent of the object, so write it out first
+            }
+        }
     
         // todo: do i need to mark the cache line as volatile?
         retry:
@@ -336,7 +607,7 @@ public:
         if (is_marked(ptr_m)){
             // Get cache line and lock
             rdma_ptr<T> ptr = unmark_ptr(ptr_m);
-            CacheLine* l = &lines[hash(ptr)];
+            CacheLine* l = &thread_lines()[hash(ptr)];
             #ifdef USE_RW_LOCK
             l->mu->lock_shared();
             bool acquired_wlock = false;
@@ -364,7 +635,7 @@ public:
                     atomic_thread_fence(std::memory_order_seq_cst);
 
                     // Read the new object into the local ptr
-                    rdma_ptr<T> data = pool->template ExtendedRead<T>(ptr, size);
+                    rdma_ptr<T> data = pool->template ExtendedRead<T>(ptr, size, alloc_copy<T>(size));
                     handle_free(l->local_ptr, l->size, l->ref_counter); // free the old data
                     l->local_ptr = static_cast<rdma_ptr<Object>>(data);
                     l->priority = priority;
@@ -421,7 +692,7 @@ public:
                 atomic_thread_fence(std::memory_order_seq_cst);
 
                 // Then read the data and update the cache line
-                rdma_ptr<T> data = pool->template ExtendedRead<T>(ptr, size);
+                rdma_ptr<T> data = pool->template ExtendedRead<T>(ptr, size, alloc_copy<T>(size));
                 handle_free(l->local_ptr, l->size, l->ref_counter); // free the old data
                 l->local_ptr = static_cast<rdma_ptr<Object>>(data);
                 l->size = size * sizeof(T);
@@ -472,17 +743,33 @@ public:
 
     template <typename T>
     void Write(rdma_ptr<T> ptr, const T& val, rdma_ptr<T> prealloc = nullptr, internal::RDMAWriteBehavior write_behavior = internal::RDMAWriteWithAck){
+        if (write_scope.depth != 0){
+            // Buffer the write until Commit
+            PendingWrite* p = find_pending(ptr.raw());
+            if (p != nullptr && p->bytes == sizeof(T)){
+                *((T*) p->value) = val;
+                p->write_behavior = write_behavior;
+                metrics.combined_writes++;
+                return;
+            } else if (p != nullptr){
+                flush_pending(ptr.raw()); // a differently sized write to the same address, keep them in order
+            }
+            T* value = new T(val);
+            write_scope.pending.push_back(PendingWrite{ptr.raw(), sizeof(T), value, write_behavior, [=, this](internal::RDMAWriteBehavior behavior){
+                Write(ptr, *value, prealloc, behavior);
+                delete value;
+            }});
+            return;
+        }
         if (is_marked(ptr)){
-            // Get cache line and lock it
             ptr = unmark_ptr(ptr);
-            CacheLine* l = &lines[hash(ptr)];
 
             // write to the value in the owner
             pool->Write(ptr, val, prealloc);
             metrics.remote_writes++;
 
             // Invalidate
-            invalidate(l, ptr, write_behavior);
+            invalidate(ptr, write_behavior);
         } else {
             // write normally
             pool->Write(ptr, val, prealloc, write_behavior);
@@ -497,12 +784,55 @@ public:
         if (!is_marked(ptr)) {
             return; // if the ptr is not marked, don't invalidate the object
         }
-        // Get the cache line
+        // A buffered write will invalidate at Commit
+        if (write_scope.depth != 0 && find_pending(ptr.raw()) != nullptr) return;
         ptr = unmark_ptr(ptr);
-        CacheLine* l = &lines[hash(ptr)];
 
         // Invalidate
-        invalidate(l, ptr);
+        invalidate(ptr);
+    }
+
+    /// Drop the node's copy of an object, in every replica (the copy is freed once no CachedObject refers to it)
+    /// Unlike Invalidate, the line is emptied so the copy stops taking up memory. The peers' caches keep their copies
+    template <typename T>
+    void Evict(rdma_ptr<T> ptr){
+        ptr = unmark_ptr(ptr);
+        uint64_t line = hash(ptr);
+        for(CacheLine* lines : replicas){
+            CacheLine* l = &lines[line];
+            l->mu->lock();
+            if ((l->address & ~mask) == ptr.raw()){
+                // swap like a miss does, since the peers CAS the address to invalidate it
+                rdma_ptr<uint64_t> cache_line = rdma_ptr<uint64_t>(self_id, (uint64_t) l);
+                pool->template AtomicSwap<uint64_t>(cache_line, 0, l->address);
+                handle_free(l->local_ptr, l->size, l->ref_counter);
+                l->local_ptr = nullptr;
+                l->priority = INT_MAX;
+                l->ref_counter = reference_pool.fetch();
+                l->ref_counter->store(0);
+            }
+            l->mu->unlock();
+        }
+    }
+
+    /// Start a write-combining scope for this thread (scopes can nest, only the outermost Commit writes)
+    /// Until Commit, writes are buffered locally and repeated writes to the same object only keep the final value.
+    /// Reads of a buffered object (of the same size) observe the buffered value.
+    /// The caller must hold whatever lock protects the objects, and must not write the object through the pool directly (i.e. unlocking) until after Commit
+    void BeginWriteScope(){
+        write_scope.depth++;
+    }
+
+    /// Write (and invalidate) every object buffered in the scope once, in the order they were first written
+    /// Every write but the last is acknowledged, so prealloc buffers can be reused. The last uses the behavior of its final write
+    void Commit(){
+        REMUS_ASSERT_DEBUG(write_scope.depth > 0, "Commit without BeginWriteScope");
+        if (--write_scope.depth != 0) return;
+        vector<PendingWrite> pending = std::move(write_scope.pending);
+        write_scope.pending.clear();
+        for(size_t i = 0; i < pending.size(); i++){
+            pending[i].commit(i == pending.size() - 1 ? pending[i].write_behavior : internal::RDMAWriteWithAck);
+        }
     }
 };
 
@@ -510,4 +840,8 @@ typedef RemoteCacheImpl<> RemoteCache;
 template<> inline thread_local CacheMetrics RemoteCache::metrics = CacheMetrics();
 template<> inline thread_local rdma_capability_thread* RemoteCache::pool = nullptr;
 
-template<class T> inline thread_local bool RemoteCacheImpl<T>::is_leader = false;
\ No newline at end of file
+template<class T, class H> inline thread_local bool RemoteCacheImpl<T, H>::is_leader = false;
+template<class T, class H> inline thread_local WriteScope RemoteCacheImpl<T, H>::write_scope = WriteScope();
+#ifdef RECORD_TRACE
+template<class T, class H> inline thread_local vector<uint64_t> RemoteCacheImpl<T, H>::trace = vector<uint64_t>();
+#endif
\ No newline at end of file
@@ -27,6 +27,8 @@ struct CacheMetrics {
     int empty_lines;
     /// Invalidations
     int successful_invalidations;
+    /// A write that was combined with a later write to the same object (inside a write scope)
+    int combined_writes;
 
     CacheMetrics(){
         remote_reads = 0;
@@ -41,6 +43,7 @@ struct CacheMetrics {
         empty_lines = 0;
         successful_invalidations = 0;
         priority_misses = 0;
+        combined_writes = 0;
     }
 
     std::string as_string() {
@@ -58,6 +61,7 @@ struct CacheMetrics {
         ss += "  <CacheHits = " + std::to_string(hits) + "/>\n";
         ss += "  <EmptyLines = " + std::to_string(empty_lines) + "/>\n";
         ss += "  <Invalidations = " + std::to_string(successful_invalidations) + "/>\n";
+        ss += "  <CombinedWrites = " + std::to_string(combined_writes) + "/>\n";
         ss += "</Metrics>\n";
         return ss;
     }
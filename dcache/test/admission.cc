@@ -0,0 +1,89 @@
+#include <remus/logging/logging.h>
+#include <remus/rdma/memory_pool.h>
+#include <remus/rdma/rdma.h>
+
+#include <dcache/cache_store.h>
+#include <dcache/cached_ptr.h>
+
+#include <vector>
+
+#include "../../iht/common.h"
+#include "faux_mempool.h"
+#include "../../iht/cached/ds/iht_ds_cached.h"
+
+using namespace remus::rdma;
+
+// Set remote cache static variables
+template<> inline thread_local CacheMetrics RemoteCacheImpl<CountingPool>::metrics = CacheMetrics();
+template<> inline thread_local CountingPool* RemoteCacheImpl<CountingPool>::pool = nullptr;
+
+typedef RdmaIHT<int, int, CNF_ELIST_SIZE, CNF_PLIST_SIZE, key_hash::Mix13Hash, CountingPool> IHT;
+
+/// The size of a level-1 PList
+const uint64_t PLIST_BYTES = CNF_PLIST_SIZE * sizeof(uint64_t) * 2;
+const int KEYS = 20000;
+
+/// Check the cache holds no more than the budget
+void check_occupancy(RemoteCacheImpl<CountingPool>* cache, IHT::Admission* admission, uint64_t budget){
+    REMUS_ASSERT(admission->get_charged() <= budget, "Admitted PLists within the budget ({} > {})", admission->get_charged(), budget);
+    REMUS_ASSERT(cache->occupancy() <= budget, "The cache holds PLists within the budget ({} > {})", cache->occupancy(), budget);
+}
+
+int main(){
+    REMUS_INIT_LOG();
+
+    CountingPool* pool = new CountingPool(0);
+    RemoteCacheImpl<CountingPool>* cache = new RemoteCacheImpl<CountingPool>(pool, 0);
+    cache->init({cache->root()}, 0); // initialize with itself
+    RemoteCacheImpl<CountingPool>::pool = pool;
+    Peer self = Peer(0);
+
+    // A budget of the root and one level-1 PList (twice the size of the root), while the cache depth marks far more
+    const uint64_t budget = 3 * PLIST_BYTES;
+    IHT::Admission* admission = new IHT::Admission(budget);
+    IHT* iht = new IHT(self, CacheDepth::UpToLayer2, cache, pool, nullptr, nullptr, nullptr, admission);
+    iht->InitAsFirst(pool);
+    // Before the first epoch, the PLists are admitted as they are tracked, until the budget is spent
+    for(int i = 0; i < KEYS; i++){
+        REMUS_ASSERT(!iht->insert(pool, i, i).has_value(), "Inserted key {}", i);
+        if (i % 100 == 0) check_occupancy(cache, admission, budget);
+    }
+    REMUS_ASSERT(cache->occupancy() > 0, "Cached some PLists");
+    REMUS_INFO("Test 1 -- PASSED");
+
+    // The hot PList changes (by the root bucket of the keys read), so the PList cached for the previous phase is demoted and evicted to make room
+    // The budget only fits the root and one level-1 PList, so the hot PList is only cached if the previous one was evicted
+    for(int phase = 0; phase < 4; phase++){
+        std::vector<int> keys;
+        for(int i = 0; i < KEYS; i++){
+            if (fastrange(key_hash::Mix13Hash::hash(i, 1), CNF_PLIST_SIZE - 1) == phase) keys.push_back(i);
+        }
+        int hot_reads = keys.size();
+        for(int i = 0; i < KEYS; i += 500) keys.push_back(i); // and some cold reads
+        // a few epochs of samples
+        for(int r = 0; r < 200; r++){
+            RemoteCacheImpl<CountingPool>::metrics = CacheMetrics();
+            for(int i : keys){
+                REMUS_ASSERT(iht->contains(pool, i).value_or(-1) == i, "Found key {}", i);
+            }
+            check_occupancy(cache, admission, budget);
+        }
+        // a hot read hits the root and the hot PList
+        REMUS_ASSERT(RemoteCacheImpl<CountingPool>::metrics.hits > hot_reads * 3 / 2, "Cached the hot PList of phase {} ({} hits for {} reads)", phase, RemoteCacheImpl<CountingPool>::metrics.hits, hot_reads);
+    }
+    REMUS_ASSERT(admission->get_threshold() > 0, "Adapted the cached PLists");
+    REMUS_INFO("Test 2 -- PASSED");
+
+    // Writes keep invalidating the cached PLists, which still count until they are evicted
+    for(int i = 0; i < 2000; i++){
+        REMUS_ASSERT(iht->remove(pool, i).value_or(-1) == i, "Removed key {}", i);
+        REMUS_ASSERT(!iht->insert(pool, i, i).has_value(), "Reinserted key {}", i);
+        if (i % 100 == 0) check_occupancy(cache, admission, budget);
+    }
+    REMUS_ASSERT(iht->count(pool) == KEYS, "Found every key");
+    REMUS_INFO("Test 3 -- PASSED");
+
+    iht->destroy(pool);
+    delete admission;
+    return 0;
+}
@@ -0,0 +1,255 @@
+#include <remus/logging/logging.h>
+#include <remus/rdma/memory_pool.h>
+#include <remus/rdma/rdma.h>
+
+#include <dcache/cache_store.h>
+#include <dcache/cached_ptr.h>
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "faux_mempool.h"
+#include "../../iht/cached/ds/btree_cached.h"
+
+using namespace remus::rdma;
+
+// Set remote cache static variables
+template<> inline thread_local CacheMetrics RemoteCacheImpl<CountingPool>::metrics = CacheMetrics();
+template<> inline thread_local CountingPool* RemoteCacheImpl<CountingPool>::pool = nullptr;
+
+/// A small degree, so the operations split and merge nodes often
+const int DEGREE = 4;
+const int THREADS = 4;
+/// Every thread inserts and removes its own share of the keys
+const int KEYS = 4000;
+/// The keys every thread inserts and removes at random (above the others, so they don't change the counts checked)
+const int SHARED_LOW = 10000;
+const int SHARED = 200;
+
+/// A btree of a layout and number of delta records, run by threads sharing a node's pool, cache and (optionally) lock table
+template <class Layout, int DELTAS>
+struct Tree {
+    using BTree = RdmaBPTree<int, DEGREE, CountingPool, Layout, DELTAS>;
+    using EBRLeaf = EBRObjectPool<typename BTree::BLeaf, 100, CountingPool>;
+    using EBRNode = EBRObjectPoolAccompany<typename BTree::BNode, typename BTree::BLeaf, 100, CountingPool>;
+
+    CountingPool* pool;
+    RemoteCacheImpl<CountingPool>* cache;
+    LockTable<CountingPool>* locks;
+    EBRLeaf* ebr_leaf;
+    EBRNode* ebr_node;
+
+    /// @param registrations how many threads will use the btree
+    Tree(bool lock_table, int registrations) {
+        pool = new CountingPool(true);
+        cache = new RemoteCacheImpl<CountingPool>(pool, 0);
+        cache->init({cache->root()}, 0); // initialize with itself
+        locks = lock_table ? new LockTable<CountingPool>(pool) : nullptr;
+        if (locks != nullptr) locks->init({locks->root()});
+        ebr_leaf = new EBRLeaf(pool, registrations);
+        ebr_node = new EBRNode(ebr_leaf);
+    }
+
+    /// Bind the calling thread and get its handle of the btree
+    BTree* enter() {
+        RemoteCacheImpl<CountingPool>::pool = pool;
+        ebr_leaf->RegisterThread();
+        ebr_node->RegisterThread();
+        Peer self = Peer(0);
+        return new BTree(self, CacheDepth::UpToLayer1, cache, pool, ebr_leaf, ebr_node, false, locks);
+    }
+
+    void destroy() {
+        if (locks != nullptr) locks->destroy(pool);
+    }
+};
+
+/// Concurrent inserts, removes, contains and scans
+template <class Layout, int DELTAS>
+void test_concurrent(bool lock_table, std::string name){
+    Tree<Layout, DELTAS> tree(lock_table, 2 * THREADS + 2);
+    using BTree = typename Tree<Layout, DELTAS>::BTree;
+    rdma_ptr<anon_ptr> root;
+    std::thread([&](){
+        BTree* first = tree.enter();
+        root = first->InitAsFirst(tree.pool);
+    }).join();
+
+    // Each thread inserts, finds and removes its keys while contending on the shared ones
+    std::vector<std::thread> threads;
+    for(int t = 0; t < THREADS; t++){
+        threads.emplace_back([&, t](){
+            BTree* btree = tree.enter();
+            btree->InitFromPointer(root);
+            std::mt19937 random(t);
+            for(int round = 0; round < 3; round++){
+                for(int i = t; i < KEYS; i += THREADS){
+                    REMUS_ASSERT(!btree->insert(tree.pool, i, i).has_value(), "{}: Inserted key {}", name, i);
+                }
+                for(int i = t; i < KEYS; i += THREADS){
+                    REMUS_ASSERT(btree->contains(tree.pool, i).value_or(-1) == i, "{}: Found key {}", name, i);
+                }
+                for(int i = 0; i < 2000; i++){
+                    int k = SHARED_LOW + random() % SHARED;
+                    if (random() % 2) btree->insert(tree.pool, k, k);
+                    else btree->remove(tree.pool, k);
+                }
+                for(int i = t; i < KEYS; i += THREADS){
+                    REMUS_ASSERT(btree->remove(tree.pool, i).value_or(-1) == i, "{}: Removed key {}", name, i);
+                }
+            }
+            for(int i = t; i < KEYS; i += THREADS){
+                REMUS_ASSERT(!btree->insert(tree.pool, i, i).has_value(), "{}: Reinserted key {}", name, i);
+            }
+        });
+    }
+    for(auto& t : threads) t.join();
+    threads.clear();
+
+    // Half of the threads scan the keys, while the others keep changing the shared keys
+    for(int t = 0; t < THREADS; t++){
+        threads.emplace_back([&, t](){
+            BTree* btree = tree.enter();
+            btree->InitFromPointer(root);
+            std::mt19937 random(THREADS + t);
+            for(int i = 0; i < 300; i++){
+                if (t % 2 == 1) {
+                    int k = SHARED_LOW + random() % SHARED;
+                    if (random() % 2) btree->insert(tree.pool, k, k);
+                    else btree->remove(tree.pool, k);
+                    continue;
+                }
+                int lo = random() % (KEYS + 200), hi = lo + random() % 300;
+                int prev = -1, found = 0;
+                btree->scan(tree.pool, lo, hi, [&](int k, int v){
+                    REMUS_ASSERT(k > prev && k >= lo && k <= hi && v == k, "{}: Scanned ({}, {}) in order in [{}, {}]", name, k, v, lo, hi);
+                    prev = k;
+                    found++;
+                });
+                int expected = std::max(0, std::min(hi, KEYS - 1) - lo + 1);
+                REMUS_ASSERT(found == expected, "{}: Scanned every key in [{}, {}] ({} != {})", name, lo, hi, found, expected);
+            }
+        });
+    }
+    for(auto& t : threads) t.join();
+
+    std::thread([&](){
+        BTree* btree = tree.enter();
+        btree->InitFromPointer(root);
+        for(int i = 0; i < KEYS; i++){
+            REMUS_ASSERT(btree->contains(tree.pool, i).value_or(-1) == i, "{}: Found key {} after the threads", name, i);
+        }
+        int count = btree->count(tree.pool);
+        REMUS_ASSERT(count >= KEYS && count <= KEYS + SHARED, "{}: Counted the keys ({})", name, count);
+        REMUS_ASSERT((int) btree->scan(tree.pool, INT_MIN + 1, INT_MAX - 1).size() == count, "{}: Scanned every key", name);
+        std::string valid = btree->valid();
+        REMUS_ASSERT(valid == "yes", "{}: The btree is valid ({})", name, valid);
+    }).join();
+    tree.destroy();
+    REMUS_INFO("{} -- PASSED", name);
+}
+
+/// Bulk-load the btree and use it like an inserted one
+template <class Layout, int DELTAS>
+void test_bulk(std::string name){
+    Tree<Layout, DELTAS> tree(false, 1);
+    using BTree = typename Tree<Layout, DELTAS>::BTree;
+    std::thread([&](){
+        BTree* btree = tree.enter();
+        for(int n : {0, 1, 2, 37, 1000, 20000}){
+            for(double fill : {0.1, 0.75, 1.0}){
+                // the even keys (out of order), with a repeated key of which the first pair is kept
+                std::vector<std::pair<int, int>> pairs;
+                for(int i = 0; i < n; i++) pairs.push_back({(i * 7919) % n * 2, i});
+                if (n != 0) pairs.push_back({0, -1});
+                btree->InitFromBulk(tree.pool, pairs, fill);
+                std::string valid = btree->valid();
+                REMUS_ASSERT(valid == "yes", "{}: The loaded btree is valid ({}, n={}, fill={})", name, valid, n, fill);
+                REMUS_ASSERT(btree->count(tree.pool) == n, "{}: Loaded every key (n={}, fill={})", name, n, fill);
+                std::vector<std::pair<int, int>> scanned = btree->scan(tree.pool, INT_MIN + 1, INT_MAX - 1);
+                REMUS_ASSERT((int) scanned.size() == n, "{}: Scanned every loaded key", name);
+                for(int i = 0; i < n; i++){
+                    REMUS_ASSERT(scanned[i].first == i * 2, "{}: Scanned the loaded keys in order", name);
+                }
+                for(int i = 0; i < n; i++){
+                    REMUS_ASSERT(btree->contains(tree.pool, (i * 7919) % n * 2).value_or(-2) == i, "{}: Found loaded key {}", name, (i * 7919) % n * 2);
+                    REMUS_ASSERT(!btree->contains(tree.pool, i * 2 + 1).has_value(), "{}: Didn't find odd key {}", name, i * 2 + 1);
+                }
+                // insert the odd keys in between and remove every other loaded key
+                for(int i = 0; i < n; i++){
+                    REMUS_ASSERT(!btree->insert(tree.pool, i * 2 + 1, i).has_value(), "{}: Inserted odd key {}", name, i * 2 + 1);
+                }
+                for(int i = 0; i < n; i += 2){
+                    REMUS_ASSERT(btree->remove(tree.pool, i * 2).has_value(), "{}: Removed loaded key {}", name, i * 2);
+                }
+                valid = btree->valid();
+                REMUS_ASSERT(valid == "yes", "{}: The loaded btree is valid after updates ({}, n={}, fill={})", name, valid, n, fill);
+                REMUS_ASSERT(btree->count(tree.pool) == n + n / 2, "{}: Counted the keys after updates (n={}, fill={})", name, n, fill);
+            }
+        }
+    }).join();
+    REMUS_INFO("{} -- PASSED", name);
+}
+
+/// A read of a leaf interleaving with its consolidation is torn, and is re-read instead of losing or reapplying its delta records
+template <class Layout>
+void test_torn(std::string name){
+    Tree<Layout, 8> tree(false, 1);
+    using BTree = typename Tree<Layout, 8>::BTree;
+    using BLeaf = typename BTree::BLeaf;
+    std::thread([&](){
+        BTree* btree = tree.enter();
+        rdma_ptr<typename BTree::BRoot> root = unmark_ptr(static_cast<rdma_ptr<typename BTree::BRoot>>(btree->InitAsFirst(tree.pool)));
+        rdma_ptr<BLeaf> leaf = static_cast<rdma_ptr<BLeaf>>(root->start);
+        // fill the records of the (only) leaf
+        for(int i = 1; i <= 8; i++) btree->insert(tree.pool, i, i);
+        BLeaf before = *leaf;
+        // the leaf is consolidated with a new version, then the next record reuses the first slot
+        btree->remove(tree.pool, 1);
+        BLeaf consolidated = *leaf;
+        btree->insert(tree.pool, 20, 20);
+        BLeaf after = *leaf;
+        REMUS_ASSERT(consolidated.version() == before.version() + 1, "{}: Consolidated the leaf", name);
+        REMUS_ASSERT(before.is_valid() && consolidated.is_valid() && after.is_valid(), "{}: The leaves read whole are valid", name);
+
+        // the leaf before the consolidation with the records after it (whose first slot dropped a record of the old leaf)
+        BLeaf torn = after;
+        memcpy((void*) &torn, (void*) &before, BLeaf::deltas_offset());
+        REMUS_ASSERT(!torn.is_valid(true), "{}: The old leaf with the new records is torn", name);
+        // the version before the consolidation with the leaf after it (which already merged the records of that version)
+        torn = consolidated;
+        memcpy((void*) &torn, (void*) &before, sizeof(uint64_t));
+        REMUS_ASSERT(!torn.is_valid(true), "{}: The old version with the new leaf is torn", name);
+
+        after.merge_deltas();
+        std::vector<int> keys;
+        for(int i = 0; i < 2 * DEGREE + 1 && after.key_at(i) != SENTINEL; i++) keys.push_back(after.key_at(i));
+        REMUS_ASSERT(keys == std::vector<int>({2, 3, 4, 5, 6, 7, 8, 20}), "{}: Merged the records of the new leaf", name);
+        REMUS_ASSERT(btree->contains(tree.pool, 20).value_or(-1) == 20 && !btree->contains(tree.pool, 1).has_value(), "{}: Found the keys", name);
+    }).join();
+    REMUS_INFO("{} -- PASSED", name);
+}
+
+template <class Layout>
+void test_layout(std::string layout){
+    test_concurrent<Layout, 0>(false, layout);
+    test_concurrent<Layout, 0>(true, layout + " with a lock table");
+    test_concurrent<Layout, 8>(false, layout + " with deltas");
+    test_concurrent<Layout, 8>(true, layout + " with deltas and a lock table");
+    test_bulk<Layout, 0>(layout + " bulk-loaded");
+    test_bulk<Layout, 8>(layout + " bulk-loaded with deltas");
+    test_torn<Layout>(layout + " torn reads of deltas");
+}
+
+int main(){
+    REMUS_INIT_LOG();
+
+    test_layout<node_layout::LineVersions>("LineVersions");
+    test_layout<node_layout::Checksum<>>("Checksum");
+    test_layout<node_layout::HeaderFooter>("HeaderFooter");
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include <dcache/mark_ptr.h>
+#include <dcache/cache_hash.h>
+#include <dcache/cache_store.h>
+
+#include "faux_mempool.h"
+
+// Set remote cache static variables (for each hash policy under test)
+template<> inline thread_local CacheMetrics RemoteCacheImpl<CountingPool, Mix13Mask>::metrics = CacheMetrics();
+template<> inline thread_local CountingPool* RemoteCacheImpl<CountingPool, Mix13Mask>::pool = nullptr;
+template<> inline thread_local CacheMetrics RemoteCacheImpl<CountingPool, Mix13FastRange>::metrics = CacheMetrics();
+template<> inline thread_local CountingPool* RemoteCacheImpl<CountingPool, Mix13FastRange>::pool = nullptr;
+template<> inline thread_local CacheMetrics RemoteCacheImpl<CountingPool, SlabIndex>::metrics = CacheMetrics();
+template<> inline thread_local CountingPool* RemoteCacheImpl<CountingPool, SlabIndex>::pool = nullptr;
+
+#include <remus/logging/logging.h>
+#include <remus/rdma/rdma.h>
+#include <remus/rdma/rdma_ptr.h>
+
+struct alignas (64) Structure {
+    int x[16];
+};
+
+#define test(condition, message){ \
+    if (!(condition)){ \
+        REMUS_ERROR("Error: {}", message); \
+        exit(1); \
+    } \
+}
+
+/// Check every index is in range, for every offset a node could have
+template <typename Hash>
+void test_range(int requested){
+    uint64_t lines = Hash::lines(requested);
+    test(lines >= requested, "Policy shrunk the cache");
+    for(uint64_t offset = 0; offset < lines; offset += (lines / 7) + 1){
+        for(uint64_t address = 0; address < 64 * 10000; address += 64){
+            test(Hash::index(address, offset, lines) < lines, "Index out of range");
+        }
+    }
+}
+
+/// Read and write through a cache using the policy
+template <typename Hash>
+void test_cache(CountingPool* pool, int lines){
+    RemoteCacheImpl<CountingPool, Hash>* cache = new RemoteCacheImpl<CountingPool, Hash>(pool, 0, lines);
+    RemoteCacheImpl<CountingPool, Hash>::pool = pool;
+    cache->init({cache->root()}, 0);
+    test(cache->size() == Hash::lines(lines), "Cache allocated the lines of the policy");
+
+    #define TRIAL_WIDTH 1000
+    rdma_ptr<Structure> ps[TRIAL_WIDTH];
+    for(int i = 0; i < TRIAL_WIDTH; i++){
+        ps[i] = pool->Allocate<Structure>();
+        ps[i]->x[0] = i;
+        ps[i]->x[1] = 0;
+    }
+    for(int i = 0; i < TRIAL_WIDTH * 10; i++){
+        int bucket = i % TRIAL_WIDTH;
+        rdma_ptr<Structure> at_ptr = mark_ptr(ps[bucket]);
+        CachedObject<Structure> tmp = cache->template Read<Structure>(at_ptr);
+        test(tmp->x[0] == bucket, "Read is correct value");
+        test(tmp->x[1] == i / TRIAL_WIDTH, "Read observed the last write");
+        Structure tmp_copy = *tmp;
+        tmp_copy.x[1] += 1;
+        cache->template Write<Structure>(at_ptr, tmp_copy);
+    }
+    for(int i = 0; i < TRIAL_WIDTH; i++){
+        pool->Deallocate<Structure>(ps[i]);
+    }
+    cache->free_all_tmp_objects();
+    delete cache;
+}
+
+int main(){
+    // -- Test 1 -- //
+    test(Mix13Mask::lines(500) == 512, "Rounded up to a power of two");
+    test(SlabIndex::lines(512) == 512, "Power of two is unchanged");
+    test(Mix13FastRange::lines(500) == 500, "Fastrange keeps the requested size");
+    test(fastrange(UINT64_MAX, 500) == 499, "Fastrange upper bound");
+    test(fastrange(0, 500) == 0, "Fastrange lower bound");
+    REMUS_INFO("Test 1 -- PASSED");
+
+    // -- Test 2 -- //
+    test_range<Mix13Modulo>(500);
+    test_range<Mix13Mask>(500);
+    test_range<Mix13FastRange>(500);
+    test_range<SlabIndex>(500);
+    test_range<Mix13FastRange>(3);
+    REMUS_INFO("Test 2 -- PASSED");
+
+    // -- Test 3 -- //
+    test(SlabIndex::index(64 * 5, 0, 8) == 5, "Slab index uses the object index");
+    test(SlabIndex::index(64 * 13, 0, 8) == 5, "Slab index wraps");
+    test(SlabIndex::index(64 * 5, 4, 8) == 1, "Slab index applies the offset");
+    REMUS_INFO("Test 3 -- PASSED");
+
+    // -- Test 4 -- //
+    CountingPool* pool = new CountingPool(false);
+    test_cache<Mix13Mask>(pool, 500);
+    test_cache<Mix13FastRange>(pool, 500);
+    test_cache<SlabIndex>(pool, 500);
+    test_cache<SlabIndex>(pool, 4); // smaller cache so more conflicts
+    REMUS_INFO("Test 4 -- PASSED");
+
+    // Check for no leaked memory
+    if (pool->HasNoLeaks()){
+        REMUS_INFO("No Leaks In Cache Hash");
+    } else {
+        REMUS_ERROR("Found Leaks in Cache Hash");
+        pool->debug();
+        return 1;
+    }
+    return 0;
+}
@@ -8,6 +8,7 @@ template<> inline thread_local CacheMetrics RemoteCacheImpl<CountingPool>::metri
 template<> inline thread_local CountingPool* RemoteCacheImpl<CountingPool>::pool = nullptr;
 
 #include <cstring>
+#include <fstream>
 #include <remus/logging/logging.h>
 #include <remus/rdma/rdma.h>
 #include <remus/rdma/rdma_ptr.h>
@@ -87,6 +88,35 @@ void main_body(CountingPool* pool, RemoteCacheImpl<CountingPool>* cache){
     test(cache->metrics.priority_misses == 1, "Made it into cache"); // cache was full, caused priority miss
     REMUS_INFO("Test 5 -- PASSED");
 
+    // -- Test 6 -- //
+    rdma_ptr<Structure> ptr4 = pool->Allocate<Structure>();
+    memset((Structure*) ptr4.address(), 0, sizeof(Structure));
+    int combined = cache->metrics.combined_writes;
+    cache->BeginWriteScope();
+    Structure s6 = *cache->Read<Structure>(mark_ptr(ptr4));
+    s6.x[0] = 1;
+    cache->Write<Structure>(mark_ptr(ptr4), s6);
+    test(ptr4->x[0] == 0, "Write was buffered");
+    s6 = *cache->Read<Structure>(mark_ptr(ptr4));
+    test(s6.x[0] == 1, "Read observed the buffered write");
+    s6.x[1] = 2;
+    cache->Write<Structure>(mark_ptr(ptr4), s6);
+    test(cache->metrics.combined_writes == combined + 1, "Writes were combined");
+    cache->Commit();
+    test(ptr4->x[0] == 1 && ptr4->x[1] == 2, "Commit wrote the final value");
+    test(cache->Read<Structure>(mark_ptr(ptr4))->x[1] == 2, "Commit invalidated the cache");
+    REMUS_INFO("Test 6 -- PASSED");
+
+    // -- Test 7 -- //
+    cache->dump_lines("/tmp/cache_store_lines.txt", p.raw());
+    std::ifstream dumped("/tmp/cache_store_lines.txt");
+    int dumped_lines = 0;
+    std::string entry;
+    while (std::getline(dumped, entry)) if (entry.rfind("line", 0) == 0) dumped_lines++;
+    test(dumped_lines > 0 && dumped_lines <= cache->size() * 2, "Dumped the valid lines");
+    test(cache->prefetch_lines("/tmp/cache_store_lines.txt", p.raw()) == 0, "Lines of our own (restarted) node are not prefetched");
+    REMUS_INFO("Test 7 -- PASSED");
+
     // free all the structures
     for(int i = 0; i < TRIAL_WIDTH; i++){
         pool->Deallocate<Structure>(ps[i]);
@@ -96,6 +126,41 @@ void main_body(CountingPool* pool, RemoteCacheImpl<CountingPool>* cache){
     pool->Deallocate<Structure>(p, 2);
     pool->Deallocate<Structure>(ptr2);
     pool->Deallocate<Structure>(ptr3);
+    pool->Deallocate<Structure>(ptr4);
+}
+
+/// A node that restarts its cache prefetches the lines another node owns, if the snapshot is of the same structure
+void snapshot_body(CountingPool* pool){
+    // -- Test 8 -- //
+    RemoteCacheImpl<CountingPool>* owner = new RemoteCacheImpl<CountingPool>(pool, 0, 500);
+    owner->init({owner->root()}, 0);
+    rdma_ptr<Structure> structure = pool->Allocate<Structure>();
+    memset((Structure*) structure.address(), 0, sizeof(Structure));
+    structure->x[0] = 8;
+
+    // the first run of node 1 caches the structure and saves its lines
+    RemoteCacheImpl<CountingPool>* first = new RemoteCacheImpl<CountingPool>(pool, 1, 500);
+    first->init({owner->root(), first->root()}, 1);
+    test(first->Read<Structure>(mark_ptr(structure))->x[0] == 8, "Read through the first run");
+    first->dump_lines("/tmp/cache_store_snapshot.txt", structure.raw());
+    first->free_all_tmp_objects();
+    delete first;
+
+    // node 1 restarts
+    RemoteCacheImpl<CountingPool>* restarted = new RemoteCacheImpl<CountingPool>(pool, 1, 500);
+    restarted->init({owner->root(), restarted->root()}, 1);
+    test(restarted->prefetch_lines("/tmp/cache_store_snapshot.txt", structure.raw() + 64) == 0, "A snapshot of another structure is not prefetched");
+    test(restarted->prefetch_lines("/tmp/cache_store_snapshot.txt", structure.raw()) == 1, "The owner's line was prefetched");
+    int hits = restarted->metrics.hits;
+    test(restarted->Read<Structure>(mark_ptr(structure))->x[0] == 8, "Read the prefetched line");
+    test(restarted->metrics.hits == hits + 1, "The prefetched line was hit");
+    restarted->free_all_tmp_objects();
+    delete restarted;
+
+    owner->free_all_tmp_objects();
+    delete owner;
+    pool->Deallocate<Structure>(structure);
+    REMUS_INFO("Test 8 -- PASSED");
 }
 
 int main(){
@@ -123,6 +188,34 @@ int main(){
     cache->free_all_tmp_objects();
     delete cache;
 
+    // Construct the remote cache with its locks on huge pages and its copies in a slab
+    CacheOptions options;
+    options.huge_pages = true;
+    options.numa_node = CacheOptions::LOCAL_NUMA;
+    options.copy_slab_bytes = 1 << 20;
+    cache = new RemoteCacheImpl<CountingPool>(pool, 0, 500, options);
+    cache->init({cache->root()}, 0); // initialize with itself
+
+    main_body(pool, cache);
+
+    // Free memory
+    cache->free_all_tmp_objects();
+    delete cache;
+
+    // Construct the remote cache with two replicas (writes invalidate both)
+    options = CacheOptions();
+    options.replicas = 2;
+    cache = new RemoteCacheImpl<CountingPool>(pool, 0, 4, options);
+    cache->init({cache->root()}, 0); // initialize with itself
+
+    main_body(pool, cache);
+
+    // Free memory
+    cache->free_all_tmp_objects();
+    delete cache;
+
+    snapshot_body(pool);
+
     // Check for no leaked memory
     if (pool->HasNoLeaks()){
         REMUS_INFO("No Leaks In Cache Store");
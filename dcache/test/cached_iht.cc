@@ -15,6 +15,26 @@ using namespace remus::rdma;
 template<> inline thread_local CacheMetrics RemoteCacheImpl<CountingPool>::metrics = CacheMetrics();
 template<> inline thread_local CountingPool* RemoteCacheImpl<CountingPool>::pool = nullptr;
 
+/// Binary keys and 64-bit values with a hash policy
+template <class Hash>
+void test_binary_keys(CountingPool* pool, RemoteCacheImpl<CountingPool>* cache, Peer self){
+    using Key = key_hash::FixedKey<16>;
+    auto iht = new RdmaIHT<Key, uint64_t, CNF_ELIST_SIZE, CNF_PLIST_SIZE, Hash>(self, CacheDepth::UpToLayer1, cache, pool);
+    iht->InitAsFirst(pool);
+    for(uint64_t i = 0; i < 5000; i++){
+        REMUS_ASSERT(!iht->insert(pool, Key::from_int(i), i << 32).has_value(), "Inserted a binary key with {}", Hash::name);
+    }
+    for(uint64_t i = 0; i < 5000; i++){
+        REMUS_ASSERT(iht->contains(pool, Key::from_int(i)).value_or(0) == i << 32, "Found a binary key with {}", Hash::name);
+    }
+    for(uint64_t i = 0; i < 5000; i += 2){
+        REMUS_ASSERT(iht->remove(pool, Key::from_int(i)).value_or(0) == i << 32, "Removed a binary key with {}", Hash::name);
+    }
+    REMUS_ASSERT(!iht->contains(pool, Key::from_int(5000)).has_value(), "Didn't find a binary key that wasn't inserted");
+    REMUS_ASSERT(iht->count(pool) == 2500, "Found correct size with {}", Hash::name);
+    iht->destroy(pool);
+}
+
 int main(){
     // Construct a capability
     CountingPool* pool = new CountingPool(false);
@@ -36,10 +56,82 @@ int main(){
         REMUS_ASSERT(iht->remove(pool, i).value_or(0) == i, "Removed value at i");
     }
 
+    // Batched operations (including keys that repeat in a batch and batches that need a rehash)
+    int before = iht->count(pool);
+    for(int b = 0; b < 200; b++){
+        std::vector<int> keys, values;
+        for(int j = 0; j < 64; j++){
+            keys.push_back(20000 + ((b * 64 + j) % 10000));
+            values.push_back(keys.back() * 2);
+        }
+        std::vector<std::optional<int>> inserted = iht->multi_insert(pool, keys, values);
+        std::vector<std::optional<int>> found = iht->multi_contains(pool, keys);
+        for(int j = 0; j < 64; j++){
+            REMUS_ASSERT(b * 64 + j < 10000 || inserted[j].has_value(), "Found the existing key in multi_insert");
+            REMUS_ASSERT(found[j].value_or(0) == keys[j] * 2, "Found correct value with multi_contains");
+        }
+    }
+    std::vector<std::optional<int>> missing = iht->multi_contains(pool, {-1, -2, -3});
+    for(auto& m : missing) REMUS_ASSERT(!m.has_value(), "Didn't find a key that wasn't inserted");
+    REMUS_ASSERT(iht->count(pool) == before + 10000, "Found correct size in IHT after multi_insert");
+
+    // Bulk-load an IHT (unsorted and with a repeated key), then keep using it
+    auto bulk = new RdmaIHT<int, int, CNF_ELIST_SIZE, CNF_PLIST_SIZE>(self, CacheDepth::UpToLayer1, cache, pool);
+    std::vector<std::pair<int, int>> pairs;
+    for(int i = 0; i < 20000; i++) pairs.push_back({(i * 7919) % 20000, i});
+    pairs.push_back({0, -1});
+    bulk->InitFromBulk(pool, pairs);
+    REMUS_ASSERT(bulk->count(pool) == 20000, "Found correct size in bulk-loaded IHT");
+    for(int i = 0; i < 20000; i++){
+        REMUS_ASSERT(bulk->contains(pool, (i * 7919) % 20000).value_or(-1) == i, "Found correct value in bulk-loaded IHT");
+    }
+    for(int i = 20000; i < 30000; i++){
+        REMUS_ASSERT(!bulk->insert(pool, i, i).has_value(), "Inserted into bulk-loaded IHT");
+        REMUS_ASSERT(bulk->contains(pool, i).value_or(-1) == i, "Found inserted value in bulk-loaded IHT");
+    }
+    REMUS_ASSERT(bulk->count(pool) == 30000, "Found correct size in bulk-loaded IHT after inserts");
+
+    // Scan it (with and without validating the versions)
+    for(bool consistent : {false, true}){
+        std::vector<bool> seen(30000, false);
+        auto it = bulk->scan(pool, consistent);
+        int scanned = 0;
+        for(auto pair = it.next(pool); pair.has_value(); pair = it.next(pool)){
+            REMUS_ASSERT(pair->first >= 0 && pair->first < 30000 && !seen[pair->first], "Scanned a key once");
+            seen[pair->first] = true;
+            scanned++;
+        }
+        it.destroy(pool);
+        REMUS_ASSERT(scanned == 30000, "Scanned every key");
+    }
+    bulk->destroy(pool);
+
+    // Choose the cached PLists by access frequency (a budget of 4 level-1 PLists)
+    auto admission = new RdmaIHT<int, int, CNF_ELIST_SIZE, CNF_PLIST_SIZE>::Admission(4 * CNF_PLIST_SIZE * 16);
+    auto adaptive = new RdmaIHT<int, int, CNF_ELIST_SIZE, CNF_PLIST_SIZE>(self, CacheDepth::UpToLayer2, cache, pool, admission);
+    adaptive->InitAsFirst(pool);
+    for(int i = 0; i < 20000; i++) adaptive->insert(pool, i, i);
+    for(int r = 0; r < 60; r++){
+        for(int i = 0; i < 20000; i += (i < 1000 ? 1 : 50)){
+            REMUS_ASSERT(adaptive->contains(pool, i).value_or(-1) == i, "Found correct value with adaptive caching");
+        }
+        REMUS_ASSERT(adaptive->remove(pool, r).value_or(-1) == r, "Removed with adaptive caching");
+        REMUS_ASSERT(!adaptive->insert(pool, r, r).has_value(), "Inserted with adaptive caching");
+    }
+    REMUS_ASSERT(admission->get_threshold() > 0, "Adapted the cached PLists");
+    REMUS_ASSERT(adaptive->count(pool) == 20000, "Found correct size with adaptive caching");
+    adaptive->destroy(pool);
+    delete admission;
+
+    // Other key types and hash policies
+    test_binary_keys<key_hash::Mix13Hash>(pool, cache, self);
+    test_binary_keys<key_hash::WyHash>(pool, cache, self);
+    test_binary_keys<key_hash::Crc32cHash>(pool, cache, self);
+
     // Free memory
+    iht->destroy(pool);
     cache->free_all_tmp_objects();
     delete cache;
-    iht->destroy(pool);
 
     // Check for no leaked memory
     if (pool->HasNoLeaks()){
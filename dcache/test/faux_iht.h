@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <atomic>
 #include <random>
 #include <remus/logging/logging.h>
@@ -10,14 +11,21 @@
 #include "../../iht/common.h"
 #include "dcache/mark_ptr.h"
 #include "faux_mempool.h"
+#include "../../iht/cached/ds/key_search.h"
+#include "../../iht/cached/ds/key_hash.h"
+#include "../../iht/cached/ds/cache_admission.h"
 #include <cassert>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <memory>
 #include <optional>
+#include <vector>
 
-template <class K, class V, int ELIST_SIZE, int PLIST_SIZE> class RdmaIHT {
+/// @tparam K the key type. An integer or a fixed-size binary key (see key_hash::FixedKey)
+/// @tparam Hash the policy hashing the keys into the buckets of a level (see key_hash.h)
+template <class K, class V, int ELIST_SIZE, int PLIST_SIZE, class Hash = key_hash::Mix13Hash> class RdmaIHT {
 private:
   Peer self_;
   CacheDepth::CacheDepth cache_depth_;
@@ -39,13 +47,19 @@ private:
     V val;
   };
 
+  /// Set in both versions of an EList once it was rehashed into a PList (it will never change again)
+  static constexpr uint64_t RETIRED = 1ULL << 63;
+
   // ElementList stores a bunch of K/V pairs. IHT employs a "separate
   // chaining"-like approach. Rather than storing via a linked list (with easy
   // append), it uses a fixed size array
+  // The version is stored at the head and the tail so a reader without the lock can detect a torn read (the versions won't match)
   struct alignas(64) EList : Base {
+    uint64_t version = 0;     // The version at the head
     size_t count = 0;         // The number of live elements in the Elist
     pair_t pairs[ELIST_SIZE]; // A list of pairs to store (stored as remote
                               // pointer to start of the contigous memory block)
+    uint64_t version_tail = 0; // The version at the tail
 
     // Insert into elist a deconstructed pair
     void elist_insert(const K key, const V val) {
@@ -93,25 +107,22 @@ private:
       return unmark_ptr(remote_lock(arr_start.id(), new_addy));
   }
 
-  // Get the address of the baseptr at bucket (index)
-  rdma_ptr<remote_baseptr> get_baseptr(remote_plist arr_start, int index){
+  // Get the address of the bucket (baseptr and lock) at index
+  rdma_ptr<plist_pair_t> get_bucket(remote_plist arr_start, int index){
       uint64_t new_addy = arr_start.address();
       new_addy += sizeof(plist_pair_t) * index;
-      return unmark_ptr(rdma_ptr<remote_baseptr>(arr_start.id(), new_addy));
+      return unmark_ptr(rdma_ptr<plist_pair_t>(arr_start.id(), new_addy));
   }
 
-  /// @brief Initialize the plist with values.
+  /// @brief Initialize the plist with empty buckets.
+  /// ELists are allocated lazily, an empty bucket is a null base with E_UNLOCKED
   /// @param p the plist pointer to init
   /// @param depth the depth of p, needed for PLIST_SIZE == base_size * (2 **
   /// (depth - 1)) pow(2, depth)
-  inline void InitPList(CountingPool* pool, remote_plist p, int mult_modder) {
+  inline void InitPList(remote_plist p, int mult_modder) {
     assert(sizeof(plist_pair_t) == 16); // Assert I did my math right...
-    // memset(std::to_address(p), 0, 2 * sizeof(PList));
     for (size_t i = 0; i < PLIST_SIZE * mult_modder; i++){
-      remote_elist e_new = pool->Allocate<EList>();
-      objects.push_back(DeallocTask(static_cast<rdma_ptr<Object>>(e_new), sizeof(EList), nullptr));
-      e_new->count = 0;
-      p->buckets[i] = { static_cast<remote_baseptr>(e_new), E_UNLOCKED };
+      p->buckets[i] = { remote_baseptr(nullptr), E_UNLOCKED };
     }
   }
 
@@ -140,49 +151,115 @@ private:
     pool->Write<lock_type>(lock, unlock_status, temp_lock, internal::RDMAWriteWithNoAck);
   }
 
-  /// @brief Change the baseptr for a given bucket to point to a different EList or a different PList
+  /// @brief Start modifying an EList (while holding the bucket lock)
+  /// Local ELists are modified in place, so the head version changes before the contents
+  inline void elist_begin_write(remote_elist bucket_base, EList* e) {
+    if (is_local(bucket_base)) {
+      e->version++;
+      std::atomic_thread_fence(std::memory_order_release);
+    }
+  }
+
+  /// @brief Publish the modification of an EList and unlock its bucket
+  /// Remote ELists were modified in a local copy (temp_elist), which is written in one write with both versions bumped
+  /// If the EList and the lock are on the same peer, the write is chained with the unlock on the same queue pair.
+  /// RC places them in order, so only the unlock waits for an ack (which also means the EList write is done before temp_elist is reused)
+  inline void elist_end_write(CountingPool* pool, remote_elist bucket_base, EList* e, remote_lock lock) {
+    if (is_local(bucket_base)) {
+      std::atomic_thread_fence(std::memory_order_release);
+      e->version_tail = e->version;
+      unlock(pool, lock, E_UNLOCKED);
+    } else {
+      e->version++;
+      e->version_tail = e->version;
+      if (bucket_base.id() == lock.id()) {
+        pool->template Write<EList>(bucket_base, *e, temp_elist, internal::RDMAWriteWithNoAck);
+        pool->template Write<lock_type>(lock, E_UNLOCKED, temp_lock);
+      } else {
+        pool->template Write<EList>(bucket_base, *e, temp_elist);
+        unlock(pool, lock, E_UNLOCKED);
+      }
+    }
+  }
+
+  /// @brief Change the baseptr for a given bucket to point to a different EList or a different PList and unlock it
+  /// The base and the lock are adjacent, so it is a single 16 byte write. It is placed in increasing address order (base before lock)
   /// @param list_start the start of the plist (bucket list)
   /// @param bucket the bucket to manipulate
   /// @param baseptr the new pointer that bucket should have
+  /// @param unlock_status what should the end lock status be.
   inline void change_bucket_pointer(CountingPool* pool, remote_plist list_start,
-                                    uint64_t bucket, remote_baseptr baseptr) {
-    rdma_ptr<remote_baseptr> bucket_ptr = get_baseptr(list_start, bucket);
+                                    uint64_t bucket, remote_baseptr baseptr, lock_type unlock_status) {
+    rdma_ptr<plist_pair_t> bucket_ptr = get_bucket(list_start, bucket);
     if (!is_local(bucket_ptr)) {
-      pool->Write<remote_baseptr>(bucket_ptr, baseptr, temp_ptr);
+      pool->Write<plist_pair_t>(bucket_ptr, plist_pair_t{baseptr, unlock_status}, temp_bucket);
     } else {
-      *bucket_ptr = baseptr;
+      bucket_ptr->base = baseptr;
+      std::atomic_thread_fence(std::memory_order_release);
+      bucket_ptr->lock = unlock_status;
     }
   }
 
+  /// @brief Allocate an empty EList
+  remote_elist new_elist(CountingPool* pool) {
+    remote_elist e = pool->Allocate<EList>();
+    objects.push_back(DeallocTask(static_cast<rdma_ptr<Object>>(e), sizeof(EList), nullptr));
+    e->count = 0;
+    e->version = 0;
+    e->version_tail = 0;
+    return e;
+  }
+
+  /// @brief The base of a bucket, read from the PList instead of the cache
+  /// An empty bucket of a cached PList can be stale, so it is read again while holding the bucket lock (which keeps it stable)
+  remote_baseptr read_bucket_base(CountingPool* pool, remote_plist list_start, uint64_t bucket) {
+    rdma_ptr<plist_pair_t> bucket_ptr = get_bucket(list_start, bucket);
+    if (is_local(bucket_ptr)) return bucket_ptr->base;
+    return pool->Read<plist_pair_t>(bucket_ptr, temp_bucket)->base;
+  }
+
+  /// @brief Give an empty bucket (locked by the caller) its first EList and unlock it
+  /// Readers may have cached the empty bucket, so the PList is invalidated like after a rehash
+  inline void publish_elist(CountingPool* pool, remote_plist list_start, uint64_t bucket, remote_elist e) {
+    change_bucket_pointer(pool, list_start, bucket, static_cast<remote_baseptr>(e), E_UNLOCKED);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    cache->Invalidate(list_start);
+  }
+
+  /// @brief Read a PList. A marked PList is only read through the cache if the admission admits it (the pointer stays marked for the writers' invalidations)
+  /// A PList the admission demotes is evicted from the node's cache
+  /// @param ptr the PList as stored in its parent bucket (or the root)
+  /// @param depth the depth of the PList (the root is depth 1)
+  inline CachedObject<PList> read_plist(remote_plist ptr, size_t depth) {
+    if (admission != nullptr && is_marked(ptr)) {
+      auto evict = [&](uint64_t demoted){ cache->Evict(remote_plist(demoted)); };
+      if (!admission->admit(unmark_ptr(ptr).raw(), sizeof(PList) << (depth - 1), evict)) ptr = unmark_ptr(ptr);
+    }
+    return cache->ExtendedRead<PList>(ptr, 1 << (depth - 1));
+  }
+
   /// @brief Hashing function to decide bucket size
   /// @param key the key to hash
   /// @param level the level in the iht
   /// @param count the number of buckets to hash into
   inline uint64_t level_hash(const K &key, size_t level, size_t count) {
-    std::hash<K> to_num;
-    size_t prehash = to_num(key) ^ level;
-    // mix13 implementation, maintains divisibility so we still have to subtract 1 from the bucket count
-    prehash ^= (prehash >> 33);
-    prehash *= 0xff51afd7ed558ccd;
-    prehash ^= (prehash >> 33);
-    prehash *= 0xc4ceb9fe1a85ec53;
-    prehash ^= (prehash >> 33);
-
-    // 1) pre_hash will first map the type K to size_t
-    //    then pre_hash will help distribute non-uniform inputs evenly by applying a finalizer
+    uint64_t prehash = Hash::hash(key, level);
+
+    // 1) The hash policy maps the key to a well mixed 64-bit number (seeded by the level)
     // 2) We use count-1 to ensure the bucket count is co-prime with the other plist bucket counts
     //    B/C of the property: A key maps to a suboptimal set of values when modding by 2A given "k mod A = Y" (where Y becomes the parent bucket)
     //    This happens because the hashing function maintains divisibility.
-    return prehash % (count - 1);
+    return fastrange(prehash, count - 1);
   }
 
-  /// Rehash function - will add more capacity
+  /// Rehash function - builds the PList that will replace a full EList
+  /// It is built from a copy of the EList without holding the bucket lock (it is private until it is published)
+  /// Only the buckets that receive a pair are given an EList
   /// @param pool The memory pool capability
-  /// @param parent The P-List whose bucket needs rehashing
-  /// @param pcount The number of elements in `parent`
-  /// @param pdepth The depth of `parent`
-  /// @param pidx   The index in `parent` of the bucket to rehash
-  remote_plist rehash(CountingPool* pool, rdma_ptr<PList> parent, size_t pcount, size_t pdepth, size_t pidx) {
+  /// @param source A copy of the full EList
+  /// @param pcount The number of elements in the parent PList
+  /// @param pdepth The depth of the parent PList
+  remote_plist build_plist(CountingPool* pool, const EList& source, size_t pcount, size_t pdepth) {
     pcount = pcount * 2;
     // how much bigger than original size we are
     int plist_size_factor = (pcount / PLIST_SIZE);
@@ -190,37 +267,160 @@ private:
     // 2 ^ (depth) ==> in other words (depth:factor). 0:1, 1:2, 2:4, 3:8, 4:16, 5:32.
     remote_plist new_p = pool->Allocate<PList>(plist_size_factor);
     objects.push_back(DeallocTask(static_cast<rdma_ptr<Object>>(new_p), sizeof(PList) * plist_size_factor, nullptr));
-    InitPList(pool, new_p, plist_size_factor);
-
-    // hash everything from the full elist into it
-    remote_elist parent_bucket = static_cast<remote_elist>(parent->buckets[pidx].base);
-    remote_elist source = is_local(parent_bucket)
-                              ? parent_bucket
-                              : pool->Read<EList>(parent_bucket);
+    InitPList(new_p, plist_size_factor);
 
     // insert everything from the elist we rehashed into the plist
-    for (size_t i = 0; i < source->count; i++) {
-      uint64_t b = level_hash(source->pairs[i].key, pdepth + 1, pcount);
+    for (size_t i = 0; i < source.count; i++) {
+      uint64_t b = level_hash(source.pairs[i].key, pdepth + 1, pcount);
+      if (new_p->buckets[b].base == nullptr) new_p->buckets[b].base = static_cast<remote_baseptr>(new_elist(pool));
       remote_elist dest = static_cast<remote_elist>(new_p->buckets[b].base);
-      dest->elist_insert(source->pairs[i]);
+      dest->elist_insert(source.pairs[i]);
+    }
+    return new_p;
+  }
+
+  /// Stop tracking an object that was freed before destroy
+  void untrack(rdma_ptr<Object> ptr) {
+    objects.erase(std::remove_if(objects.begin(), objects.end(), [&](const DeallocTask& t){ return t.local_ptr == ptr; }), objects.end());
+  }
+
+  /// Bulk-load function - builds a PList (and everything below it) for the pairs directly in memory
+  /// A bucket with more pairs than an EList holds becomes a PList, as if it was rehashed
+  /// @param pool The memory pool capability
+  /// @param pairs The pairs hashing into the PList (with unique keys)
+  /// @param depth The depth of the PList
+  /// @param count The number of buckets in the PList
+  remote_plist build_bulk(CountingPool* pool, const std::vector<pair_t>& pairs, size_t depth, size_t count) {
+    int plist_size_factor = (count / PLIST_SIZE);
+    remote_plist p = pool->Allocate<PList>(plist_size_factor);
+    objects.push_back(DeallocTask(static_cast<rdma_ptr<Object>>(p), sizeof(PList) * plist_size_factor, nullptr));
+    InitPList(p, plist_size_factor);
+
+    std::vector<std::pair<uint64_t, pair_t>> hashed;
+    hashed.reserve(pairs.size());
+    for (const pair_t& pair : pairs) hashed.push_back({level_hash(pair.key, depth, count), pair});
+    std::sort(hashed.begin(), hashed.end(), [](const auto& a, const auto& b){ return a.first < b.first; });
+    for (size_t i = 0; i < hashed.size();) {
+      uint64_t b = hashed[i].first;
+      size_t j = i;
+      while (j < hashed.size() && hashed[j].first == b) j++;
+      if (j - i <= ELIST_SIZE) {
+        remote_elist e = new_elist(pool);
+        for (; i < j; i++) e->elist_insert(hashed[i].second);
+        p->buckets[b] = { static_cast<remote_baseptr>(e), E_UNLOCKED };
+      } else {
+        std::vector<pair_t> child;
+        for (; i < j; i++) child.push_back(hashed[i].second);
+        remote_plist c = build_bulk(pool, child, depth + 1, count * 2);
+        if (cache_depth_ > depth)
+          c = mark_ptr(c);
+        p->buckets[b] = { static_cast<remote_baseptr>(c), P_UNLOCKED };
+      }
+    }
+    return p;
+  }
+
+  /// Free a PList from build_plist that was never published (the EList changed or was rehashed by another thread)
+  void discard_plist(CountingPool* pool, remote_plist p, size_t pcount) {
+    int plist_size_factor = (pcount * 2 / PLIST_SIZE);
+    for (size_t i = 0; i < PLIST_SIZE * plist_size_factor; i++) {
+      if (p->buckets[i].base == nullptr) continue;
+        untrack(static_cast<rdma_ptr<Object>>(p->buckets[i].base));
+      pool->Deallocate<EList>(static_cast<remote_elist>(p->buckets[i].base));
     }
+    untrack(static_cast<rdma_ptr<Object>>(p));
+    pool->Deallocate<PList>(p, plist_size_factor);
+  }
+
+  /// The version of a locked EList (the lock keeps the head and the tail equal, so only the head is read)
+  uint64_t read_version(CountingPool* pool, remote_elist bucket_base) {
+    if (is_local(bucket_base)) return bucket_base->version;
+    return *pool->Read<uint64_t>(rdma_ptr<uint64_t>(bucket_base.raw()), temp_version);
+  }
+
+  /// Retire a full EList before the PList that replaces it is published, so lock-free readers holding a stale parent know to re-read it
+  /// @param source the EList if it is local, otherwise the copy of it the PList was built from
+  void retire_elist(CountingPool* pool, remote_elist bucket_base, EList* source) {
+    source->version |= RETIRED;
+    std::atomic_thread_fence(std::memory_order_release);
+    source->version_tail = source->version;
+    if (!is_local(bucket_base)) pool->template Write<EList>(bucket_base, *source, temp_elist);
     // Deallocate the old elist
     // TODO replace for remote deallocation
-    // pool->Deallocate<EList>(source);
     // todo: freed by destroy since it is part of the data structure! (and hence is added as a dealloc task)
-    return new_p;
+  }
+
+  /// Where a key of a batch landed after the descent (the bucket of the EList it belongs to)
+  struct batch_pos_t {
+    remote_plist parent_ptr; // the PList holding the bucket
+    uint64_t bucket;
+    remote_baseptr base; // the EList (as seen in the cached PList)
+  };
+
+  /// Descend the PLists for a batch of keys together. Each PList is read once per level for all the keys that pass through it
+  std::vector<batch_pos_t> descend_batch(const std::vector<K>& keys) {
+    std::vector<batch_pos_t> pos(keys.size());
+    std::vector<size_t> level(keys.size()); // keys still descending
+    for (size_t i = 0; i < keys.size(); i++) {
+      level[i] = i;
+      pos[i].parent_ptr = root;
+    }
+    size_t depth = 1;
+    size_t count = PLIST_SIZE;
+    while (!level.empty()) {
+      // group the keys by the PList they are at
+      std::sort(level.begin(), level.end(), [&](size_t a, size_t b){ return pos[a].parent_ptr.raw() < pos[b].parent_ptr.raw(); });
+      std::vector<size_t> next;
+      for (size_t g = 0; g < level.size();) {
+        remote_plist ptr = pos[level[g]].parent_ptr;
+        CachedObject<PList> curr = read_plist(ptr, depth);
+        for (; g < level.size() && pos[level[g]].parent_ptr == ptr; g++) {
+          size_t i = level[g];
+          uint64_t bucket = level_hash(keys[i], depth, count);
+          pos[i].bucket = bucket;
+          pos[i].base = curr->buckets[bucket].base;
+          if (curr->buckets[bucket].lock == P_UNLOCKED) {
+            pos[i].parent_ptr = static_cast<remote_plist>(pos[i].base);
+            next.push_back(i);
+          }
+        }
+      }
+      level.swap(next);
+      depth++;
+      count *= 2;
+    }
+    return pos;
+  }
+
+  /// Sort the keys of a batch by EList, with the ELists of the same node next to each other (and empty buckets by bucket)
+  std::vector<size_t> order_by_elist(const std::vector<batch_pos_t>& pos) {
+    std::vector<size_t> order(pos.size());
+    for (size_t i = 0; i < pos.size(); i++) order[i] = i;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b){
+      remote_baseptr x = unmark_ptr(pos[a].base), y = unmark_ptr(pos[b].base);
+      if (x.id() != y.id()) return x.id() < y.id();
+      if (x.address() != y.address()) return x.address() < y.address();
+      return get_lock(pos[a].parent_ptr, pos[a].bucket).raw() < get_lock(pos[b].parent_ptr, pos[b].bucket).raw();
+    });
+    return order;
   }
 
   RemoteCacheImpl<CountingPool>* cache;
+  /// Decides which of the marked PLists are read through the cache (or null to read all of them through it)
+  CacheAdmission<>* admission;
   
   // preallocated memory for RDMA operations (avoiding frequent allocations)
   remote_lock temp_lock;
-  rdma_ptr<remote_baseptr> temp_ptr;
+  rdma_ptr<plist_pair_t> temp_bucket;
   remote_elist temp_elist;
+  rdma_ptr<uint64_t> temp_version;
+  std::vector<remote_lock> temp_cas; // results of the batched lock CASes
   // N.B. I don't bother creating preallocated PLists since we're hoping to cache them anyways :)
 public:
-  RdmaIHT(Peer& self, CacheDepth::CacheDepth depth, RemoteCacheImpl<CountingPool>* cache, CountingPool* pool) 
-  : self_(std::move(self)), cache_depth_(depth), cache(cache) {
+  using Admission = CacheAdmission<>;
+
+  RdmaIHT(Peer& self, CacheDepth::CacheDepth depth, RemoteCacheImpl<CountingPool>* cache, CountingPool* pool, Admission* admission = nullptr) 
+  : self_(std::move(self)), cache_depth_(depth), cache(cache), admission(admission) {
     // I want to make sure we are choosing PLIST_SIZE and ELIST_SIZE to best use the space (b/c of alignment)
     if ((PLIST_SIZE * sizeof(plist_pair_t)) % 64 != 0) {
       // PList must use all its space to obey the space requirements
@@ -229,15 +429,16 @@ public:
       REMUS_DEBUG("PList Level 1 takes up {} bytes", PLIST_SIZE * sizeof(plist_pair_t));
       assert(sizeof(PList) == PLIST_SIZE * sizeof(plist_pair_t));
     }
-    auto size = ((ELIST_SIZE * sizeof(pair_t)) + sizeof(size_t));
+    auto size = ((ELIST_SIZE * sizeof(pair_t)) + sizeof(size_t) + 2 * sizeof(uint64_t));
     if (size % 64 < 60 && size % 64 != 0) {
       REMUS_WARN("Suboptimal ELIST_SIZE b/c EList aligned to 64 bytes");
     }
 
     // Allocate landing spots for the datastructure traversal
     temp_lock = pool->Allocate<lock_type>();
-    temp_ptr = pool->Allocate<remote_baseptr>();
+    temp_bucket = pool->Allocate<plist_pair_t>();
     temp_elist = pool->Allocate<EList>();
+    temp_version = pool->Allocate<uint64_t>();
   };
 
   /// Free all the resources associated with the IHT
@@ -246,9 +447,13 @@ public:
     // Have to deallocate "8" of them to account for alignment
     // But faux memory pool doesnt have the issue
     pool->Deallocate<lock_type>(temp_lock);
-    pool->Deallocate<remote_baseptr>(temp_ptr);
+    pool->Deallocate<plist_pair_t>(temp_bucket);
     pool->Deallocate<EList>(temp_elist);
+    pool->Deallocate<uint64_t>(temp_version);
+    for (remote_lock r : temp_cas) pool->Deallocate<lock_type>(r);
     for(int i = 0; i < objects.size(); i++){
+      // another IHT sharing the cache might reuse the address, so don't leave a copy behind
+      cache->Invalidate(mark_ptr(objects[i].local_ptr));
       pool->Deallocate<Object>(objects[i].local_ptr, objects[i].size);
     }
   }
@@ -259,7 +464,27 @@ public:
   rdma_ptr<anon_ptr> InitAsFirst(CountingPool* pool){
       remote_plist iht_root = pool->Allocate<PList>();
       objects.push_back(DeallocTask(static_cast<rdma_ptr<Object>>(iht_root), sizeof(PList), nullptr));
-      InitPList(pool, iht_root, 1);
+      InitPList(iht_root, 1);
+      this->root = iht_root;
+      if (cache_depth_ >= 1)
+        this->root = mark_ptr(this->root);
+      return static_cast<rdma_ptr<anon_ptr>>(iht_root);
+  }
+
+  /// @brief Create an iht holding the pairs (i.e. to populate it before a benchmark)
+  /// Instead of inserting the pairs one at a time, every PList and EList is built by this thread and the root is returned once it is complete
+  /// The pairs can be in any order. If a key repeats, its first pair is used
+  /// @param pool the capability to init the IHT with
+  /// @param pairs the pairs to load
+  /// @return the iht root pointer
+  rdma_ptr<anon_ptr> InitFromBulk(CountingPool* pool, std::vector<std::pair<K, V>> pairs){
+      std::stable_sort(pairs.begin(), pairs.end(), [](const auto& a, const auto& b){ return a.first < b.first; });
+      std::vector<pair_t> unique;
+      unique.reserve(pairs.size());
+      for (size_t i = 0; i < pairs.size(); i++) {
+        if (i == 0 || pairs[i].first != pairs[i - 1].first) unique.push_back({pairs[i].first, pairs[i].second});
+      }
+      remote_plist iht_root = build_bulk(pool, unique, 1, PLIST_SIZE);
       this->root = iht_root;
       if (cache_depth_ >= 1)
         this->root = mark_ptr(this->root);
@@ -267,7 +492,7 @@ public:
   }
 
   /// @brief Initialize an IHT from the pointer of another IHT
-  /// @param root_ptr the root pointer of the other iht from InitAsFirst();
+  /// @param root_ptr the root pointer of the other iht from InitAsFirst() or InitFromBulk();
   void InitFromPointer(rdma_ptr<anon_ptr> root_ptr){
       if (cache_depth_ >= 1)
         root_ptr = mark_ptr(root_ptr);
@@ -285,47 +510,37 @@ public:
     remote_plist parent_ptr = root;
 
     // start at root
-    CachedObject<PList> curr = cache->Read<PList>(root);
+    CachedObject<PList> curr = read_plist(root, 1);
     while (true) {
       uint64_t bucket = level_hash(key, depth, count);
       // Normal descent
       if (curr->buckets[bucket].lock == P_UNLOCKED){
         auto bucket_base = static_cast<remote_plist>(curr->buckets[bucket].base);
-        curr = cache->ExtendedRead<PList>(bucket_base, 1 << depth);
+        curr = read_plist(bucket_base, depth + 1);
         parent_ptr = bucket_base;
         depth++;
         count *= 2;
         continue;
       }
 
-      // If we have a sizeof the elist 64, we can enable the lock-free GET
-      if (sizeof(EList) != 64){
-        // Erroneous descent into EList (Think we are at an EList, but it turns out its a PList)
-        if (!acquire(pool, get_lock(parent_ptr, bucket))){
-          // We must re-fetch the PList to ensure freshness of our pointers (1 << depth-1 to adjust size of read with customized ExtendedRead)
-          curr = cache->ExtendedRead<PList>(parent_ptr, 1 << (depth - 1));
-          continue;
-        }
-      }
-
-      // We locked an elist, we can read the baseptr and progress
+      // Lock-free GET. Read the elist once and validate it with its versions
       remote_elist bucket_base = static_cast<remote_elist>(curr->buckets[bucket].base);
+      // An empty bucket. If it was given an EList since we cached the PList, the insert giving it invalidates the PList before it returns
+      if (bucket_base == nullptr) return std::nullopt;
       // Past this point we have recursed to an elist
       remote_elist e = pool->Read<EList>(bucket_base, temp_elist);
-      // Get elist and linear search
-      for (size_t i = 0; i < e->count; i++) {
-        // Linear search to determine if elist already contains the key 
-        pair_t kv = e->pairs[i];
-        if (kv.key == key) {
-          // If lock free get, no need to unlock
-          if (sizeof(EList) != 64)
-            unlock(pool, get_lock(parent_ptr, bucket), E_UNLOCKED);
-          return std::make_optional<V>(kv.val);
-        }
+      // Torn read (a writer was writing the elist), read it again
+      if (e->version != e->version_tail) continue;
+      // Erroneous descent into EList (Think we are at an EList, but it turns out its a PList)
+      if (e->version & RETIRED) {
+        // We must re-fetch the PList to ensure freshness of our pointers (1 << depth-1 to adjust size of read with customized ExtendedRead)
+        curr = read_plist(parent_ptr, depth);
+        continue;
       }
-      // If lock free get, no need to unlock
-      if (sizeof(EList) != 64)
-        unlock(pool, get_lock(parent_ptr, bucket), E_UNLOCKED);
+
+      // Get elist and search for the key
+      int i = key_search::find_key(e->pairs, e->count, key);
+      if (i != -1) return std::make_optional<V>(e->pairs[i].val);
       return std::nullopt;
     }
   }
@@ -343,13 +558,13 @@ public:
     remote_plist parent_ptr = root;
 
     // start at root
-    CachedObject<PList> curr = cache->Read<PList>(root);
+    CachedObject<PList> curr = read_plist(root, 1);
     while (true) {
       uint64_t bucket = level_hash(key, depth, count);
       // Normal descent
       if (curr->buckets[bucket].lock == P_UNLOCKED){
         auto bucket_base = static_cast<remote_plist>(curr->buckets[bucket].base);
-        curr = cache->ExtendedRead<PList>(bucket_base, 1 << depth);
+        curr = read_plist(bucket_base, depth + 1);
         parent_ptr = bucket_base;
         depth++;
         count *= 2;
@@ -359,37 +574,58 @@ public:
       // Erroneous descent into EList (Think we are at an EList, but it turns out its a PList)
       if (!acquire(pool, get_lock(parent_ptr, bucket))){
         // We must re-fetch the PList to ensure freshness of our pointers (1 << depth-1 to adjust size of read with customized ExtendedRead)
-        curr = cache->ExtendedRead<PList>(parent_ptr, 1 << (depth - 1));
+        curr = read_plist(parent_ptr, depth);
         continue;
       }
 
       // We locked an elist, we can read the baseptr and progress
       remote_elist bucket_base = static_cast<remote_elist>(curr->buckets[bucket].base);
+      if (bucket_base == nullptr) bucket_base = static_cast<remote_elist>(read_bucket_base(pool, parent_ptr, bucket));
+      if (bucket_base == nullptr) {
+        // The first pair of the bucket. Its EList is published with the unlock
+        remote_elist e_new = new_elist(pool);
+        e_new->elist_insert(key, value);
+        publish_elist(pool, parent_ptr, bucket, e_new);
+        return std::nullopt;
+      }
       remote_elist e = is_local(bucket_base) ? bucket_base : pool->Read<EList>(bucket_base, temp_elist);
 
-      // We have recursed to an non-empty elist
-      for (size_t i = 0; i < e->count; i++) {
-        // Linear search to determine if elist already contains the key
-        pair_t kv = e->pairs[i];
-        if (kv.key == key) {
-          std::optional<V> result = std::make_optional<V>(kv.val);
-          unlock(pool, get_lock(parent_ptr, bucket), E_UNLOCKED);
-          return result;
-        }
+      // We have recursed to an non-empty elist, determine if it already contains the key
+      int i = key_search::find_key(e->pairs, e->count, key);
+      if (i != -1) {
+        std::optional<V> result = std::make_optional<V>(e->pairs[i].val);
+        unlock(pool, get_lock(parent_ptr, bucket), E_UNLOCKED);
+        return result;
       }
 
       // Check for enough insertion room
       if (e->count < ELIST_SIZE) {
         // insert, unlock, return
+        elist_begin_write(bucket_base, e.get());
         e->elist_insert(key, value);
         // If we are modifying a local copy, we need to write to the remote at the end
-        if (!is_local(bucket_base)) pool->Write<EList>(bucket_base, *e);
-        unlock(pool, get_lock(parent_ptr, bucket), E_UNLOCKED);
+        elist_end_write(pool, bucket_base, e.get(), get_lock(parent_ptr, bucket));
         return std::nullopt;
       }
 
       // Need more room so rehash into plist and perma-unlock
-      remote_plist p = rehash(pool, curr.get(), count, depth, bucket);
+      // The PList is built from a copy of the EList with the bucket unlocked, so other threads only wait for it to be published
+      EList full = *e;
+      unlock(pool, get_lock(parent_ptr, bucket), E_UNLOCKED);
+      remote_plist p = build_plist(pool, full, count, depth);
+      if (!acquire(pool, get_lock(parent_ptr, bucket))) {
+        // Another thread rehashed the bucket
+        discard_plist(pool, p, count);
+        curr = read_plist(parent_ptr, depth);
+        continue;
+      }
+      if (read_version(pool, bucket_base) != full.version) {
+        // The EList changed while it was unlocked, try again
+        unlock(pool, get_lock(parent_ptr, bucket), E_UNLOCKED);
+        discard_plist(pool, p, count);
+        continue;
+      }
+      retire_elist(pool, bucket_base, is_local(bucket_base) ? bucket_base.get() : &full);
       if (cache_depth_ > depth)
         p = mark_ptr(p);
 
@@ -397,16 +633,15 @@ public:
       // todo: remove these lines if they can be removed (we want our cached object to have read-only semantics)
       // curr->buckets[bucket].base = static_cast<remote_baseptr>(p);
       // curr->buckets[bucket].lock = P_UNLOCKED;
-      change_bucket_pointer(pool, parent_ptr, bucket, static_cast<remote_baseptr>(p));
-      unlock(pool, get_lock(parent_ptr, bucket), P_UNLOCKED);
+      // the base and the lock are written together, and the write is acked so the unlock is placed before the invalidate
+      change_bucket_pointer(pool, parent_ptr, bucket, static_cast<remote_baseptr>(p), P_UNLOCKED);
       // Prevent invalidate occuring before unlock
       std::atomic_thread_fence(std::memory_order_seq_cst);
       // have to invalidate a line associated with the object at parent_ptr
-      // todo: async processing of unlock to ensure ordering (unlock -> invalidate)
       cache->Invalidate(parent_ptr);
 
       // we need to refresh our copy as well :)
-      curr = cache->ExtendedRead<PList>(parent_ptr, 1 << (depth - 1)); // todo: check this
+      curr = read_plist(parent_ptr, depth); // todo: check this
     }
   }
 
@@ -422,14 +657,14 @@ public:
     remote_plist parent_ptr = root;
 
     // start at root
-    CachedObject<PList> curr = cache->Read<PList>(root);
+    CachedObject<PList> curr = read_plist(root, 1);
 
     while (true) {
       uint64_t bucket = level_hash(key, depth, count);
       // Normal descent
       if (curr->buckets[bucket].lock == P_UNLOCKED){
         auto bucket_base = static_cast<remote_plist>(curr->buckets[bucket].base);
-        curr = cache->ExtendedRead<PList>(bucket_base, 1 << depth);
+        curr = read_plist(bucket_base, depth + 1);
         parent_ptr = bucket_base;
         depth++;
         count *= 2;
@@ -439,37 +674,152 @@ public:
       // Erroneous descent into EList (Think we are at an EList, but it turns out its a PList)
       if (!acquire(pool, get_lock(parent_ptr, bucket))){
         // We must re-fetch the PList to ensure freshness of our pointers (1 << depth-1 to adjust size of read with customized ExtendedRead)
-        curr = cache->ExtendedRead<PList>(parent_ptr, 1 << (depth - 1));
+        curr = read_plist(parent_ptr, depth);
         continue;
       }
 
       // We locked an elist, we can read the baseptr and progress
       remote_elist bucket_base = static_cast<remote_elist>(curr->buckets[bucket].base);
+      if (bucket_base == nullptr) bucket_base = static_cast<remote_elist>(read_bucket_base(pool, parent_ptr, bucket));
+      if (bucket_base == nullptr) {
+        // An empty bucket
+        unlock(pool, get_lock(parent_ptr, bucket), E_UNLOCKED);
+        return std::nullopt;
+      }
       // Past this point we have recursed to an elist
       remote_elist e = is_local(bucket_base) ? bucket_base : pool->Read<EList>(bucket_base, temp_elist);
 
-      // Get elist and linear search
-      for (size_t i = 0; i < e->count; i++) {
-        // Linear search to determine if elist already contains the value
-        pair_t kv = e->pairs[i];
-        if (kv.key == key) {
-          std::optional<V> result = std::make_optional<V>(kv.val); // saving the previous value at key
-          // Edge swap if count != (0 or 1)
-          if (e->count > 1) {
-            e->pairs[i] = e->pairs[e->count - 1];
-          }
-          e->count -= 1;
-          // If we are modifying the local copy, we need to write to the remote
-          if (!is_local(bucket_base)) pool->Write<EList>(bucket_base, *e);
-          unlock(pool, get_lock(parent_ptr, bucket), E_UNLOCKED);
-          return result;
+      // Get elist and search for the key
+      int i = key_search::find_key(e->pairs, e->count, key);
+      if (i != -1) {
+        std::optional<V> result = std::make_optional<V>(e->pairs[i].val); // saving the previous value at key
+        elist_begin_write(bucket_base, e.get());
+        // Edge swap if count != (0 or 1)
+        if (e->count > 1) {
+          e->pairs[i] = e->pairs[e->count - 1];
         }
+        e->count -= 1;
+        // If we are modifying the local copy, we need to write to the remote
+        elist_end_write(pool, bucket_base, e.get(), get_lock(parent_ptr, bucket));
+        return result;
       }
       unlock(pool, get_lock(parent_ptr, bucket), E_UNLOCKED);
       return std::nullopt;
     }
   }
 
+  /// @brief Gets the values of a batch of keys. The keys descend the PLists together and keys that share an EList read it once
+  /// @param pool the capability providing one-sided RDMA
+  /// @param keys the keys to search on
+  /// @return the result of contains for each key
+  std::vector<std::optional<V>> multi_contains(CountingPool* pool, const std::vector<K>& keys) {
+    std::vector<std::optional<V>> results(keys.size());
+    std::vector<batch_pos_t> pos = descend_batch(keys);
+    std::vector<size_t> order = order_by_elist(pos);
+    for (size_t g = 0; g < order.size();) {
+      remote_elist bucket_base = static_cast<remote_elist>(pos[order[g]].base);
+      size_t end = g;
+      while (end < order.size() && pos[order[end]].base == pos[order[g]].base) end++;
+      if (bucket_base == nullptr) {
+        // Empty buckets (see contains)
+        g = end;
+        continue;
+      }
+      remote_elist e = pool->Read<EList>(bucket_base, temp_elist);
+      // Torn read, read it again
+      if (e->version != e->version_tail) continue;
+      bool retired = e->version & RETIRED;
+      for (; g < end; g++) {
+        size_t i = order[g];
+        if (retired) {
+          // the EList was rehashed, search for the key on its own
+          results[i] = contains(pool, keys[i]);
+          continue;
+        }
+        int idx = key_search::find_key(e->pairs, e->count, keys[i]);
+        if (idx != -1) results[i] = std::make_optional<V>(e->pairs[idx].val);
+      }
+    }
+    return results;
+  }
+
+  /// @brief Insert a batch of keys and values. The keys descend the PLists together, the bucket locks of the batch are CASed together
+  /// and keys that share an EList are inserted with one read and one write. Keys whose bucket is busy or full are inserted one at a time
+  /// @param pool the capability providing one-sided RDMA
+  /// @param keys the keys to insert
+  /// @param values the value to associate with each key
+  /// @return the result of insert for each key
+  std::vector<std::optional<V>> multi_insert(CountingPool* pool, const std::vector<K>& keys, const std::vector<V>& values) {
+    std::vector<std::optional<V>> results(keys.size());
+    std::vector<batch_pos_t> pos = descend_batch(keys);
+    std::vector<size_t> order = order_by_elist(pos);
+
+    // Post a CAS for the lock of every bucket of the batch (ordered by node) and wait for them together
+    std::vector<size_t> groups; // the start of each bucket in order
+    for (size_t g = 0; g < order.size(); g++) {
+      batch_pos_t p = pos[order[g]];
+      if (g == 0 || get_lock(p.parent_ptr, p.bucket) != get_lock(pos[order[g - 1]].parent_ptr, pos[order[g - 1]].bucket)) groups.push_back(g);
+    }
+    while (temp_cas.size() < groups.size()) temp_cas.push_back(pool->Allocate<lock_type>());
+    std::vector<uint64_t> ids(groups.size());
+    for (size_t j = 0; j < groups.size(); j++) {
+      batch_pos_t p = pos[order[groups[j]]];
+      remote_lock lock = get_lock(p.parent_ptr, p.bucket);
+      pool->CompareAndSwapAsync(lock, temp_cas[j], E_UNLOCKED, E_LOCKED);
+      ids[j] = lock.id();
+    }
+    for (size_t j = 0; j < groups.size(); j++) {
+      pool->Await(ids[j], groups.size() - j - 1);
+    }
+
+    std::vector<size_t> single; // keys to insert one at a time
+    for (size_t j = 0; j < groups.size(); j++) {
+      size_t start = groups[j];
+      size_t end = j + 1 < groups.size() ? groups[j + 1] : order.size();
+      batch_pos_t p = pos[order[start]];
+      if (*temp_cas[j] != E_UNLOCKED) {
+        // busy or rehashed into a PList
+        for (size_t g = start; g < end; g++) single.push_back(order[g]);
+        continue;
+      }
+      remote_elist bucket_base = static_cast<remote_elist>(p.base);
+      if (bucket_base == nullptr) bucket_base = static_cast<remote_elist>(read_bucket_base(pool, p.parent_ptr, p.bucket));
+      // The first pairs of an empty bucket go into a new EList
+      bool empty = bucket_base == nullptr;
+      if (empty) bucket_base = new_elist(pool);
+      remote_elist e = is_local(bucket_base) ? bucket_base : pool->Read<EList>(bucket_base, temp_elist);
+      bool modified = false;
+      for (size_t g = start; g < end; g++) {
+        size_t i = order[g];
+        int idx = key_search::find_key(e->pairs, e->count, keys[i]);
+        if (idx != -1) {
+          results[i] = std::make_optional<V>(e->pairs[idx].val);
+        } else if (e->count < ELIST_SIZE) {
+          // (a new EList is private until it is published)
+          if (!modified && !empty) elist_begin_write(bucket_base, e.get());
+          modified = true;
+          e->elist_insert(keys[i], values[i]);
+        } else {
+          // needs a rehash
+          single.push_back(i);
+        }
+      }
+      if (empty) {
+        publish_elist(pool, p.parent_ptr, p.bucket, bucket_base);
+      } else if (modified) {
+        elist_end_write(pool, bucket_base, e.get(), get_lock(p.parent_ptr, p.bucket));
+      } else {
+        unlock(pool, get_lock(p.parent_ptr, p.bucket), E_UNLOCKED);
+      }
+    }
+
+    // Without holding any lock of the batch (i.e. a full EList is rehashed)
+    for (size_t i : single) {
+      results[i] = insert(pool, keys[i], values[i]);
+    }
+    return results;
+  }
+
   /// @brief Populate only works when we have numerical keys. Will add data
   /// @param pool the capability providing one-sided RDMA
   /// @param op_count the number of values to insert. Recommended in total to do key_range / 2
@@ -477,9 +827,9 @@ public:
   /// @param key_ub the upper bound for the key range
   /// @param value the value to associate with each key. Currently, we have
   /// asserts for result to be equal to the key. Best to set value equal to key!
-  int populate(CountingPool* pool, int op_count, K key_lb, K key_ub, std::function<K(V)> value) {
-    // Populate only works when we have numerical keys
-    K key_range = key_ub - key_lb;
+  int populate(CountingPool* pool, int op_count, int key_lb, int key_ub, std::function<V(int)> value) {
+    // Populate works on a numerical key space, the numbers are made into keys with key_hash::from_int
+    int key_range = key_ub - key_lb;
     // Create a random operation generator that is
     // - evenly distributed among the key range
     int success_count = 0;
@@ -487,13 +837,104 @@ public:
     std::default_random_engine gen(std::chrono::system_clock::now().time_since_epoch().count() * self_.id);
     while (success_count != op_count) {
       int k = (dist(gen) * key_range) + key_lb;
-      if (insert(pool, k, value(k)) == std::nullopt) success_count++;
+      if (insert(pool, key_hash::from_int<K>(k), value(k)) == std::nullopt) success_count++;
       // Wait some time before doing next insert...
       std::this_thread::sleep_for(std::chrono::nanoseconds(10));
     }
     return success_count;
   }
 
+  /// A breadth-first scan over the pairs of the IHT (i.e. for backups and analytics). Doesn't take locks and doesn't go through the cache
+  /// Every PList of a level is read before the next level. The ELists of a PList are read grouped by the node that owns them
+  /// If consistent, every EList is validated with its versions (so the pairs of a bucket are from one moment)
+  /// and an EList that was rehashed since its PList was read is replaced by the new PList. Otherwise the pairs are yielded as read
+  /// Concurrent inserts and removes might or might not be seen. Must be destroyed with the pool it used
+  class Iterator {
+    /// A PList to visit (and its size as a multiple of PLIST_SIZE)
+    struct level_t {
+      remote_plist ptr;
+      int size;
+    };
+
+    RdmaIHT* iht;
+    bool consistent;
+    std::deque<level_t> plists;
+    std::vector<pair_t> pairs; // the pairs of the last visited PList
+    size_t at = 0;
+    remote_elist landing;
+
+    /// Read the pairs of the ELists of the next PList
+    void visit(CountingPool* pool) {
+      level_t level = plists.front();
+      plists.pop_front();
+      remote_plist ptr = unmark_ptr(level.ptr);
+      int buckets = level.size * PLIST_SIZE;
+      remote_plist local = iht->is_local(ptr) ? ptr : pool->template ExtendedRead<PList>(ptr, level.size);
+
+      std::vector<int> elists;
+      for (int i = 0; i < buckets; i++) {
+        plist_pair_t bucket = local->buckets[i];
+        if (bucket.base == nullptr) continue;
+        if (bucket.lock == iht->P_UNLOCKED) {
+          plists.push_back({static_cast<remote_plist>(bucket.base), level.size * 2});
+        } else {
+          elists.push_back(i);
+        }
+      }
+      std::sort(elists.begin(), elists.end(), [&](int a, int b){ return local->buckets[a].base.id() < local->buckets[b].base.id(); });
+
+      pairs.clear();
+      at = 0;
+      for (int i : elists) {
+        remote_elist base = unmark_ptr(static_cast<remote_elist>(local->buckets[i].base));
+        while (true) {
+          EList e = iht->is_local(base) ? *base : *pool->template Read<EList>(base, landing);
+          if (consistent) {
+            // Torn read (a writer was writing the elist), read it again
+            if (e.version != e.version_tail) continue;
+            if (e.version & RETIRED) {
+              // Rehashed since the PList was read, visit the PList that replaced it
+              rdma_ptr<plist_pair_t> bucket_ptr = iht->get_bucket(ptr, i);
+              plist_pair_t bucket = iht->is_local(bucket_ptr) ? *bucket_ptr : *pool->template Read<plist_pair_t>(bucket_ptr, iht->temp_bucket);
+              plists.push_back({static_cast<remote_plist>(bucket.base), level.size * 2});
+              break;
+            }
+          }
+          for (size_t j = 0; j < e.count && j < ELIST_SIZE; j++) pairs.push_back(e.pairs[j]);
+          break;
+        }
+      }
+      if (local != ptr) pool->template Deallocate<PList>(local, level.size);
+    }
+
+  public:
+    Iterator(CountingPool* pool, RdmaIHT* iht, bool consistent) : iht(iht), consistent(consistent) {
+      plists.push_back({iht->root, 1});
+      landing = pool->template Allocate<EList>();
+    }
+
+    /// The next pair, or an empty optional at the end of the scan
+    std::optional<std::pair<K, V>> next(CountingPool* pool) {
+      while (at == pairs.size()) {
+        if (plists.empty()) return std::nullopt;
+        visit(pool);
+      }
+      pair_t pair = pairs[at++];
+      return std::make_optional(std::make_pair(pair.key, pair.val));
+    }
+
+    void destroy(CountingPool* pool) {
+      pool->template Deallocate<EList>(landing);
+    }
+  };
+
+  /// @brief Start a scan over the pairs of the IHT. See Iterator
+  /// @param pool the capability providing one-sided RDMA (used by every call to next)
+  /// @param consistent if the pairs of each bucket should be validated to be from one moment
+  Iterator scan(CountingPool* pool, bool consistent = false) {
+    return Iterator(pool, this, consistent);
+  }
+
   /// No concurrent or thread safe. Counts the number of elements in the IHT
   int count(CountingPool* pool){
     return count_plist(pool, root, 1);
@@ -22,11 +22,15 @@ class CountingPool {
     int total_allocations;
     int total_deallocations;
     bool locality;
+    int node; // -1 unless the pool stands for one of several nodes
     shared_mutex mu;
     mutex alloc_mu;
 
 public:
-    CountingPool(bool all_local) : locality(all_local), total_allocations(0), total_deallocations(0) {}
+    CountingPool(bool all_local) : locality(all_local), node(-1), total_allocations(0), total_deallocations(0) {}
+
+    /// A pool standing for node node_id (i.e. to run several nodes in one process). Its objects carry the node id and only those are local
+    explicit CountingPool(int node_id) : locality(false), node(node_id), total_allocations(0), total_deallocations(0) {}
 
     /// Returns a value that accounts for alignment of the type (for parity with slab allocator)
     template <typename T>
@@ -39,7 +43,7 @@ public:
         allocat[(void*) p] = bytes;
         ptr_map[(void*) p] = org_ptr;
         alloc_mu.unlock();
-        return rdma_ptr<T>(0, p);
+        return rdma_ptr<T>(node == -1 ? 0 : node, p);
     }
 
     template <typename T>
@@ -114,7 +118,7 @@ public:
     }
 
     template <typename T>
-    T CompareAndSwap(rdma_ptr<T> ptr, uint64_t expected, uint64_t swap) {
+    T CompareAndSwap(rdma_ptr<T> ptr, uint64_t expected, uint64_t swap, internal::RDMAWriteBehavior write_behavior = internal::RDMAWriteWithAck) {
         mu.lock();
         uint64_t prev = *ptr;
         if (prev == expected){
@@ -156,6 +160,7 @@ public:
 
     template <typename T>
     bool is_local(rdma_ptr<T> p){
+        if (node != -1) return p.id() == node;
         return locality;
     }
 
@@ -0,0 +1,65 @@
+#include <remus/logging/logging.h>
+#include <remus/rdma/memory_pool.h>
+#include <remus/rdma/rdma.h>
+
+#include <dcache/cache_store.h>
+#include <dcache/cached_ptr.h>
+
+#include <set>
+#include <thread>
+
+#include "../../iht/common.h"
+#include "faux_mempool.h"
+#include "../../iht/cached/ds/iht_ds_cached.h"
+
+using namespace remus::rdma;
+
+// Set remote cache static variables
+template<> inline thread_local CacheMetrics RemoteCacheImpl<CountingPool>::metrics = CacheMetrics();
+template<> inline thread_local CountingPool* RemoteCacheImpl<CountingPool>::pool = nullptr;
+
+typedef RdmaIHT<int, int, CNF_ELIST_SIZE, CNF_PLIST_SIZE, key_hash::Mix13Hash, CountingPool> IHT;
+
+int main(){
+    REMUS_INIT_LOG();
+
+    CountingPool* pool = new CountingPool(0);
+    RemoteCacheImpl<CountingPool>* cache = new RemoteCacheImpl<CountingPool>(pool, 0);
+    cache->init({cache->root()}, 0); // initialize with itself
+    Peer self = Peer(0);
+
+    // Consistent scans while another thread inserts (and rehashes the ELists being scanned)
+    IHT* writer = new IHT(self, CacheDepth::UpToLayer1, cache, pool);
+    IHT* reader = new IHT(self, CacheDepth::UpToLayer1, cache, pool);
+    reader->InitFromPointer(writer->InitAsFirst(pool));
+    const int keys = 20000;
+    std::atomic<bool> done = false;
+    std::thread inserts([&](){
+        RemoteCacheImpl<CountingPool>::pool = pool;
+        for (int i = 0; i < keys; i++) writer->insert(pool, i, i);
+        done = true;
+    });
+    int scans = 0;
+    RemoteCacheImpl<CountingPool>::pool = pool;
+    while (!done) {
+        IHT::Iterator it = reader->scan(pool, true);
+        std::set<int> seen;
+        for (auto pair = it.next(pool); pair.has_value(); pair = it.next(pool)) {
+            REMUS_ASSERT(pair->first >= 0 && pair->first < keys && pair->second == pair->first, "Scanned a pair that was inserted ({}, {})", pair->first, pair->second);
+            REMUS_ASSERT(seen.insert(pair->first).second, "Scanned key {} once", pair->first);
+        }
+        it.destroy(pool);
+        scans++;
+    }
+    inserts.join();
+    IHT::Iterator it = reader->scan(pool, true);
+    int count = 0;
+    for (auto pair = it.next(pool); pair.has_value(); pair = it.next(pool)) count++;
+    it.destroy(pool);
+    REMUS_ASSERT(count == keys, "Scanned every key once the inserts are done ({} != {})", count, keys);
+    REMUS_INFO("Test 1 -- PASSED ({} scans during the inserts)", scans);
+
+    writer->destroy(pool);
+    reader->destroy(pool);
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include "../../iht/cached/ds/key_search.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <remus/logging/logging.h>
+
+#define test(condition, message){ \
+    if (!(condition)){ \
+        REMUS_ERROR("Error: {}", message); \
+        exit(1); \
+    } \
+}
+
+template <typename K, typename V>
+struct Pair {
+    K key;
+    V val;
+};
+
+/// Compare count_less against a scalar count over sorted arrays of every length up to 40
+template <typename K>
+void test_count_less(std::mt19937_64& gen, K low, K high){
+    std::uniform_int_distribution<K> dist(low, high);
+    for(int n = 0; n <= 40; n++){
+        for(int trial = 0; trial < 100; trial++){
+            std::vector<K> keys(n);
+            for(K& k : keys) k = dist(gen);
+            std::sort(keys.begin(), keys.end());
+            K key = trial % 2 == 0 || n == 0 ? dist(gen) : keys[trial % n];
+            int expected = std::lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+            test(key_search::count_less(keys.data(), n, key) == expected, "count_less matches the lower bound");
+        }
+    }
+}
+
+/// Compare find_key against a linear search over arrays of every length up to 40
+template <typename K, typename V>
+void test_find_key(std::mt19937_64& gen, K low, K high){
+    std::uniform_int_distribution<K> dist(low, high);
+    for(int n = 0; n <= 40; n++){
+        for(int trial = 0; trial < 100; trial++){
+            std::vector<Pair<K, V>> pairs(n);
+            for(Pair<K, V>& p : pairs){
+                p.key = dist(gen);
+                p.val = (V) p.key; // the value equals the key, so a match on the value must not be reported
+            }
+            K key = trial % 2 == 0 || n == 0 ? dist(gen) : pairs[trial % n].key;
+            int expected = -1;
+            for(int i = 0; i < n; i++) if (pairs[i].key == key) { expected = i; break; }
+            test(key_search::find_key(pairs.data(), n, key) == expected, "find_key finds the first match");
+        }
+    }
+}
+
+int main(){
+    REMUS_INFO("Testing Key Search");
+    std::mt19937_64 gen(42);
+
+    // -- Test 1 -- //
+    test_count_less<int32_t>(gen, -50, 50);
+    test_count_less<int32_t>(gen, INT32_MIN, INT32_MAX);
+    test_count_less<int64_t>(gen, -50, 50);
+    test_count_less<uint32_t>(gen, 0, UINT32_MAX);
+    test_count_less<uint64_t>(gen, 0, UINT64_MAX); // needs the unsigned bias
+    REMUS_INFO("Test 1 -- PASSED");
+
+    // -- Test 2 -- //
+    test_find_key<int32_t, int32_t>(gen, -50, 50);
+    test_find_key<int32_t, int32_t>(gen, INT32_MIN, INT32_MAX);
+    test_find_key<int64_t, int64_t>(gen, -50, 50);
+    test_find_key<uint64_t, uint64_t>(gen, 0, 100);
+    test_find_key<int32_t, int64_t>(gen, -50, 50); // not a vector layout, scalar search
+    REMUS_INFO("Test 2 -- PASSED");
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include <remus/logging/logging.h>
+#include <remus/rdma/rdma.h>
+
+#include <set>
+
+#include "faux_mempool.h"
+#include "../../iht/cached/ds/placement.h"
+
+using namespace remus::rdma;
+
+struct alignas(64) Object {
+    uint64_t value;
+};
+
+const int SLOTS = 64;
+typedef ObjectPlacement<Object, CountingPool, SLOTS> Placer;
+
+int main(){
+    REMUS_INIT_LOG();
+
+    // Two nodes with their own pool, so an object can only be deallocated by the node that allocated it
+    CountingPool* pool0 = new CountingPool(0);
+    CountingPool* pool1 = new CountingPool(1);
+    Placer* node0 = new Placer(pool0, Placement::Accessor, 0, {0, 1});
+    Placer* node1 = new Placer(pool1, Placement::Accessor, 1, {0, 1});
+    node0->init({node0->root(), node1->root()});
+    node1->init({node0->root(), node1->root()});
+
+    // Take the whole depot of node 0 from node 1
+    REMUS_ASSERT(node1->take(pool1, 0) == nullptr, "An empty depot has nothing to take");
+    node0->refill(pool0);
+    std::set<uint64_t> taken;
+    for (int i = 0; i < SLOTS; i++) {
+        rdma_ptr<Object> obj = node1->take(pool1, 0);
+        REMUS_ASSERT(obj != nullptr, "Took object {} of the depot", i);
+        REMUS_ASSERT(obj.id() == 0, "The object is on the node of the depot");
+        REMUS_ASSERT(taken.insert(obj.raw()).second, "Every slot holds a different object");
+    }
+    REMUS_ASSERT(node1->take(pool1, 0) == nullptr, "Took every object of the depot");
+    REMUS_ASSERT(node1->take(pool1, 7) == nullptr, "Nothing to take from an unknown node");
+    REMUS_INFO("Test 1 -- PASSED");
+
+    // The owner refills the empty slots, with new objects
+    node0->refill(pool0);
+    for (int i = 0; i < SLOTS / 2; i++) {
+        rdma_ptr<Object> obj = node1->take(pool1, 0);
+        REMUS_ASSERT(obj != nullptr && obj.id() == 0, "Took object {} of the refilled depot", i);
+        REMUS_ASSERT(taken.insert(obj.raw()).second, "The refilled slots hold new objects");
+    }
+    node0->refill(pool0); // only the emptied slots are refilled
+    REMUS_INFO("Test 2 -- PASSED");
+
+    // Accessor places an object on the node that accessed its position the most
+    uint64_t position = 0x1234, other = 0x5678;
+    for (int i = 0; i < 3; i++) node1->sample(pool1, 0, position);
+    node0->sample(pool0, 0, position);
+    REMUS_ASSERT(node0->choose(pool0, 0, position) == 1, "Node 0 places on the node accessing the position the most");
+    REMUS_ASSERT(node1->choose(pool1, 0, position) == 1, "Node 1 places on itself");
+    node0->sample(pool0, 0, other);
+    REMUS_ASSERT(node1->choose(pool1, 0, other) == 0, "Node 1 places on the only node accessing the position");
+    REMUS_ASSERT(node1->choose(pool1, 0, 0x9abc) == 1, "A position that wasn't accessed is placed locally");
+    REMUS_ASSERT(node0->choose(pool0, 7, position) == 0, "A position of an unknown node is placed locally");
+    REMUS_INFO("Test 3 -- PASSED");
+
+    // The taken objects are returned to their owner (i.e. through a ReturnInbox) and destroy frees the rest of the depot
+    for (uint64_t raw : taken) pool0->Deallocate<Object>(rdma_ptr<Object>(raw));
+    node1->refill(pool1);
+    node0->destroy(pool0);
+    node1->destroy(pool1);
+    REMUS_ASSERT(pool0->HasNoLeaks(), "Node 0 freed every object of its depot");
+    REMUS_ASSERT(pool1->HasNoLeaks(), "Node 1 freed every object of its depot");
+
+    // Local placement doesn't stock a depot
+    Placer* local = new Placer(pool0, Placement::Local, 0, {0});
+    local->init({local->root()});
+    local->refill(pool0);
+    REMUS_ASSERT(local->take(pool0, 0) == nullptr, "A local placement has an empty depot");
+    REMUS_ASSERT(local->choose(pool0, 0, position) == 0, "A local placement places on itself");
+    local->destroy(pool0);
+    REMUS_ASSERT(pool0->HasNoLeaks(), "Freed the local placement");
+    REMUS_INFO("Test 4 -- PASSED");
+    return 0;
+}
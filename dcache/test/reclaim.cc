@@ -0,0 +1,140 @@
+#include <remus/logging/logging.h>
+#include <remus/rdma/memory_pool.h>
+#include <remus/rdma/rdma.h>
+
+#include <dcache/cache_store.h>
+#include <dcache/cached_ptr.h>
+
+#include <barrier>
+#include <thread>
+
+#include "../../iht/common.h"
+#include "faux_mempool.h"
+#include "../../iht/cached/ds/iht_ds_cached.h"
+
+using namespace remus::rdma;
+
+// Set remote cache static variables
+template<> inline thread_local CacheMetrics RemoteCacheImpl<CountingPool>::metrics = CacheMetrics();
+template<> inline thread_local CountingPool* RemoteCacheImpl<CountingPool>::pool = nullptr;
+
+typedef RdmaIHT<int, int, CNF_ELIST_SIZE, CNF_PLIST_SIZE, key_hash::Mix13Hash, CountingPool> IHT;
+
+/// Slots of an inbox (see IHT::Inbox)
+const int INBOX_SLOTS = 64;
+/// Operations between two drains of the inbox (see RdmaIHT::DRAIN_PERIOD)
+const int DRAIN_PERIOD = 100;
+
+/// One node of the IHT. Every node has its own pool, so only the node that allocated an EList can deallocate it
+struct Node {
+    CountingPool* pool;
+    RemoteCacheImpl<CountingPool>* cache;
+    IHT::EBR* ebr;
+    IHT::Inbox* inbox;
+    IHT* iht;
+
+    Node(int id) {
+        pool = new CountingPool(id);
+        cache = new RemoteCacheImpl<CountingPool>(pool, id);
+        cache->init({cache->root()}, 0); // each node only caches its own reads
+        ebr = new IHT::EBR(pool, 1);
+        inbox = new IHT::Inbox(pool);
+        Peer self = Peer(id);
+        iht = new IHT(self, CacheDepth::None, cache, pool, ebr, inbox);
+    }
+
+    /// Bind the calling thread to the node (the EBR and the cache keep their state per thread)
+    void enter() {
+        RemoteCacheImpl<CountingPool>::pool = pool;
+        ebr->RegisterThread();
+    }
+};
+
+/// The number of ELists waiting in an inbox for their owner to drain it
+int inbox_occupancy(Node* n) {
+    uint64_t* slots = (uint64_t*) rdma_ptr<uint64_t>(n->inbox->root()).address();
+    int count = 0;
+    for (int i = 0; i < INBOX_SLOTS; i++) {
+        if (slots[i] != 0) count++;
+    }
+    return count;
+}
+
+int main(){
+    REMUS_INIT_LOG();
+
+    // Node 0 creates the ELists, node 1 rehashes them and returns the reclaimed ones to node 0
+    Node* owner = new Node(0);
+    Node* peer = new Node(1);
+    owner->inbox->init({owner->inbox->root(), peer->inbox->root()});
+    peer->inbox->init({owner->inbox->root(), peer->inbox->root()});
+    peer->iht->InitFromPointer(owner->iht->InitAsFirst(owner->pool));
+
+    const int owned = 2000; // keys inserted by the owner
+    const int total = 20000;
+    // The nodes take turns (the pools are separate so their CASes aren't atomic with each other's)
+    std::barrier turn(2);
+    std::atomic<bool> returned = false;
+
+    std::thread owner_thread([&](){
+        owner->enter();
+        for (int i = 0; i < owned; i++) {
+            REMUS_ASSERT(!owner->iht->insert(owner->pool, i, i).has_value(), "Inserted key on the owner");
+        }
+        turn.arrive_and_wait();
+        // the peer rehashes the owner's ELists
+        turn.arrive_and_wait();
+        while (!returned) {
+            // a drain period of operations on the owner empties its inbox
+            for (int i = 0; i < DRAIN_PERIOD; i++) owner->iht->contains(owner->pool, i);
+            REMUS_ASSERT(inbox_occupancy(owner) == 0, "The owner drained its inbox");
+            turn.arrive_and_wait();
+            // the peer retries the ELists that didn't fit
+            turn.arrive_and_wait();
+        }
+        for (int i = 0; i < total; i++) {
+            REMUS_ASSERT(owner->iht->contains(owner->pool, i).value_or(-1) == i, "The owner found key {} after the returns", i);
+        }
+        owner->iht->destroy(owner->pool);
+        owner->ebr->destroy(owner->pool);
+    });
+
+    std::thread peer_thread([&](){
+        peer->enter();
+        // the owner inserts
+        turn.arrive_and_wait();
+        for (int i = owned; i < total; i++) {
+            REMUS_ASSERT(!peer->iht->insert(peer->pool, i, i).has_value(), "Inserted key on the peer");
+        }
+        // Over an epoch, the owner's ELists that the peer rehashed were reused by the peer and pushed to the owner's inbox
+        // The owner isn't draining it, so it filled up and the rest wait on the peer
+        REMUS_ASSERT(inbox_occupancy(owner) == INBOX_SLOTS, "The peer filled the owner's inbox");
+        REMUS_ASSERT(peer->iht->unreturned_count() > 0, "The peer kept the ELists that didn't fit in the owner's inbox");
+        turn.arrive_and_wait();
+        int rounds = 0;
+        while (!returned) {
+            // the owner drains
+            turn.arrive_and_wait();
+            size_t before = peer->iht->unreturned_count();
+            for (int i = 0; i < DRAIN_PERIOD; i++) peer->iht->contains(peer->pool, i);
+            size_t after = peer->iht->unreturned_count();
+            REMUS_ASSERT(after < before, "The peer returned ELists once the owner's inbox had room ({} -> {})", before, after);
+            REMUS_ASSERT(++rounds < 1000, "The peer returned every EList");
+            returned = after == 0;
+            turn.arrive_and_wait();
+        }
+        REMUS_INFO("Returned the owner's ELists over {} drains", rounds);
+        for (int i = 0; i < total; i++) {
+            REMUS_ASSERT(peer->iht->contains(peer->pool, i).value_or(-1) == i, "The peer found key {} after the returns", i);
+        }
+        peer->iht->destroy(peer->pool);
+        peer->ebr->destroy(peer->pool);
+    });
+
+    owner_thread.join();
+    peer_thread.join();
+    peer->inbox->destroy(peer->pool);
+    owner->inbox->destroy(owner->pool);
+    REMUS_INFO("Test 1 -- PASSED");
+    return 0;
+}
@@ -1,8 +1,13 @@
 #pragma once
 
 #include "../experiment.h"
+#include "ds/key_hash.h"
 
+#include <algorithm>
 #include <functional>
+#include <random>
+#include <utility>
+#include <vector>
 #include <remus/metrics/workload_driver_result.h>
 #include <remus/util/tcp/tcp.h>
 #include <remus/rdma/rdma.h>
@@ -13,6 +18,16 @@ using namespace remus::metrics;
 
 #define PORT_NUM_TCP 19000
 
+/// The pairs a data structure is bulk-loaded with: a random half of the key range (the same on every node)
+template <class K = int, class V = int>
+inline std::vector<std::pair<K, V>> bulk_pairs(BenchmarkParams& params){
+    std::vector<std::pair<K, V>> pairs;
+    for(int k = params.key_lb; k < params.key_ub; k++) pairs.push_back({key_hash::from_int<K>(k), (V) k});
+    std::shuffle(pairs.begin(), pairs.end(), std::default_random_engine(params.key_ub));
+    pairs.resize(pairs.size() / 2);
+    return pairs;
+}
+
 inline void init_endpoints(tcp::EndpointManager* endpoint_managers[], BenchmarkParams& params, Peer host){
     // Initialize T endpoints, one for each thread
     for(uint16_t i = 0; i < params.thread_count; i++){
@@ -23,8 +23,9 @@
 using namespace remus::util;
 using namespace remus::rdma;
 
-inline void btree_run(BenchmarkParams& params, rdma_capability* capability, RemoteCache* cache, Peer& host, Peer& self, std::vector<Peer> peers){
-    using BTree = RdmaBPTree<int, 12, rdma_capability_thread>; // todo: increment size more?
+template <int DEGREE, class Layout, int DELTAS>
+inline void btree_run_layout(BenchmarkParams& params, rdma_capability* capability, RemoteCache* cache, Peer& host, Peer& self, std::vector<Peer> peers){
+    using BTree = RdmaBPTree<int, DEGREE, rdma_capability_thread, Layout, DELTAS>;
     // Create a list of client and server  threads
     std::vector<std::thread> threads;
     if (params.node_id == 0){
@@ -36,11 +37,24 @@ inline void btree_run(BenchmarkParams& params, rdma_capability* capability, Remo
 
             // Collect and redistribute the CacheStore pointers
             collect_distribute(socket_handle, params);
+            if (params.lock_table){
+                // Collect and redistribute the lock table pointers
+                collect_distribute(socket_handle, params);
+            }
 
             // Create a root ptr to the IHT
             Peer p = Peer();
-            BTree btree = BTree(p, CacheDepth::None, cache, pool, nullptr, nullptr, true);
-            rdma_ptr<anon_ptr> root_ptr = btree.InitAsFirst(pool);
+            rdma_ptr<anon_ptr> root_ptr;
+            if (params.bulk_load){
+                // Load half of the key range (the same as the clients would populate). The bnodes are marked for the clients' cache depth
+                BTree btree = BTree(p, params.cache_depth, cache, pool, nullptr, nullptr, true);
+                std::vector<std::pair<int, int>> pairs = bulk_pairs(params);
+                root_ptr = btree.InitFromBulk(pool, pairs);
+                REMUS_INFO("[SERVER THREAD] -- Bulk-loaded {} keys", pairs.size());
+            } else {
+                BTree btree = BTree(p, CacheDepth::None, cache, pool, nullptr, nullptr, true);
+                root_ptr = btree.InitAsFirst(pool);
+            }
             // Send the root pointer over
             tcp::message ptr_message = tcp::message(root_ptr.raw());
             socket_handle->send_to_all(&ptr_message);
@@ -70,8 +84,8 @@ inline void btree_run(BenchmarkParams& params, rdma_capability* capability, Remo
     std::this_thread::sleep_for(std::chrono::milliseconds(10));
 
     /// Create an ebr object
-    using EBRLeaf = EBRObjectPool<BTree::BLeaf, 100, rdma_capability_thread>;
-    using EBRNode = EBRObjectPoolAccompany<BTree::BNode, BTree::BLeaf, 100, rdma_capability_thread>;
+    using EBRLeaf = EBRObjectPool<typename BTree::BLeaf, 100, rdma_capability_thread>;
+    using EBRNode = EBRObjectPoolAccompany<typename BTree::BNode, typename BTree::BLeaf, 100, rdma_capability_thread>;
     auto ebr_pool = capability->RegisterThread();
     EBRLeaf* ebr_leaf = new EBRLeaf(ebr_pool, params.thread_count);
     for(int i = 0; i < peers.size(); i++){
@@ -80,7 +94,11 @@ inline void btree_run(BenchmarkParams& params, rdma_capability* capability, Remo
     ebr_leaf->Init(capability, self.id, peers);
     REMUS_INFO("Init ebr");
     EBRNode* ebr_node = new EBRNode(ebr_leaf);
+    /// Create the table of the node locks (shared by the threads, like the cache)
+    LockTable<rdma_capability_thread>* locks = params.lock_table ? new LockTable<rdma_capability_thread>(ebr_pool) : nullptr;
 
+    /// The root of the structure the clients run on (to key the cache snapshot to it)
+    uint64_t structure_root = 0;
     // Barrier to start all the clients at the same time
     std::barrier client_sync = std::barrier(params.thread_count);
     WorkloadDriverResult workload_results[params.thread_count];
@@ -101,10 +119,20 @@ inline void btree_run(BenchmarkParams& params, rdma_capability* capability, Remo
             }));
             cache->init(peer_roots, params.node_count - 1);
 
-            std::shared_ptr<BTree> btree = std::make_shared<BTree>(self, params.cache_depth, cache, pool, ebr_leaf, ebr_node);
+            if (locks != nullptr){
+                // Exchange the lock tables of the node locks
+                vector<uint64_t> peer_locks;
+                map_reduce(endpoint, params, locks->root(), std::function<void(uint64_t)>([&](uint64_t data){
+                    peer_locks.push_back(data);
+                }));
+                locks->init(peer_locks);
+            }
+
+            std::shared_ptr<BTree> btree = std::make_shared<BTree>(self, params.cache_depth, cache, pool, ebr_leaf, ebr_node, false, locks);
             // Get the data from the server to init the btree
             tcp::message ptr_message;
             endpoint->recv_server(&ptr_message);
+            if (thread_index == 0) structure_root = ptr_message.get_first();
             btree->InitFromPointer(rdma_ptr<anon_ptr>(ptr_message.get_first()));
 
             REMUS_DEBUG("Creating client");
@@ -119,8 +147,17 @@ inline void btree_run(BenchmarkParams& params, rdma_capability* capability, Remo
                         }
                         // capability->RegisterThread();
                         ExperimentManager::ClientArriveBarrier(endpoint);
-                        delta += btree->populate(pool, param1, param2, param3, [=](int key){ return key; });
+                        if (!params.bulk_load){
+                            delta += btree->populate(pool, param1, param2, param3, [=](int key){ return key; });
+                        } else if (params.node_id == 0 && thread_index == 0){
+                            // account for the bulk-load once
+                            delta += bulk_pairs(params).size();
+                        }
                         ExperimentManager::ClientArriveBarrier(endpoint);
+                        if (params.cache_snapshot){
+                            // warm up with the lines saved by the last run of this structure (split across the threads)
+                            cache->prefetch_lines("cache_lines_" + std::to_string(params.node_id) + ".txt", ptr_message.get_first(), thread_index, params.thread_count);
+                        }
                         populate_amount = btree->count(pool); // ? IMPORTANT - Count hits every element which in effect warms up the cache
                                         // ? BENCHMARK EXECUTION STARTS WITH NO INVALID CACHE LINES
                         ExperimentManager::ClientArriveBarrier(endpoint);
@@ -187,10 +224,63 @@ inline void btree_run(BenchmarkParams& params, rdma_capability* capability, Remo
         t->join();
     }
     delete_endpoints(endpoint_managers, params);
+    // every node's clients passed the last barrier, so no peer locks a slot of this table anymore
+    if (locks != nullptr) locks->destroy(ebr_pool);
 
+    if (params.cache_snapshot) cache->dump_lines("cache_lines_" + std::to_string(params.node_id) + ".txt", structure_root);
     save_result("btree_result.csv", workload_results, params, params.thread_count);
 }
 
+/// Run the btree with the node layout from the params
+template <int DEGREE, int DELTAS>
+inline void btree_run_deltas(BenchmarkParams& params, rdma_capability* capability, RemoteCache* cache, Peer& host, Peer& self, std::vector<Peer> peers){
+    if (params.node_layout == node_layout::LineVersions::name){
+        btree_run_layout<DEGREE, node_layout::LineVersions, DELTAS>(params, capability, cache, host, self, peers);
+    } else if (params.node_layout == node_layout::Checksum<>::name){
+        btree_run_layout<DEGREE, node_layout::Checksum<>, DELTAS>(params, capability, cache, host, self, peers);
+    } else if (params.node_layout == node_layout::HeaderFooter::name){
+        btree_run_layout<DEGREE, node_layout::HeaderFooter, DELTAS>(params, capability, cache, host, self, peers);
+    } else {
+        REMUS_FATAL("Unknown node layout {} (line, checksum, header_footer)", params.node_layout);
+    }
+}
+
+/// Run the btree with or without delta records in its leaves (8 records per leaf)
+template <int DEGREE>
+inline void btree_run_degree(BenchmarkParams& params, rdma_capability* capability, RemoteCache* cache, Peer& host, Peer& self, std::vector<Peer> peers){
+    if (params.leaf_deltas){
+        btree_run_deltas<DEGREE, 8>(params, capability, cache, host, self, peers);
+    } else {
+        btree_run_deltas<DEGREE, 0>(params, capability, cache, host, self, peers);
+    }
+}
+
+/// Run the btree with the degree, node layout and leaf deltas from the params. Every degree is a precompiled instantiation
+inline void btree_run(BenchmarkParams& params, rdma_capability* capability, RemoteCache* cache, Peer& host, Peer& self, std::vector<Peer> peers){
+    switch (params.degree) {
+    case 4:
+        btree_run_degree<4>(params, capability, cache, host, self, peers);
+        break;
+    case 8:
+        btree_run_degree<8>(params, capability, cache, host, self, peers);
+        break;
+    case 12:
+        btree_run_degree<12>(params, capability, cache, host, self, peers);
+        break;
+    case 16:
+        btree_run_degree<16>(params, capability, cache, host, self, peers);
+        break;
+    case 32:
+        btree_run_degree<32>(params, capability, cache, host, self, peers);
+        break;
+    case 64:
+        btree_run_degree<64>(params, capability, cache, host, self, peers);
+        break;
+    default:
+        REMUS_FATAL("Unsupported degree {} (4, 8, 12, 16, 32 or 64)", params.degree);
+    }
+}
+
 inline void btree_run_tmp(BenchmarkParams& params, CountingPool* pool, RemoteCacheImpl<CountingPool>* cache, Peer& host, Peer& self, std::vector<Peer> peers){
     using BTreeLocal = RdmaBPTree<int, 1, CountingPool>;
 
@@ -1,7 +1,12 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <climits>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <iostream>
 #include <ostream>
 #include <random>
 #include <remus/logging/logging.h>
@@ -15,7 +20,11 @@
 #include "ebr.h"
 
 #include "../../common.h"
+#include "key_search.h"
+#include "lock_table.h"
+#include "node_layout.h"
 #include <optional>
+#include <vector>
 #include <remus/rdma/rdma_ptr.h>
 
 using namespace remus::rdma;
@@ -25,7 +34,11 @@ typedef int32_t K;
 
 static const bool ADDR = false;
 
-template <class V, int DEGREE, class capability> class RdmaBPTree {
+/// @tparam Layout how the nodes are laid out in memory and validated (see node_layout.h)
+/// @tparam DELTAS the number of delta records after each leaf (0 rewrites the whole leaf on every update)
+/// Inserts and removes that don't split or merge the leaf append a record to it instead of rewriting it. Readers merge the records into the leaf they read,
+/// and the leaf is rewritten (consolidated) once its records are full
+template <class V, int DEGREE, class capability, class Layout = node_layout::LineVersions, int DELTAS = 0> class RdmaBPTree {
   /// SIZE is DEGREE * 2
   // typedef CountingPool capability;
   // typedef rdma_capability_thread capability;
@@ -33,38 +46,9 @@ template <class V, int DEGREE, class capability> class RdmaBPTree {
 private:
   static const int SIZE = (DEGREE * 2) + 1;
   static const uint64_t LOCK_BIT = (uint64_t) 1 << 63;
-
-  static const int VLINE_SIZE = 56 / sizeof(V);
-  static const int HLINE_SIZE = 40 / sizeof(V);
-  #define KLINE_SIZE 14
-  #define PLINE_SIZE 7
-
-  /// A hybrid struct for the next ptr
-  struct hline {
-    long version;
-    V values[HLINE_SIZE];
-    K key_low; // lower bound (cannot be eq)
-    K key_high; // upper bound (can be eq)
-    rdma_ptr<hline> next;
-  };
-
-  /// A line with keys
-  struct kline {
-      long version;
-      K keys[KLINE_SIZE];
-  };
-
-  /// A line with values
-  struct vline {
-      long version;
-      V values[VLINE_SIZE];
-  };
-
-  /// A line with ptrs
-  struct pline {
-      long version;
-      rdma_ptr<pline> ptrs[PLINE_SIZE];
-  };
+  /// How often an empty leaf tries to lock its neighbor before it is written back unmerged.
+  /// The merge holds the leaf and its parent, so it can't wait: the neighbor's holder may need the parent, or share a slot of the lock table
+  static const int MERGE_ATTEMPTS = 16;
 
 public:
   struct BNode;
@@ -91,19 +75,10 @@ public:
 
   struct alignas(64) BNode {
   private:
-    const static int KLINES = (SIZE + KLINE_SIZE) / KLINE_SIZE;
-    const static int PLINES = (SIZE + 1 + PLINE_SIZE) / PLINE_SIZE;
-    kline key_lines[KLINES];
-    pline ptr_lines[PLINES];
+    typename Layout::template Inner<K, SIZE> data;
 
   public:
     BNode(){
-      for(int i = 0; i < KLINES; i++){
-        key_lines[i].version = 0;
-      }
-      for(int i = 0; i < PLINES; i++){
-        ptr_lines[i].version = 0;
-      }
       for(int i = 0; i < SIZE; i++){
         set_key(i, SENTINEL);
         set_ptr(i, nullptr);
@@ -130,66 +105,100 @@ public:
       return has_mark ? "[marked]" : "[unmarked]";
     }
 
-    /// Checks if the version is valid
+    /// Checks if the version is valid (the node isn't torn)
     bool is_valid(bool ignore_lock = false) const {
-      long base = key_lines[0].version;
-      if (ignore_lock) base = base & ~LOCK_BIT;
-      for(int i = 0; i < KLINES; i++){
-        if (key_lines[i].version != base) return false;
-      }
-      for(int i = 0; i < PLINES; i++){
-        if (ptr_lines[i].version != base) return false;
-      }
-      return true;
+      return data.is_valid(ignore_lock);
     }
 
     /// Get version of the node without the lock bit
     long version() const {
-      return key_lines[0].version & ~LOCK_BIT;
+      return data.version();
     }
 
     /// unchecked increment version (also unlocks)
     void increment_version(){
-      key_lines[0].version = (key_lines[0].version & ~LOCK_BIT) + 1;
-      for(int i = 1; i < KLINES; i++) key_lines[i].version++;
-      for(int i = 0; i < PLINES; i++) ptr_lines[i].version++;
+      data.increment_version();
+    }
+
+    /// Make the modified node valid before it's written (i.e. compute its checksum)
+    void seal(){
+      data.seal();
     }
 
     K key_at(int index) const {
-      return key_lines[index / KLINE_SIZE].keys[index % KLINE_SIZE];
+      return data.key_at(index);
+    }
+
+    /// The number of keys less than key
+    int count_less(K key) const {
+      return data.count_less(key);
     }
 
     void set_key(int index, K key) {
-      key_lines[index / KLINE_SIZE].keys[index % KLINE_SIZE] = key;
+      data.set_key(index, key);
     }
 
     rdma_ptr<BNode> ptr_at(int index) const {
-      return static_cast<rdma_ptr<BNode>>(ptr_lines[index / PLINE_SIZE].ptrs[index % PLINE_SIZE]);
+      return rdma_ptr<BNode>(data.ptr_at(index));
     }
 
     void set_ptr(int index, rdma_ptr<BNode> ptr){
-      ptr_lines[index / PLINE_SIZE].ptrs[index % PLINE_SIZE] = static_cast<rdma_ptr<pline>>(ptr);
+      data.set_ptr(index, ptr.raw());
+    }
+  };
+
+  /// An insert or remove of a key appended to a leaf instead of rewriting it
+  /// A record belongs to the version of the leaf it was appended to, so rewriting the leaf with a new version drops the records it merged
+  struct delta_t {
+    /// The leaf version (32 bits), the op (8 bits, INSERT or REMOVE) and a check of the record (24 bits), so a torn record is ignored
+    uint64_t tag;
+    K key;
+    V value;
+
+    delta_t() : tag(0), key(SENTINEL), value() {}
+
+    delta_t(long version, uint64_t op, K key, V value) : key(key), value(value) {
+      uint64_t head = ((uint64_t) (uint32_t) version << 32) | (op << 24);
+      tag = head | check(head);
+    }
+
+    uint64_t op() const {
+      return (tag >> 24) & 0xFF;
+    }
+
+    /// If the record was appended to this version of the leaf (and wasn't torn)
+    bool is_valid(long version) const {
+      return is_whole() && (tag >> 32) == (uint32_t) version;
+    }
+
+    /// If the record was appended to a later version of the leaf (and wasn't torn)
+    bool is_newer(long version) const {
+      return is_whole() && (int32_t) ((uint32_t) (tag >> 32) - (uint32_t) version) > 0;
+    }
+
+  private:
+    bool is_whole() const {
+      return (op() == INSERT || op() == REMOVE) && (tag & 0xFFFFFF) == check(tag & ~(uint64_t) 0xFFFFFF);
+    }
+
+    uint64_t check(uint64_t head) const {
+      uint64_t bits = 0;
+      memcpy(&bits, &value, std::min(sizeof(V), sizeof(uint64_t)));
+      return mix13(head ^ ((uint64_t) (uint32_t) key << 8) ^ mix13(bits)) & 0xFFFFFF;
     }
   };
 
+  struct no_deltas {};
+  using delta_region = std::conditional_t<DELTAS == 0, no_deltas, std::array<delta_t, DELTAS>>;
+
   struct alignas(64) BLeaf {
   private:
-    const static int KLINES = (SIZE + KLINE_SIZE) / KLINE_SIZE;
-    const static int VLINES = (SIZE + VLINE_SIZE - HLINE_SIZE) / VLINE_SIZE;
-    kline key_lines[KLINES];
-    vline value_lines[VLINES];
-    hline last_line;
+    typename Layout::template Leaf<K, V, SIZE> data;
+    [[no_unique_address]] delta_region deltas; // after the leaf, so rewriting the leaf doesn't rewrite them
+
   public:
     BLeaf(){
-      for(int i = 0; i < KLINES; i++){
-        key_lines[i].version = 0;
-      }
-      for(int i = 0; i < VLINES; i++){
-        value_lines[i].version = 0;
-      }
-      last_line.version = 0;
-      last_line.key_low = INT_MIN; // neither INT_MIN nor INT_MAX are valid keys!
-      last_line.key_high = SENTINEL;
+      data.set_range(INT_MIN, SENTINEL); // neither INT_MIN nor INT_MAX are valid keys!
       for(int i = 0; i < SIZE; i++){
         set_key(i, SENTINEL);
         set_value(i, 0); // set just for debugging
@@ -197,90 +206,144 @@ public:
       set_next(nullptr);
     }
 
-    /// Checks if the version is valid
-    bool is_valid(bool ignore_lock = false) const {
-      long base = key_lines[0].version;
-      if (ignore_lock) base = base & ~LOCK_BIT;
-      for(int i = 1; i < KLINES; i++){
-        if (key_lines[i].version != base) return false;
+    /// The leaf without its delta records (what a consolidation writes)
+    const typename Layout::template Leaf<K, V, SIZE>& base() const {
+      return data;
+    }
+
+    /// The offset of the delta records in the leaf
+    static uint64_t deltas_offset(){
+      return offsetof(BLeaf, deltas);
+    }
+
+    /// Replace the delta records with a fresh read of them
+    void set_deltas(const delta_region& region){
+      deltas = region;
+    }
+
+    /// Apply the valid delta records to the keys and values (in the order they were appended), and drop them
+    /// Only for a local copy of the leaf. Returns the number of records, which is also the slot of the next one
+    int merge_deltas(){
+      if constexpr (DELTAS == 0) {
+        return 0;
+      } else {
+        int count = 0;
+        for(; count < DELTAS && deltas[count].is_valid(version()); count++){
+          const delta_t& d = deltas[count];
+          int i = count_less(d.key);
+          bool found = i < SIZE && key_at(i) == d.key;
+          if (d.op() == INSERT){
+            if (found){
+              set_value(i, d.value);
+              continue;
+            }
+            REMUS_ASSERT_DEBUG(key_at(SIZE - 1) == SENTINEL, "A delta record overflows the leaf");
+            for(int j = SIZE - 1; j > i; j--){
+              set_key(j, key_at(j - 1));
+              set_value(j, value_at(j - 1));
+            }
+            set_key(i, d.key);
+            set_value(i, d.value);
+          } else if (found){
+            for(int j = i + 1; j < SIZE; j++){
+              set_key(j - 1, key_at(j));
+              set_value(j - 1, value_at(j));
+            }
+            set_key(SIZE - 1, SENTINEL);
+          }
+        }
+        for(int i = 0; i < count; i++) deltas[i] = delta_t();
+        return count;
       }
-      for(int i = 0; i < VLINES; i++){
-        if (value_lines[i].version != base) return false;
+    }
+
+    /// Checks if the version is valid (the leaf isn't torn)
+    /// A consolidation reuses the slots of the records, so a read can pair the leaf before it with a record appended after it.
+    /// The leaf's own records in the reused slots are lost, so a record of a later version makes the read torn
+    bool is_valid(bool ignore_lock = false) const {
+      if (!data.is_valid(ignore_lock)) return false;
+      if constexpr (DELTAS != 0) {
+        for(int i = 0; i < DELTAS; i++){
+          if (deltas[i].is_newer(version())) return false;
+        }
       }
-      if (last_line.version != base) return false;
       return true;
     }
 
     /// Test if a key is in the range
     bool key_in_range(K key) const {
-      return last_line.key_low < key && key <= last_line.key_high;
+      return data.key_low() < key && key <= data.key_high();
     }
 
     /// Get the lower bound for the leaf (exclusive)
     K key_low() const {
-      return last_line.key_low;
+      return data.key_low();
     }
 
     /// Get the upper bound for the leaf (inclusive)
     K key_high() const {
-      return last_line.key_high;
+      return data.key_high();
     }
 
     /// Set the range of the leaf
     void set_range(K key_low, K key_high){
-      last_line.key_low = key_low;
-      last_line.key_high = key_high;
+      data.set_range(key_low, key_high);
     }
 
     /// Get version of the node without the lock bit
     long version() const {
-      return key_lines[0].version & ~LOCK_BIT;
+      return data.version();
     }
 
     /// unchecked increment version (also unlocks)
     void increment_version(){
-      key_lines[0].version = (key_lines[0].version & ~LOCK_BIT) + 1;
-      for(int i = 1; i < KLINES; i++) key_lines[i].version++;
-      for(int i = 0; i < VLINES; i++) value_lines[i].version++;
-      last_line.version++;
+      data.increment_version();
+    }
+
+    /// Make the modified leaf valid before it's written (i.e. compute its checksum)
+    void seal(){
+      data.seal();
     }
 
     /// Unsafe function, is not coherent with RDMA... can be used before the bleaf is linked!
     void lock(){
-      key_lines[0].version = (key_lines[0].version | LOCK_BIT);
+      data.lock();
     }
 
     /// Local write to unlock the node
     void unlock(){
-      key_lines[0].version = (key_lines[0].version & ~LOCK_BIT);
+      data.unlock();
     }
 
     /// Get the next ptr for traversal
     const rdma_ptr<BLeaf> get_next() const {
-      return static_cast<rdma_ptr<BLeaf>>(last_line.next);
+      return rdma_ptr<BLeaf>(data.next());
     }
 
     /// Set the next ptr
     void set_next(rdma_ptr<BLeaf> next_leaf){
-      last_line.next = static_cast<rdma_ptr<hline>>(next_leaf);
+      data.set_next(next_leaf.raw());
     }
 
     K key_at(int index) const {
-      return key_lines[index / KLINE_SIZE].keys[index % KLINE_SIZE];
+      return data.key_at(index);
+    }
+
+    /// The number of keys less than key
+    int count_less(K key) const {
+      return data.count_less(key);
     }
 
     void set_key(int index, K key) {
-      key_lines[index / KLINE_SIZE].keys[index % KLINE_SIZE] = key;
+      data.set_key(index, key);
     }
 
     V value_at(int index) const {
-      if ((index / VLINE_SIZE) >= VLINES) return last_line.values[index % VLINE_SIZE];
-      else return value_lines[index / VLINE_SIZE].values[index % VLINE_SIZE];
+      return data.value_at(index);
     }
 
     void set_value(int index, V value) {
-      if ((index / VLINE_SIZE) >= VLINES) last_line.values[index % VLINE_SIZE] = value;
-      else value_lines[index / VLINE_SIZE].values[index % VLINE_SIZE] = value;
+      data.set_value(index, value);
     }
   };
 
@@ -292,6 +355,7 @@ private:
   using EBRNode = EBRObjectPoolAccompany<BNode, BLeaf, 100, capability>;
   using depth_t = CacheDepth::CacheDepth;
   using Cache = RemoteCacheImpl<capability>;
+  using Locks = LockTable<capability>;
   
   Peer self_;
   depth_t cache_depth_;
@@ -299,6 +363,8 @@ private:
   Cache* cache;
   EBRLeaf* ebr_leaf;
   EBRNode* ebr_node;
+  /// The table of the node locks (nullptr to lock the nodes in their version words)
+  Locks* locks;
 
   template <typename T> inline bool is_local(rdma_ptr<T> ptr) {
     return ptr.id() == self_.id;
@@ -312,22 +378,108 @@ private:
   rdma_ptr<BLeaf> prealloc_leaf_r1;
   rdma_ptr<BLeaf> prealloc_leaf_r2;
   rdma_ptr<BLeaf> prealloc_leaf_w;
+  rdma_ptr<delta_region> prealloc_deltas; // nullptr without delta records
 
   /// returns true if we can acquire the version of the node
   template <class ptr_t>
   bool try_acquire(capability* pool, rdma_ptr<ptr_t> node, long version){
+    if (locks != nullptr){
+      // lock the node's slot, then check the node is unlocked and didn't change since we read it
+      rdma_ptr<uint64_t> word = static_cast<rdma_ptr<uint64_t>>(unmark_ptr(node));
+      if (!locks->lock(pool, word)) return false;
+      if (*pool->template Read<uint64_t>(word, temp_lock) == (version & ~LOCK_BIT)) return true;
+      locks->unlock(pool, word, temp_lock);
+      return false;
+    }
     // swap the first 8 bytes (the lock) from unlocked to locked
     uint64_t v = pool->template CompareAndSwap<uint64_t>(static_cast<rdma_ptr<uint64_t>>(unmark_ptr(node)), version & ~LOCK_BIT, version | LOCK_BIT);
     if (v == (version & ~LOCK_BIT)) return true; // I think the lock bit will never be set in this scenario since we'd detect a broken read primarily
     return false;
   }
 
+  /// Release a lock without modifying the node
   template <class ptr_t>
   void release(capability* pool, rdma_ptr<ptr_t> node, long version){
+    if (locks != nullptr){
+      locks->unlock(pool, static_cast<rdma_ptr<uint64_t>>(unmark_ptr(node)), temp_lock);
+      return;
+    }
+    release_in_node(pool, node, version);
+  }
+
+  /// Release the lock bit in the node by writing back its version (i.e. a new neighbor that was written locked)
+  template <class ptr_t>
+  void release_in_node(capability* pool, rdma_ptr<ptr_t> node, long version){
     pool->template Write<uint64_t>(static_cast<rdma_ptr<uint64_t>>(unmark_ptr(node)), version, temp_lock, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
     cache->template Invalidate<ptr_t>(node);
   }
 
+  /// Seal a modified node for its layout and write it through the cache
+  template <class ptr_t>
+  inline void write_node(rdma_ptr<ptr_t> node, ptr_t& obj, rdma_ptr<ptr_t> prealloc, internal::RDMAWriteBehavior behavior = internal::RDMAWriteBehavior::RDMAWriteWithAck){
+    obj.seal();
+    cache->template Write<ptr_t>(node, obj, prealloc, behavior);
+  }
+
+  /// Rewrite a leaf that is already linked. With delta records, only the leaf before them is written (with a new version that drops the records it merged).
+  /// The next record reuses the first slot, so a torn read can pair the old leaf with the new records, which BLeaf::is_valid rejects (see reliable_read)
+  inline void write_leaf(bleaf_ptr node, BLeaf& obj, internal::RDMAWriteBehavior behavior = internal::RDMAWriteBehavior::RDMAWriteWithAck){
+    if constexpr (DELTAS == 0) {
+      write_node<BLeaf>(node, obj, prealloc_leaf_w, behavior);
+    } else {
+      using leaf_base_t = typename Layout::template Leaf<K, V, SIZE>;
+      obj.seal();
+      cache->template Write<leaf_base_t>(static_cast<rdma_ptr<leaf_base_t>>(node), obj.base(), static_cast<rdma_ptr<leaf_base_t>>(prealloc_leaf_w), behavior);
+    }
+  }
+
+  /// Merge the delta records of a leaf we read (leaves are never cached, so the object is our own copy)
+  inline void merge_deltas(CachedObject<BLeaf>& leaf){
+    if constexpr (DELTAS != 0) {
+      REMUS_ASSERT_DEBUG(!is_marked(leaf.remote_origin()), "Leaves are never cached");
+      ((BLeaf*) leaf.get())->merge_deltas();
+    }
+  }
+
+  /// After locking a leaf, read the delta records appended since we read it (appending doesn't change the version we locked) and merge them
+  /// Returns the number of records, which is also the slot of the next one
+  int refresh_deltas(capability* pool, CachedObject<BLeaf>& leaf){
+    if constexpr (DELTAS == 0) {
+      return 0;
+    } else {
+      bleaf_ptr origin = unmark_ptr(leaf.remote_origin());
+      rdma_ptr<delta_region> region = rdma_ptr<delta_region>(origin.id(), origin.address() + BLeaf::deltas_offset());
+      BLeaf* local = (BLeaf*) leaf.get();
+      local->set_deltas(*pool->template Read<delta_region>(region, prealloc_deltas));
+      return local->merge_deltas();
+    }
+  }
+
+  /// Instead of rewriting a leaf we locked, append the insert or remove of key as a delta record in slot, then unlock the leaf
+  /// @param leaf the leaf we locked (with its records merged)
+  /// @param updated the leaf after the effect
+  void append_delta(capability* pool, CachedObject<BLeaf>& leaf, const BLeaf& updated, K key, int slot){
+    if constexpr (DELTAS != 0) {
+      int before = search_node<BLeaf>(leaf, key);
+      int after = search_node<BLeaf>(&updated, key);
+      bool had = before != -1 && leaf->key_at(before) == key;
+      bool has = after != -1 && updated.key_at(after) == key;
+      if (had != has){
+        delta_t record = has ? delta_t(leaf->version(), INSERT, key, updated.value_at(after)) : delta_t(leaf->version(), REMOVE, key, V());
+        bleaf_ptr origin = unmark_ptr(leaf.remote_origin());
+        rdma_ptr<delta_t> dest = rdma_ptr<delta_t>(origin.id(), origin.address() + BLeaf::deltas_offset() + slot * sizeof(delta_t));
+        pool->template Write<delta_t>(dest, record, static_cast<rdma_ptr<delta_t>>(prealloc_leaf_w), internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
+      }
+      release<BLeaf>(pool, leaf.remote_origin(), leaf->version());
+    }
+  }
+
+  /// Release the lock of a node we wrote with an incremented version (which already released a lock in the node)
+  template <class ptr_t>
+  inline void release_written(capability* pool, rdma_ptr<ptr_t> node){
+    if (locks != nullptr) locks->unlock(pool, static_cast<rdma_ptr<uint64_t>>(unmark_ptr(node)), temp_lock);
+  }
+
   enum ReadBehavior {
     IGNORE_LOCK = 0,
     LOOK_FOR_SPLIT_MERGE = 1,
@@ -361,19 +513,8 @@ private:
   template <class SRC>
   int search_node(const SRC* origin, K key) {
     if (key > origin->key_at(SIZE - 1)) return -1;
-    int low = 0;
-    int high = SIZE - 1;
-    int mid;
-    while(low != high){
-      mid = (low + high) / 2;
-      if (key == origin->key_at(mid))
-        return mid;
-      else if (key < origin->key_at(mid))
-        high = mid;
-      else
-        low = mid + 1;
-    }
-    return low; // low = mid = high (but mid hasn't been updated)
+    // the keys are sorted, so the first index where key <= key_at(index) is the number of keys less than key
+    return origin->count_less(key);
     /* reference for equivalence
     for(int i = 0; i < SIZE; i++) if (key <= origin->key_at(i)) return i;
     */
@@ -470,12 +611,13 @@ private:
       to_parent = split_keys<BNode*, bnode_ptr>(&node, new_neighbor, true);
       split_ptrs(&node, (BNode*) new_neighbor);
       new_neighbor->cond_unmark(cache_depth_ <= CacheDepth::UpToLayer1);
+      new_neighbor->seal();
     } else {
       BNode new_neighbor_local = BNode();
       to_parent = split_keys<BNode*, BNode*>(&node, &new_neighbor_local, true);
       split_ptrs(&node, &new_neighbor_local);
       new_neighbor_local.cond_unmark(cache_depth_ <= CacheDepth::UpToLayer1);
-      cache->template Write<BNode>(new_neighbor, new_neighbor_local, prealloc_node_w);
+      write_node<BNode>(new_neighbor, new_neighbor_local, prealloc_node_w);
     }
 
     if (pool->template is_local(new_parent)){
@@ -484,20 +626,23 @@ private:
       new_parent->set_ptr(0, node_p.remote_origin());
       new_parent->set_ptr(1, cond_mark_ptr(is_marked(node_p.remote_origin()), new_neighbor));
       new_parent->cond_unmark(cache_depth_ <= CacheDepth::RootOnly);
+      new_parent->seal();
     } else {
       BNode new_parent_local = BNode();
       new_parent_local.set_key(0, to_parent);
       new_parent_local.set_ptr(0, node_p.remote_origin());
       new_parent_local.set_ptr(1, cond_mark_ptr(is_marked(node_p.remote_origin()), new_neighbor));
       new_parent_local.cond_unmark(cache_depth_ <= CacheDepth::RootOnly);
-      cache->template Write<BNode>(new_parent, new_parent_local, prealloc_node_w);
+      write_node<BNode>(new_parent, new_parent_local, prealloc_node_w);
     }
 
     parent.increment_version();
     node.increment_version(); // increment version before writing
     node.cond_unmark(cache_depth_ <= CacheDepth::UpToLayer1);
     cache->template Write<BRoot>(parent_p.remote_origin(), parent, prealloc_root_w);      
-    cache->template Write<BNode>(node_p.remote_origin(), node, prealloc_node_w);
+    write_node<BNode>(node_p.remote_origin(), node, prealloc_node_w);
+    release_written(pool, parent_p.remote_origin());
+    release_written(pool, node_p.remote_origin());
   }
 
   /// Move
@@ -518,12 +663,13 @@ private:
       to_parent = split_keys<BLeaf*, bleaf_ptr>(&node, new_neighbor, false);
       split_values(&node, (BLeaf*) new_neighbor);
       new_neighbor->set_range(to_parent, key_high);
+      new_neighbor->seal();
     } else {
       BLeaf new_leaf = BLeaf();
       to_parent = split_keys<BLeaf*, BLeaf*>(&node, &new_leaf, false);
       split_values(&node, &new_leaf);
       new_leaf.set_range(to_parent, key_high);
-      cache->template Write<BLeaf>(new_neighbor, new_leaf, prealloc_leaf_w);
+      write_node<BLeaf>(new_neighbor, new_leaf, prealloc_leaf_w);
     }
     node.set_next(new_neighbor);
     node.set_range(key_low, to_parent);
@@ -533,18 +679,21 @@ private:
       new_parent->set_key(0, to_parent);
       new_parent->set_ptr(0, static_cast<bnode_ptr>(unmark_ptr(node_p.remote_origin())));
       new_parent->set_ptr(1, static_cast<bnode_ptr>(unmark_ptr(new_neighbor)));
+      new_parent->seal();
     } else {
       BNode new_parent_local = BNode();
       new_parent_local.set_key(0, to_parent);
       new_parent_local.set_ptr(0, static_cast<bnode_ptr>(unmark_ptr(node_p.remote_origin())));
       new_parent_local.set_ptr(1, static_cast<bnode_ptr>(unmark_ptr(new_neighbor)));
-      cache->template Write<BNode>(new_parent, new_parent_local, prealloc_node_w);
+      write_node<BNode>(new_parent, new_parent_local, prealloc_node_w);
     }
   
     parent.increment_version();
     node.increment_version();
     cache->template Write<BRoot>(parent_p.remote_origin(), parent, prealloc_root_w);
-    cache->template Write<BLeaf>(node_p.remote_origin(), node, prealloc_leaf_w);
+    write_leaf(node_p.remote_origin(), node);
+    release_written(pool, parent_p.remote_origin());
+    release_written(pool, node_p.remote_origin());
   }
 
   /// Not at root
@@ -560,12 +709,13 @@ private:
       to_parent = split_keys<BNode*, bnode_ptr>(&node, new_neighbor, true);
       split_ptrs(&node, (BNode*) new_neighbor);
       new_neighbor->cond_unmark(level_parent + 1 >= cache_depth_);
+      new_neighbor->seal();
     } else {
       BNode new_neighbor_local = BNode();
       to_parent = split_keys<BNode*, BNode*>(&node, &new_neighbor_local, true);
       split_ptrs(&node, &new_neighbor_local);
       new_neighbor_local.cond_unmark(level_parent + 1 >= cache_depth_);
-      cache->template Write<BNode>(new_neighbor, new_neighbor_local, prealloc_node_w);
+      write_node<BNode>(new_neighbor, new_neighbor_local, prealloc_node_w);
     }
 
     int bucket = search_node<BNode>(parent_p, to_parent);
@@ -580,8 +730,10 @@ private:
     // unmark parent and node in conjuction with splitting
     parent.cond_unmark(level_parent >= cache_depth_);
     node.cond_unmark(level_parent + 1 >= cache_depth_);
-    cache->template Write<BNode>(parent_p.remote_origin(), parent, prealloc_node_w);
-    cache->template Write<BNode>(node_p.remote_origin(), node, prealloc_node_w);
+    write_node<BNode>(parent_p.remote_origin(), parent, prealloc_node_w);
+    write_node<BNode>(node_p.remote_origin(), node, prealloc_node_w);
+    release_written(pool, parent_p.remote_origin());
+    release_written(pool, node_p.remote_origin());
   }
 
   /// At leaf. Try to split the leaf into two and move a key to the parent
@@ -601,6 +753,7 @@ private:
       new_neighbor->set_next(node.get_next());
       new_neighbor->set_range(to_parent, key_high);
       new_neighbor->lock(); // start locked
+      new_neighbor->seal();
     } else {
       BLeaf new_leaf = BLeaf();
       to_parent = split_keys<BLeaf*, BLeaf*>(&node, &new_leaf, false);
@@ -608,7 +761,7 @@ private:
       new_leaf.set_next(node.get_next());
       new_leaf.set_range(to_parent, key_high);
       new_leaf.lock(); // start locked
-      cache->template Write<BLeaf>(new_neighbor, new_leaf, prealloc_leaf_w);
+      write_node<BLeaf>(new_neighbor, new_leaf, prealloc_leaf_w);
     }
     node.set_next(new_neighbor);
     node.set_range(key_low, to_parent);
@@ -622,8 +775,8 @@ private:
     parent.increment_version();
     node.increment_version();
 
-    cache->template Write<BNode>(parent_p.remote_origin(), parent, prealloc_node_w);
-    // leave the leaf unmodified and locked for further use
+    write_node<BNode>(parent_p.remote_origin(), parent, prealloc_node_w);
+    // leave the leaf unmodified and locked for further use (and the parent's lock to the caller, since the write might be buffered)
     return node;
   }
 
@@ -674,6 +827,8 @@ private:
       leaf_one->set_key(size_one, leaf_two->key_at(i));
       leaf_one->set_value(size_one, leaf_two->value_at(i));
     }
+    // a late reader of leaf_two finds it out of range, so it moves right or retraverses
+    leaf_two->set_range(leaf_two->key_high(), leaf_two->key_high());
     shift_down(parent, bucket_one);
     return one_gone;
   }
@@ -685,268 +840,319 @@ private:
     return next_level;
   }
 
-  CachedObject<BLeaf> traverse(capability* pool, K key, bool modifiable, function<void(BLeaf*, int)> effect, int it_counter = 0){
-    REMUS_ASSERT(it_counter < 1000, "Too many retries! Infinite recursion detected?");
-  
-    // read root first
-    CachedObject<BRoot> curr_root = cache->template Read<BRoot>(root, prealloc_root_r, -1);
-    int height = curr_root->height;
-    int level = 1;
-    bnode_ptr next_level = curr_root->start;
-    REMUS_ASSERT_DEBUG(next_level != nullptr, "Accessing SENTINEL's ptr");
+  /// The last level of a traversal, from the parent curr to the leaf of key
+  /// Moves right along the leaves if a concurrent split moved the key to a neighbor the parent doesn't know about yet (B-link)
+  /// If the leaf changed before we could lock it, only the leaf is re-read
+  /// Returns an empty optional if the parent was stale and we have to retraverse
+  std::optional<CachedObject<BLeaf>> traverse_leaf(capability* pool, K key, bool modifiable, function<void(BLeaf*, int)>& effect, CachedObject<BNode>& curr, int bucket){
+    bleaf_ptr next_leaf = static_cast<bleaf_ptr>(read_level((BNode*) curr.get(), bucket));
+    bool moved_right = false;
+    while(true){
+      CachedObject<BLeaf> leaf = reliable_read<BLeaf>(next_leaf, modifiable ? WILL_NEED_ACQUIRE : IGNORE_LOCK, 1000, prealloc_leaf_r1);
+      if (!leaf->key_in_range(key)){
+        if (key > leaf->key_high() && leaf->get_next() != nullptr){
+          // the key was split off to the right
+          next_leaf = leaf->get_next();
+          moved_right = true;
+          continue;
+        }
+        // key is out of the range, we traversed wrong
+        return nullopt;
+      }
+      // not modifiable and no split needed
+      if (!modifiable){
+        merge_deltas(leaf);
+        return leaf;
+      }
 
-    if (height == 0){
-      CachedObject<BLeaf> next_leaf = reliable_read<BLeaf>(static_cast<bleaf_ptr>(next_level), modifiable ? WILL_NEED_ACQUIRE : IGNORE_LOCK, 1000, prealloc_leaf_r1);
-      if (modifiable){
-        // failed to get locks, retraverse
-        if (!try_acquire<BRoot>(pool, curr_root.remote_origin(), curr_root->version())) return traverse(pool, key, modifiable, effect);
-        if (!try_acquire<BLeaf>(pool, next_leaf.remote_origin(), next_leaf->version())) {
-          release<BRoot>(pool, curr_root.remote_origin(), curr_root->version());
-          return traverse(pool, key, modifiable, effect);
+      // lost the leaf between reading and locking it, re-read it
+      if (!try_acquire<BLeaf>(pool, leaf.remote_origin(), leaf->version())) continue;
+      int deltas = refresh_deltas(pool, leaf);
+      if (leaf->key_at(SIZE - 1) == SENTINEL && (leaf->key_at(0) != SENTINEL || curr->key_at(0) == SENTINEL)){
+        // modifiable so lock, update, write back
+        BLeaf leaf_updated = *leaf;
+        effect(&leaf_updated, search_node<BLeaf>(&leaf_updated, key));
+        if (deltas < DELTAS){
+          // append the update to the leaf instead (it's rewritten once its records are full)
+          append_delta(pool, leaf, leaf_updated, key, deltas);
+          return leaf;
         }
-        if (next_leaf->key_at(SIZE - 1) != SENTINEL){
-          split_node(pool, curr_root, next_leaf);
-          // Just restart
-          return traverse(pool, key, modifiable, effect);
+        leaf_updated.increment_version();
+        write_leaf(leaf.remote_origin(), leaf_updated, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
+        release_written(pool, leaf.remote_origin());
+        return leaf;
+      }
+      // splits and merges need the parent, which doesn't link the leaf if we moved right
+      if (moved_right || !try_acquire<BNode>(pool, curr.remote_origin(), curr->version())){
+        release<BLeaf>(pool, leaf.remote_origin(), leaf->version());
+        return nullopt;
+      }
+      if (leaf->key_at(SIZE - 1) != SENTINEL){
+        // should split
+        // combine the writes of the split with the update (the new neighbor is written locked and then again with the key)
+        cache->BeginWriteScope();
+        BLeaf leaf_updated = split_node(pool, curr, leaf); // todo: are we sure we can unlock parent before writing?
+        next_leaf = leaf_updated.get_next(); // next_leaf is readonly since we left it locked
+        bucket = search_node<BLeaf>(&leaf_updated, key);
+        if (!leaf_updated.key_in_range(key)) {
+          // write and unlock the prev
+          write_leaf(leaf.remote_origin(), leaf_updated);
+          // key goes into next
+          CachedObject<BLeaf> next_leaf_local_const = reliable_read<BLeaf>(next_leaf, IGNORE_LOCK, 1000, prealloc_leaf_r2);
+          BLeaf next_leaf_local = *next_leaf_local_const;
+          effect(&next_leaf_local, search_node<BLeaf>(next_leaf_local_const, key)); // modify the next
+          next_leaf_local.increment_version();
+          write_leaf(next_leaf, next_leaf_local, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
+          cache->Commit();
+          release_written(pool, leaf.remote_origin());
+          release_written(pool, curr.remote_origin());
+          return leaf;
         } else {
-          // Acquire both locks if room to spare in leaf, then write back
-          BLeaf leaf_updated = *next_leaf;
+          // key goes into current, unlock next (after the buffered locked copy is written)
+          cache->Commit();
+          release_in_node<BLeaf>(pool, next_leaf, 0);
+          effect(&leaf_updated, bucket);
+          write_leaf(leaf.remote_origin(), leaf_updated, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
+          release_written(pool, leaf.remote_origin());
+          release_written(pool, curr.remote_origin());
+          return leaf;
+        }
+      } else if (leaf->key_at(0) == SENTINEL && curr->key_at(0) != SENTINEL){
+        // Empty node with a neighbor, try to remove it
+        int bucket_neighbor;
+        rdma_ptr<BLeaf> merge_leaf_ptr;
+        if (bucket == 0) {
+          merge_leaf_ptr = static_cast<bleaf_ptr>(read_level((BNode*) curr.get(), 1));
+          bucket_neighbor = 1;
+        } else {
+          merge_leaf_ptr = static_cast<bleaf_ptr>(read_level((BNode*) curr.get(), bucket - 1));
+          bucket_neighbor = bucket - 1;
+        }
+
+        CachedObject<BLeaf> merging_leaf;
+        bool do_merge = false;
+        for(int attempt = 0; attempt < MERGE_ATTEMPTS; attempt++){
+          // don't wait on the neighbor's lock, its holder might be waiting on ours
+          merging_leaf = reliable_read<BLeaf>(merge_leaf_ptr, IGNORE_LOCK, 1000, prealloc_leaf_r2);
+          if (merging_leaf->key_at(SIZE - 1) != SENTINEL) break; // give up because merging will cause inserts to fail!
+          if (!try_acquire(pool, merging_leaf.remote_origin(), merging_leaf->version())) continue;
+          // the records appended since we read it might have filled it
+          if (refresh_deltas(pool, merging_leaf) != 0 && merging_leaf->key_at(SIZE - 1) != SENTINEL){
+            release<BLeaf>(pool, merging_leaf.remote_origin(), merging_leaf->version());
+            break;
+          }
+          do_merge = true;
+          break;
+        }
+
+        if (!do_merge){
+          // lock, update, write back
+          BLeaf leaf_updated = *leaf;
           effect(&leaf_updated, search_node<BLeaf>(&leaf_updated, key));
           leaf_updated.increment_version();
-          release<BRoot>(pool, curr_root.remote_origin(), curr_root->version());
-          cache->template Write<BLeaf>(next_leaf.remote_origin(), leaf_updated, prealloc_leaf_w);
+          write_leaf(leaf.remote_origin(), leaf_updated, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
+          release_written(pool, leaf.remote_origin());
+          release<BNode>(pool, curr.remote_origin(), curr->version()); // release parent
+          return leaf;
         }
-      }
-
-      // Made it to the leaf
-      return next_leaf;
-    } // if statement returns
-
-    // Traverse bnode until bleaf
-    CachedObject<BNode> curr = reliable_read<BNode>(next_level, modifiable ? LOOK_FOR_SPLIT_MERGE : IGNORE_LOCK, level);
-    CachedObject<BNode> parent;
-    // if split, we updated the root and we need to retraverse
-    if (modifiable && curr->key_at(SIZE - 1) != SENTINEL){
-      if (!try_acquire<BRoot>(pool, curr_root.remote_origin(), curr_root->version())) return traverse(pool, key, modifiable, effect);
-      if (!try_acquire<BNode>(pool, curr.remote_origin(), curr->version())) {
-        release<BRoot>(pool, curr_root.remote_origin(), curr_root->version());
-        return traverse(pool, key, modifiable, effect);
-      }
-      split_node(pool, curr_root, curr);
-      return traverse(pool, key, modifiable, effect);
-    } else if (modifiable && curr->key_at(0) == SENTINEL){
-      // Current is empty, remove a level
-      if (try_acquire<BRoot>(pool, curr_root.remote_origin(), curr_root->version())){
-        if (try_acquire<BNode>(pool, curr.remote_origin(), curr->version())){
-          // Update the root
-          BRoot new_root = *curr_root;
-          new_root.height--;
-          new_root.start = curr->ptr_at(0);
-          new_root.increment_version();
-
-          cache->template Write<BRoot>(curr_root.remote_origin(), new_root, prealloc_root_w);
-          release<BNode>(pool, curr.remote_origin(), curr->version());
-
-          ebr_node->deallocate(unmark_ptr(curr.remote_origin())); // deallocate the unlinked node
+        BLeaf empty_leaf = *leaf;
+        effect(&empty_leaf, 0);
+        BLeaf merged_leaf = *merging_leaf;
+        BNode parent_of_merge = *curr;
+        if (merge_leaf(&empty_leaf, bucket, &merged_leaf, bucket_neighbor, &parent_of_merge)){
+          ebr_leaf->deallocate(unmark_ptr(leaf.remote_origin()));
+          empty_leaf.increment_version();
+          merged_leaf.increment_version();
+          parent_of_merge.increment_version();
+          write_leaf(merging_leaf.remote_origin(), merged_leaf);
+          write_leaf(leaf.remote_origin(), empty_leaf, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
+          write_node<BNode>(curr.remote_origin(), parent_of_merge, prealloc_node_w, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
         } else {
-          release<BRoot>(pool, curr_root.remote_origin(), curr_root->version()); // continue traversing, we failed to lower a level
+          ebr_leaf->deallocate(unmark_ptr(merging_leaf.remote_origin()));
+          empty_leaf.increment_version();
+          merged_leaf.increment_version();
+          parent_of_merge.increment_version();
+          write_leaf(leaf.remote_origin(), empty_leaf);
+          write_leaf(merging_leaf.remote_origin(), merged_leaf, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
+          write_node<BNode>(curr.remote_origin(), parent_of_merge, prealloc_node_w, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
         }
+        release_written(pool, leaf.remote_origin());
+        release_written(pool, merging_leaf.remote_origin());
+        release_written(pool, curr.remote_origin());
+        return leaf;
+      } else {
+        REMUS_ASSERT(false, "Unreachable");
       }
     }
+  }
 
-    int bucket = search_node<BNode>(curr, key);
-    while(height != 1){
-      // Get the next level ptr
-      next_level = read_level((BNode*) curr.get(), bucket);
-
-      // Read it as a BNode
-      parent = std::move(curr);
-      curr = reliable_read<BNode>(next_level, modifiable ? LOOK_FOR_SPLIT_MERGE : IGNORE_LOCK, level);
-      if (modifiable && curr->key_at(SIZE - 1) != SENTINEL) {
-        if (try_acquire<BNode>(pool, parent.remote_origin(), parent->version())) {
-          if (try_acquire<BNode>(pool, curr.remote_origin(), curr->version())) {
-            // can acquire parent and current, so split
-            split_node(pool, parent, curr, level);
+  /// Find the leaf of key (and apply effect to it if modifiable)
+  /// Only restarts from the root if the path was wrong. A lock lost on the leaf is retried on the leaf
+  CachedObject<BLeaf> traverse(capability* pool, K key, bool modifiable, function<void(BLeaf*, int)> effect){
+    while(true){
+      // read root first
+      CachedObject<BRoot> curr_root = cache->template Read<BRoot>(root, prealloc_root_r, -1);
+      int height = curr_root->height;
+      int level = 1;
+      bnode_ptr next_level = curr_root->start;
+      REMUS_ASSERT_DEBUG(next_level != nullptr, "Accessing SENTINEL's ptr");
+
+      if (height == 0){
+        CachedObject<BLeaf> next_leaf = reliable_read<BLeaf>(static_cast<bleaf_ptr>(next_level), modifiable ? WILL_NEED_ACQUIRE : IGNORE_LOCK, 1000, prealloc_leaf_r1);
+        if (modifiable){
+          // failed to get locks, retraverse
+          if (!try_acquire<BRoot>(pool, curr_root.remote_origin(), curr_root->version())) continue;
+          if (!try_acquire<BLeaf>(pool, next_leaf.remote_origin(), next_leaf->version())) {
+            release<BRoot>(pool, curr_root.remote_origin(), curr_root->version());
+            continue;
+          }
+          int deltas = refresh_deltas(pool, next_leaf);
+          if (next_leaf->key_at(SIZE - 1) != SENTINEL){
+            split_node(pool, curr_root, next_leaf);
+            // Just restart
+            continue;
           } else {
-            // cannot acquire child so release parent and try again
-            release<BNode>(pool, parent.remote_origin(), parent->version());
+            // Acquire both locks if room to spare in leaf, then write back
+            BLeaf leaf_updated = *next_leaf;
+            effect(&leaf_updated, search_node<BLeaf>(&leaf_updated, key));
+            release<BRoot>(pool, curr_root.remote_origin(), curr_root->version());
+            if (deltas < DELTAS){
+              append_delta(pool, next_leaf, leaf_updated, key, deltas);
+            } else {
+              leaf_updated.increment_version();
+              write_leaf(next_leaf.remote_origin(), leaf_updated);
+              release_written(pool, next_leaf.remote_origin());
+            }
           }
+        } else {
+          merge_deltas(next_leaf);
         }
-        // re-read the parent and continue
-        curr = reliable_read<BNode>(parent.remote_origin(), modifiable ? LOOK_FOR_SPLIT_MERGE : IGNORE_LOCK, level);
-        bucket = search_node<BNode>(curr, key);
+
+        // Made it to the leaf
+        return next_leaf;
+      } // if statement returns
+
+      // Traverse bnode until bleaf
+      CachedObject<BNode> curr = reliable_read<BNode>(next_level, modifiable ? LOOK_FOR_SPLIT_MERGE : IGNORE_LOCK, level);
+      CachedObject<BNode> parent;
+      // if split, we updated the root and we need to retraverse
+      if (modifiable && curr->key_at(SIZE - 1) != SENTINEL){
+        if (!try_acquire<BRoot>(pool, curr_root.remote_origin(), curr_root->version())) continue;
+        if (!try_acquire<BNode>(pool, curr.remote_origin(), curr->version())) {
+          release<BRoot>(pool, curr_root.remote_origin(), curr_root->version());
+          continue;
+        }
+        split_node(pool, curr_root, curr);
         continue;
-      } else if (modifiable && curr->key_at(0) == SENTINEL && parent->key_at(0) != SENTINEL){
-        // Empty node with a neighbor, try to remove it
-        int bucket_neighbor;
-        rdma_ptr<BNode> merge_node_ptr;
-        if (bucket == 0) {
-          merge_node_ptr = read_level((BNode*) parent.get(), 1);
-          bucket_neighbor = 1;
-        } else {
-          merge_node_ptr = read_level((BNode*) parent.get(), bucket - 1);
-          bucket_neighbor = bucket - 1;
+      } else if (modifiable && curr->key_at(0) == SENTINEL){
+        // Current is empty, remove a level
+        if (try_acquire<BRoot>(pool, curr_root.remote_origin(), curr_root->version())){
+          if (try_acquire<BNode>(pool, curr.remote_origin(), curr->version())){
+            // Update the root
+            BRoot new_root = *curr_root;
+            new_root.height--;
+            new_root.start = curr->ptr_at(0);
+            new_root.increment_version();
+
+            cache->template Write<BRoot>(curr_root.remote_origin(), new_root, prealloc_root_w);
+            release_written(pool, curr_root.remote_origin());
+            release<BNode>(pool, curr.remote_origin(), curr->version());
+
+            ebr_node->deallocate(unmark_ptr(curr.remote_origin())); // deallocate the unlinked node
+          } else {
+            release<BRoot>(pool, curr_root.remote_origin(), curr_root->version()); // continue traversing, we failed to lower a level
+          }
         }
-        CachedObject<BNode> merging_node = reliable_read<BNode>(merge_node_ptr, WILL_NEED_ACQUIRE, level);
-        if (merging_node->key_at(SIZE - 1) == SENTINEL){ // there is room in neighbor for the ptr
+      }
+
+      int bucket = search_node<BNode>(curr, key);
+      while(height != 1){
+        // Get the next level ptr
+        next_level = read_level((BNode*) curr.get(), bucket);
+
+        // Read it as a BNode
+        parent = std::move(curr);
+        curr = reliable_read<BNode>(next_level, modifiable ? LOOK_FOR_SPLIT_MERGE : IGNORE_LOCK, level);
+        if (modifiable && curr->key_at(SIZE - 1) != SENTINEL) {
           if (try_acquire<BNode>(pool, parent.remote_origin(), parent->version())) {
             if (try_acquire<BNode>(pool, curr.remote_origin(), curr->version())) {
-              if (try_acquire<BNode>(pool, merging_node.remote_origin(), merging_node->version())){
-                // cannot acquire child so release parent and self and give up
-                BNode empty_node = *curr;
-                BNode merged_node = *merging_node;
-                BNode parent_of_merge = *parent;
-                if (merge_node(&empty_node, bucket, &merged_node, bucket_neighbor, &parent_of_merge)){
-                  ebr_node->deallocate(unmark_ptr(curr.remote_origin()));
-                } else {
-                  ebr_node->deallocate(unmark_ptr(merging_node.remote_origin())); 
-                }
-                empty_node.increment_version();
-                merged_node.increment_version();
-                parent_of_merge.increment_version();
-                cache->template Write<BNode>(curr.remote_origin(), empty_node, prealloc_node_w);
-                cache->template Write<BNode>(merging_node.remote_origin(), merged_node, prealloc_node_w);
-                cache->template Write<BNode>(parent.remote_origin(), parent_of_merge, prealloc_node_w);
-                // re-read the parent and continue
-                curr = reliable_read<BNode>(parent.remote_origin(), LOOK_FOR_SPLIT_MERGE, level);
-                bucket = search_node<BNode>(curr, key);
-                continue;
-              } else {
-                // cannot acquire child so release parent and self and give up
-                release<BNode>(pool, parent.remote_origin(), parent->version());
-                release<BNode>(pool, curr.remote_origin(), curr->version());
-              }
+              // can acquire parent and current, so split
+              split_node(pool, parent, curr, level);
             } else {
               // cannot acquire child so release parent and try again
               release<BNode>(pool, parent.remote_origin(), parent->version());
             }
           }
-        }
-        // give-up b/c failed somewhere
-      }
-      bucket = search_node<BNode>(curr, key);
-      height--;
-      level++;
-    }
-
-    // Get the next level ptr
-    next_level = read_level((BNode*) curr.get(), bucket);
-    bleaf_ptr next_leaf = static_cast<bleaf_ptr>(next_level);
-    CachedObject<BLeaf> leaf = reliable_read<BLeaf>(next_leaf, modifiable ? WILL_NEED_ACQUIRE : IGNORE_LOCK, 1000, prealloc_leaf_r1);
-    if (!leaf->key_in_range(key)){
-      // key is out of the range, we traversed wrong
-      return traverse(pool, key, modifiable, effect, it_counter + 1);
-    }
-
-    // Handle updates to the leaf
-    if (modifiable){
-      // acquire parent and current leaf
-      if (try_acquire<BLeaf>(pool, leaf.remote_origin(), leaf->version())){
-        if (leaf->key_at(SIZE - 1) == SENTINEL && (leaf->key_at(0) != SENTINEL || curr->key_at(0) == SENTINEL)){
-          // modifiable so lock, update, write back
-          BLeaf leaf_updated = *leaf;
-          effect(&leaf_updated, search_node<BLeaf>(&leaf_updated, key));
-          leaf_updated.increment_version();
-          cache->template Write<BLeaf>(leaf.remote_origin(), leaf_updated, prealloc_leaf_w, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
-          return leaf;
-        } else {
-          if (try_acquire<BNode>(pool, curr.remote_origin(), curr->version())){
-            if (leaf->key_at(SIZE - 1) != SENTINEL){
-              // should split
-              BLeaf leaf_updated = split_node(pool, curr, leaf); // todo: are we sure we can unlock parent before writing?
-              next_leaf = leaf_updated.get_next(); // next_leaf is readonly since we left it locked
-              bucket = search_node<BLeaf>(&leaf_updated, key);
-              if (!leaf_updated.key_in_range(key)) {
-                // write and unlock the prev
-                cache->template Write<BLeaf>(leaf.remote_origin(), leaf_updated, prealloc_leaf_w);
-                // key goes into next
-                CachedObject<BLeaf> next_leaf_local_const = reliable_read<BLeaf>(next_leaf, IGNORE_LOCK, 1000, prealloc_leaf_r2);
-                BLeaf next_leaf_local = *next_leaf_local_const;
-                effect(&next_leaf_local, search_node<BLeaf>(next_leaf_local_const, key)); // modify the next
-                next_leaf_local.increment_version();
-                cache->template Write<BLeaf>(next_leaf, next_leaf_local, prealloc_leaf_w, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
-                return leaf;
-              } else {
-                // key goes into current, unlock next
-                release<BLeaf>(pool, next_leaf, 0);
-                effect(&leaf_updated, bucket);
-                cache->template Write<BLeaf>(leaf.remote_origin(), leaf_updated, prealloc_leaf_w, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
-                return leaf;
-              }
-            } else if (leaf->key_at(0) == SENTINEL && curr->key_at(0) != SENTINEL){
-              // Empty node with a neighbor, try to remove it
-              int bucket_neighbor;
-              rdma_ptr<BLeaf> merge_leaf_ptr;
-              if (bucket == 0) {
-                merge_leaf_ptr = static_cast<bleaf_ptr>(read_level((BNode*) curr.get(), 1));
-                bucket_neighbor = 1;
-              } else {
-                merge_leaf_ptr = static_cast<bleaf_ptr>(read_level((BNode*) curr.get(), bucket - 1));
-                bucket_neighbor = bucket - 1;
-              }
-
-              CachedObject<BLeaf> merging_leaf;
-              bool do_merge = true;
-              while(true){ // aggressively acquire the node since we only compete with simple insert/remove
-                merging_leaf = reliable_read<BLeaf>(merge_leaf_ptr, WILL_NEED_ACQUIRE, 1000, prealloc_leaf_r2);
-                if (merging_leaf->key_at(SIZE - 1) != SENTINEL) {
-                  do_merge = false; // give up because merging will cause inserts to fail!
-                  break;
+          // re-read the parent and continue
+          curr = reliable_read<BNode>(parent.remote_origin(), modifiable ? LOOK_FOR_SPLIT_MERGE : IGNORE_LOCK, level);
+          bucket = search_node<BNode>(curr, key);
+          continue;
+        } else if (modifiable && curr->key_at(0) == SENTINEL && parent->key_at(0) != SENTINEL){
+          // Empty node with a neighbor, try to remove it
+          int bucket_neighbor;
+          rdma_ptr<BNode> merge_node_ptr;
+          if (bucket == 0) {
+            merge_node_ptr = read_level((BNode*) parent.get(), 1);
+            bucket_neighbor = 1;
+          } else {
+            merge_node_ptr = read_level((BNode*) parent.get(), bucket - 1);
+            bucket_neighbor = bucket - 1;
+          }
+          CachedObject<BNode> merging_node = reliable_read<BNode>(merge_node_ptr, WILL_NEED_ACQUIRE, level);
+          if (merging_node->key_at(SIZE - 1) == SENTINEL){ // there is room in neighbor for the ptr
+            if (try_acquire<BNode>(pool, parent.remote_origin(), parent->version())) {
+              if (try_acquire<BNode>(pool, curr.remote_origin(), curr->version())) {
+                if (try_acquire<BNode>(pool, merging_node.remote_origin(), merging_node->version())){
+                  // cannot acquire child so release parent and self and give up
+                  BNode empty_node = *curr;
+                  BNode merged_node = *merging_node;
+                  BNode parent_of_merge = *parent;
+                  if (merge_node(&empty_node, bucket, &merged_node, bucket_neighbor, &parent_of_merge)){
+                    ebr_node->deallocate(unmark_ptr(curr.remote_origin()));
+                  } else {
+                    ebr_node->deallocate(unmark_ptr(merging_node.remote_origin())); 
+                  }
+                  empty_node.increment_version();
+                  merged_node.increment_version();
+                  parent_of_merge.increment_version();
+                  write_node<BNode>(curr.remote_origin(), empty_node, prealloc_node_w);
+                  write_node<BNode>(merging_node.remote_origin(), merged_node, prealloc_node_w);
+                  write_node<BNode>(parent.remote_origin(), parent_of_merge, prealloc_node_w);
+                  release_written(pool, curr.remote_origin());
+                  release_written(pool, merging_node.remote_origin());
+                  release_written(pool, parent.remote_origin());
+                  // re-read the parent and continue
+                  curr = reliable_read<BNode>(parent.remote_origin(), LOOK_FOR_SPLIT_MERGE, level);
+                  bucket = search_node<BNode>(curr, key);
+                  continue;
+                } else {
+                  // cannot acquire child so release parent and self and give up
+                  release<BNode>(pool, parent.remote_origin(), parent->version());
+                  release<BNode>(pool, curr.remote_origin(), curr->version());
                 }
-                // ? if we add linearizable range queries, we prob need to re-traverse instead to prevent deadlock!
-                if (try_acquire(pool, merging_leaf.remote_origin(), merging_leaf->version())) break;
-              }
-
-              if (!do_merge){
-                // lock, update, write back
-                BLeaf leaf_updated = *leaf;
-                effect(&leaf_updated, search_node<BLeaf>(&leaf_updated, key));
-                leaf_updated.increment_version();
-                cache->template Write<BLeaf>(leaf.remote_origin(), leaf_updated, prealloc_leaf_w, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
-                release<BNode>(pool, curr.remote_origin(), curr->version()); // release parent
-                return leaf;
-              }
-              BLeaf empty_leaf = *leaf;
-              effect(&empty_leaf, 0);
-              BLeaf merged_leaf = *merging_leaf;
-              BNode parent_of_merge = *curr;
-              if (merge_leaf(&empty_leaf, bucket, &merged_leaf, bucket_neighbor, &parent_of_merge)){
-                ebr_leaf->deallocate(unmark_ptr(leaf.remote_origin()));
-                empty_leaf.increment_version();
-                merged_leaf.increment_version();
-                parent_of_merge.increment_version();
-                cache->template Write<BLeaf>(merging_leaf.remote_origin(), merged_leaf, prealloc_leaf_w);
-                cache->template Write<BLeaf>(leaf.remote_origin(), empty_leaf, prealloc_leaf_w, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
-                cache->template Write<BNode>(curr.remote_origin(), parent_of_merge, prealloc_node_w, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
               } else {
-                ebr_leaf->deallocate(unmark_ptr(merging_leaf.remote_origin()));
-                empty_leaf.increment_version();
-                merged_leaf.increment_version();
-                parent_of_merge.increment_version();
-                cache->template Write<BLeaf>(leaf.remote_origin(), empty_leaf, prealloc_leaf_w);
-                cache->template Write<BLeaf>(merging_leaf.remote_origin(), merged_leaf, prealloc_leaf_w, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
-                cache->template Write<BNode>(curr.remote_origin(), parent_of_merge, prealloc_node_w, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
+                // cannot acquire child so release parent and try again
+                release<BNode>(pool, parent.remote_origin(), parent->version());
               }
-              return leaf;
-            } else {
-              REMUS_ASSERT(false, "Unreachable");
             }
-          } else {
-            // failed to acquire leaf, release
-            release<BLeaf>(pool, leaf.remote_origin(), leaf->version());
           }
+          // give-up b/c failed somewhere
         }
-      } // else nothing was acquired, try again
-    } else {
-      // not modifiable and no split needed
-      return leaf;
+        bucket = search_node<BNode>(curr, key);
+        height--;
+        level++;
+      }
+
+      std::optional<CachedObject<BLeaf>> leaf = traverse_leaf(pool, key, modifiable, effect, curr, bucket);
+      if (leaf.has_value()) return std::move(leaf.value());
+      // the parent was stale, retraverse
     }
-    return traverse(pool, key, modifiable, effect, it_counter + 1); // retry by retraversing
   }
 
 public:
-  RdmaBPTree(Peer& self, depth_t depth, Cache* cache, capability* pool, EBRLeaf* leaf, EBRNode* node, bool print_info = false) 
-  : self_(std::move(self)), cache_depth_(depth), cache(cache), ebr_leaf(leaf), ebr_node(node) {
+  /// @param locks a lock table shared by the node's threads, so locking a node doesn't invalidate it in every cache (nullptr to lock the nodes in their version words)
+  RdmaBPTree(Peer& self, depth_t depth, Cache* cache, capability* pool, EBRLeaf* leaf, EBRNode* node, bool print_info = false, Locks* locks = nullptr) 
+  : self_(std::move(self)), cache_depth_(depth), cache(cache), ebr_leaf(leaf), ebr_node(node), locks(locks) {
     if (print_info){
       REMUS_INFO("Sentinel = {}", SENTINEL);
       REMUS_INFO("Struct Memory (BNode): {} % 64 = {}", sizeof(BNode), sizeof(BNode) % 64);
@@ -960,6 +1166,7 @@ public:
     prealloc_leaf_r1 = pool->template Allocate<BLeaf>();
     prealloc_leaf_r2 = pool->template Allocate<BLeaf>();
     prealloc_leaf_w = pool->template Allocate<BLeaf>();
+    if constexpr (DELTAS != 0) prealloc_deltas = pool->template Allocate<delta_region>();
   };
 
   /// Free all the resources associated with the IHT
@@ -971,6 +1178,7 @@ public:
     pool->template Deallocate<BLeaf>(prealloc_leaf_r1);
     pool->template Deallocate<BLeaf>(prealloc_leaf_r2);
     pool->template Deallocate<BLeaf>(prealloc_leaf_w);
+    if constexpr (DELTAS != 0) pool->template Deallocate<delta_region>(prealloc_deltas);
 
     if (pool->template is_local(root)){
       BRoot tmp_root = *root;
@@ -992,14 +1200,99 @@ public:
     this->root = broot;
     bleaf_ptr bleaf = pool->template Allocate<BLeaf>();
     *bleaf = BLeaf();
+    bleaf->seal();
     this->root->start = static_cast<bnode_ptr>(bleaf);
     if (cache_depth_ >= CacheDepth::RootOnly)
         this->root = mark_ptr(this->root);
     return static_cast<rdma_ptr<anon_ptr>>(this->root);
   }
 
+  /// @brief Create a btree holding the pairs (i.e. to populate it before a benchmark)
+  /// Instead of inserting the pairs one at a time, the leaves are packed from the sorted pairs and the bnodes are built over them bottom-up by this thread.
+  /// The root is returned once the tree is complete. The pairs can be in any order. If a key repeats, its first pair is used
+  /// @param pool the capability to init the btree with
+  /// @param pairs the pairs to load
+  /// @param fill how full to pack the nodes, leaving room for inserts before the first splits
+  /// @return the btree root pointer
+  rdma_ptr<anon_ptr> InitFromBulk(capability* pool, std::vector<std::pair<K, V>> pairs, double fill = 0.75){
+    REMUS_ASSERT(56 % sizeof(V) == 0, "V must be a multiple of 2,4,8,14,28,56");
+    REMUS_ASSERT(fill > 0 && fill <= 1, "The fill factor must be in (0, 1]");
+    std::stable_sort(pairs.begin(), pairs.end(), [](const auto& a, const auto& b){ return a.first < b.first; });
+    std::vector<std::pair<K, V>> unique;
+    unique.reserve(pairs.size());
+    for (size_t i = 0; i < pairs.size(); i++) {
+      if (i == 0 || pairs[i].first != pairs[i - 1].first) unique.push_back(pairs[i]);
+    }
+    if (unique.empty()) return InitAsFirst(pool);
+
+    // a bnode needs at least two children after spreading them evenly (or traverse would see an empty bnode)
+    int per_leaf = std::clamp((int) (fill * SIZE), 1, (int) SIZE);
+    int per_node = std::clamp((int) (fill * (SIZE + 1)), 3, SIZE + 1);
+    int leaf_count = (unique.size() + per_leaf - 1) / per_leaf;
+    int height = 0;
+    for(int count = leaf_count; count > 1; count = (count + per_node - 1) / per_node) height++;
+
+    // Pack the leaves and link them. A leaf's range ends at its last key
+    std::vector<bnode_ptr> children;
+    std::vector<K> highs; // the highest key under each child
+    bleaf_ptr prev = nullptr;
+    K key_low = INT_MIN;
+    for(size_t i = 0; i < unique.size(); i += per_leaf){
+      size_t n = std::min((size_t) per_leaf, unique.size() - i);
+      bleaf_ptr leaf = pool->template Allocate<BLeaf>();
+      *leaf = BLeaf();
+      for(size_t j = 0; j < n; j++){
+        leaf->set_key(j, unique[i + j].first);
+        leaf->set_value(j, unique[i + j].second);
+      }
+      K key_high = i + n == unique.size() ? SENTINEL : unique[i + n - 1].first;
+      leaf->set_range(key_low, key_high);
+      if (prev != nullptr) prev->set_next(leaf);
+      children.push_back(static_cast<bnode_ptr>(leaf));
+      highs.push_back(key_high);
+      key_low = key_high;
+      prev = leaf;
+    }
+    // seal the leaves once they are linked
+    for(bnode_ptr leaf : children) static_cast<bleaf_ptr>(leaf)->seal();
+
+    // Build the bnodes one level at a time, spreading the children evenly. Levels are counted from the root (1) as in traverse
+    for(int level = height; level >= 1; level--){
+      // the pointers to bnodes are marked if they are cached (the pointers to leaves never are)
+      bool mark_children = level != height && level + 1 <= cache_depth_;
+      int node_count = (children.size() + per_node - 1) / per_node;
+      std::vector<bnode_ptr> nodes;
+      std::vector<K> node_highs;
+      size_t c = 0;
+      for(int i = 0; i < node_count; i++){
+        int n = children.size() / node_count + (i < children.size() % node_count ? 1 : 0);
+        bnode_ptr node = pool->template Allocate<BNode>();
+        *node = BNode();
+        for(int j = 0; j < n; j++){
+          node->set_ptr(j, cond_mark_ptr(mark_children, children[c + j]));
+          if (j != n - 1) node->set_key(j, highs[c + j]);
+        }
+        node->seal();
+        nodes.push_back(node);
+        node_highs.push_back(highs[c + n - 1]);
+        c += n;
+      }
+      children = std::move(nodes);
+      highs = std::move(node_highs);
+    }
+
+    rdma_ptr<BRoot> broot = pool->template Allocate<BRoot>();
+    broot->height = height;
+    broot->lock = 0;
+    broot->start = cond_mark_ptr(height != 0 && cache_depth_ >= CacheDepth::RootOnly, children[0]);
+    this->root = broot;
+    if (cache_depth_ >= CacheDepth::RootOnly)
+        this->root = mark_ptr(this->root);
+    return static_cast<rdma_ptr<anon_ptr>>(broot);
+  }
+
   /// @brief Initialize an IHT from the pointer of another IHT
-  /// @param root_ptr the root pointer of the other iht from InitAsFirst();
+  /// @param root_ptr the root pointer of the other iht from InitAsFirst() or InitFromBulk();
   void InitFromPointer(rdma_ptr<anon_ptr> root_ptr){
       if (cache_depth_ >= CacheDepth::RootOnly)
         root_ptr = mark_ptr(root_ptr);
@@ -1065,6 +1358,44 @@ public:
     return prev_value;
   }
 
+  /// @brief Visit the keys in [lo, hi] in order. Descends once and then follows the leaves to the right
+  /// Each leaf is read whole (a torn read is re-read). Like count, it isn't linearizable with concurrent updates
+  /// @param pool the capability providing one-sided RDMA
+  /// @param lo the lowest key to visit
+  /// @param hi the highest key to visit
+  /// @param visit called with each key and value
+  /// @return the number of keys visited
+  int scan(capability* pool, K lo, K hi, function<void(K, V)> visit) {
+    int visited = 0;
+    K from = lo; // the lowest key we haven't covered yet
+    CachedObject<BLeaf> leaf = traverse(pool, from, false, function([=](BLeaf*, int){}));
+    while(true){
+      int bucket = search_node<BLeaf>(leaf, from);
+      for(int i = bucket; i != -1 && i < SIZE && leaf->key_at(i) != SENTINEL && leaf->key_at(i) <= hi; i++){
+        visit(leaf->key_at(i), leaf->value_at(i));
+        visited++;
+      }
+      if (leaf->key_high() >= hi || leaf->get_next() == nullptr) break;
+      from = leaf->key_high() + 1;
+      leaf = reliable_read<BLeaf>(leaf->get_next(), IGNORE_LOCK, 1000, prealloc_leaf_r2);
+      merge_deltas(leaf);
+      // the next leaf was merged away or a concurrent merge moved from behind us, find its leaf again
+      if (!leaf->key_in_range(from)) leaf = traverse(pool, from, false, function([=](BLeaf*, int){}));
+    }
+    ebr_leaf->match_version(pool);
+    return visited;
+  }
+
+  /// @brief The keys and values in [lo, hi] in order
+  /// @param pool the capability providing one-sided RDMA
+  /// @param lo the lowest key
+  /// @param hi the highest key
+  std::vector<std::pair<K, V>> scan(capability* pool, K lo, K hi) {
+    std::vector<std::pair<K, V>> pairs;
+    scan(pool, lo, hi, function([&](K key, V value){ pairs.push_back({key, value}); }));
+    return pairs;
+  }
+
   /// @brief Populate only works when we have numerical keys. Will add data
   /// @param pool the capability providing one-sided RDMA
   /// @param op_count the number of values to insert. Recommended in total to do key_range / 2
@@ -1091,6 +1422,7 @@ public:
 
   void debug(bleaf_ptr node, int indent){
     BLeaf leaf = *node;
+    leaf.merge_deltas();
     for(int i = 0; i < indent; i++){
       std::cout << "\t";
     }
@@ -1196,6 +1528,7 @@ public:
   string is_valid(int height, bnode_ptr node, K lower, K upper){
     if (height == 0){
       BLeaf l = *static_cast<bleaf_ptr>(node);
+      l.merge_deltas();
       if (l.get_next() != nullptr && l.key_high() != l.get_next()->key_low()) return "Key high is not next key low";
       if (l.get_next() == nullptr && l.key_high() != SENTINEL) return "Key high is not SENTINEL";
       for(int i = 0; i < SIZE; i++){
@@ -1253,6 +1586,7 @@ public:
       }
       if (curr->get_next() == nullptr) break;
       curr = cache->template Read<BLeaf>(curr->get_next(), nullptr, 1000);
+      merge_deltas(curr);
     }
     return count;
   }
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <remus/logging/logging.h>
+#include <dcache/cache_hash.h>
+
+/// Decides which objects (i.e. PLists) are read through the RemoteCache from their sampled access frequency, within a memory budget
+/// Only decides for objects the data structure already marks (i.e. by the cache depth, which stays the ceiling).
+/// Writers keep invalidating every marked object, so a reader can use or bypass the cache for any of them and stay coherent
+/// - rows: the sampled access count and size of an object, by its hashed address. A colliding object wears the count down before taking the row
+/// - epochs: every EPOCH samples, the counts are halved (so cold objects are demoted) and the threshold is set to admit the hottest objects that fit in the budget
+/// - charge: only a tracked object is admitted, and its size is charged to the budget until it is demoted (or loses its row), when the caller evicts its copy.
+///   So the admitted objects never exceed the budget. A read racing with a demotion can still refill its line, until a colliding object replaces it
+/// One per node, shared by its threads
+template <int ROWS = 4096, int SAMPLE_PERIOD = 16, int EPOCH = 1 << 12>
+class CacheAdmission {
+    /// Set in the address of a row once its object is admitted (objects are at least 2-byte aligned)
+    static constexpr uint64_t ADMITTED = 1;
+
+    struct alignas(16) row_t {
+        std::atomic<uint64_t> address;
+        std::atomic<uint32_t> count;
+        std::atomic<uint32_t> bytes;
+    };
+
+    uint64_t budget;
+    row_t rows[ROWS];
+    /// The minimum count to be admitted. 0 until the first epoch (every tracked object that fits is admitted)
+    std::atomic<uint32_t> threshold;
+    std::atomic<uint64_t> samples;
+    std::atomic<bool> adapting;
+    /// Orders admissions and demotions, so the charge is exact. Only taken when an object changes state, not to read it
+    std::mutex charge_lock;
+    /// The bytes of the admitted objects
+    uint64_t charged;
+
+    inline row_t& row(uint64_t address){
+        return rows[fastrange(mix13(address >> 6), ROWS)];
+    }
+
+    /// Stop charging for the object of a row (with the charge lock held)
+    template <typename Evict>
+    void demote(row_t& r, Evict&& evict){
+        uint64_t a = r.address.load(std::memory_order_relaxed);
+        if (!(a & ADMITTED)) return;
+        r.address.store(a & ~ADMITTED, std::memory_order_relaxed);
+        charged -= r.bytes.load(std::memory_order_relaxed);
+        evict(a & ~ADMITTED);
+    }
+
+    template <typename Evict>
+    void record(row_t& r, uint64_t address, uint32_t bytes, Evict&& evict){
+        if ((r.address.load(std::memory_order_relaxed) & ~ADMITTED) == address) {
+            r.count.fetch_add(1, std::memory_order_relaxed);
+        } else if (r.count.load(std::memory_order_relaxed) == 0) {
+            // take over the row. The object losing it is no longer tracked, so it can't stay admitted
+            std::lock_guard<std::mutex> guard(charge_lock);
+            if (r.count.load(std::memory_order_relaxed) == 0) {
+                demote(r, evict);
+                r.bytes.store(bytes, std::memory_order_relaxed);
+                r.count.store(1, std::memory_order_relaxed);
+                r.address.store(address, std::memory_order_relaxed);
+            }
+        } else {
+            r.count.fetch_sub(1, std::memory_order_relaxed);
+        }
+        if (samples.fetch_add(1, std::memory_order_relaxed) % EPOCH == EPOCH - 1) adapt(evict);
+    }
+
+    /// Age the counts, pick the threshold for the next epoch and demote the admitted objects under it
+    template <typename Evict>
+    void adapt(Evict&& evict){
+        if (adapting.exchange(true, std::memory_order_acquire)) return;
+        std::vector<std::pair<uint32_t, uint32_t>> tracked; // count, bytes
+        for(int i = 0; i < ROWS; i++){
+            uint32_t c = rows[i].count.load(std::memory_order_relaxed) / 2;
+            rows[i].count.store(c, std::memory_order_relaxed);
+            if (c != 0) tracked.push_back({c, rows[i].bytes.load(std::memory_order_relaxed)});
+        }
+        std::sort(tracked.begin(), tracked.end(), [](const auto& a, const auto& b){ return a.first > b.first; });
+        uint32_t t = 1;
+        uint64_t used = 0;
+        for(auto& [c, bytes] : tracked){
+            used += bytes;
+            if (used > budget) {
+                t = c + 1;
+                break;
+            }
+        }
+        threshold.store(t, std::memory_order_relaxed);
+        int demoted = 0;
+        {
+            // make room for the hotter objects
+            std::lock_guard<std::mutex> guard(charge_lock);
+            for(int i = 0; i < ROWS; i++){
+                if ((rows[i].address.load(std::memory_order_relaxed) & ADMITTED) && rows[i].count.load(std::memory_order_relaxed) < t) {
+                    demote(rows[i], evict);
+                    demoted++;
+                }
+            }
+        }
+        REMUS_DEBUG("Cache admission threshold {} ({} objects tracked, {} demoted)", t, tracked.size(), demoted);
+        adapting.store(false, std::memory_order_release);
+    }
+
+public:
+    /// @param budget how many bytes of objects to keep in the cache
+    CacheAdmission(uint64_t budget) : budget(budget), threshold(0), samples(0), adapting(false), charged(0) {
+        for(int i = 0; i < ROWS; i++){
+            rows[i].address.store(0, std::memory_order_relaxed);
+            rows[i].count.store(0, std::memory_order_relaxed);
+            rows[i].bytes.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /// Count an access to an object and decide if it is read through the cache
+    /// @param address the (unmarked) address of the object
+    /// @param bytes the size of the object
+    /// @param evict called with the address of every object that stops being admitted, to drop its copy from the cache
+    template <typename Evict>
+    bool admit(uint64_t address, uint32_t bytes, Evict&& evict){
+        thread_local uint32_t tick = 0;
+        row_t& r = row(address);
+        if (++tick % SAMPLE_PERIOD == 0) record(r, address, bytes, evict);
+        uint64_t a = r.address.load(std::memory_order_relaxed);
+        if (a == (address | ADMITTED)) return true;
+        if (a != address || r.count.load(std::memory_order_relaxed) < threshold.load(std::memory_order_relaxed)) return false;
+        // a tracked object at the threshold is admitted if it fits
+        std::lock_guard<std::mutex> guard(charge_lock);
+        if (r.address.load(std::memory_order_relaxed) != address) return r.address.load(std::memory_order_relaxed) == (address | ADMITTED);
+        uint32_t size = r.bytes.load(std::memory_order_relaxed);
+        if (charged + size > budget) return false;
+        charged += size;
+        r.address.store(address | ADMITTED, std::memory_order_relaxed);
+        return true;
+    }
+
+    uint32_t get_threshold(){
+        return threshold.load(std::memory_order_relaxed);
+    }
+
+    /// The bytes of the objects admitted (and not demoted since)
+    uint64_t get_charged(){
+        std::lock_guard<std::mutex> guard(charge_lock);
+        return charged;
+    }
+};
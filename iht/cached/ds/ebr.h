@@ -8,6 +8,7 @@
 #include <remus/rdma/rdma.h>
 #include <vector>
 #include <atomic>
+#include <mutex>
 #include <remus/rdma/peer.h>
 
 using namespace remus::rdma;
@@ -249,4 +250,74 @@ public:
 };
 
 template <class T, class K, int WAIT, class capability>
-inline thread_local LimboLists<T>* EBRObjectPoolAccompany<T, K, WAIT, capability>::limbo = nullptr;
\ No newline at end of file
+inline thread_local LimboLists<T>* EBRObjectPoolAccompany<T, K, WAIT, capability>::limbo = nullptr;
+/// Hands objects that were reclaimed by EBR back to the node that allocated them (only the owner can deallocate)
+/// Every node has an inbox of SLOTS pointers in RDMA memory. Peers claim an empty slot with a CAS and the owner drains its inbox
+template <class T, int SLOTS, class capability>
+class ReturnInbox {
+    struct alignas(64) inbox_t {
+        uint64_t slots[SLOTS];
+    };
+
+    rdma_ptr<inbox_t> my_inbox;
+    vector<rdma_ptr<inbox_t>> inboxes; // the inbox of every node (by node id)
+    std::mutex init_lock;
+
+public:
+    ReturnInbox(capability* pool) {
+        my_inbox = pool->template Allocate<inbox_t>();
+        for(int i = 0; i < SLOTS; i++) my_inbox->slots[i] = 0;
+    }
+
+    /// The address of the inbox to share with the other nodes
+    uint64_t root(){
+        return my_inbox.raw();
+    }
+
+    /// Add the inboxes of the other nodes (can be called by every thread)
+    void init(vector<uint64_t> peer_inboxes){
+        init_lock.lock();
+        for(uint64_t raw : peer_inboxes){
+            rdma_ptr<inbox_t> p = rdma_ptr<inbox_t>(raw);
+            if (p.id() >= inboxes.size()) inboxes.resize(p.id() + 1, nullptr);
+            inboxes[p.id()] = p;
+        }
+        init_lock.unlock();
+    }
+
+    /// Return obj to its owner. Returns false if the owner's inbox is full (try again later)
+    bool push(capability* pool, rdma_ptr<T> obj){
+        REMUS_ASSERT_DEBUG(obj.id() < inboxes.size() && inboxes[obj.id()] != nullptr, "No inbox for node {}", obj.id());
+        rdma_ptr<inbox_t> inbox = inboxes[obj.id()];
+        // read the inbox once to find the empty slots
+        rdma_ptr<inbox_t> local = pool->template Read<inbox_t>(inbox);
+        bool pushed = false;
+        for(int i = 0; i < SLOTS && !pushed; i++){
+            if (local->slots[i] != 0) continue;
+            rdma_ptr<uint64_t> slot = rdma_ptr<uint64_t>(inbox.id(), inbox.address() + i * sizeof(uint64_t));
+            pushed = pool->template CompareAndSwap<uint64_t>(slot, 0, obj.raw()) == 0;
+        }
+        pool->template Deallocate<inbox_t>(local);
+        return pushed;
+    }
+
+    /// Deallocate everything the other nodes returned to this node. Returns the number of objects deallocated
+    int drain(capability* pool){
+        int count = 0;
+        for(int i = 0; i < SLOTS; i++){
+            uint64_t raw = ((volatile uint64_t*) my_inbox->slots)[i];
+            if (raw == 0) continue;
+            // peers CAS the slots with RDMA atomics, so take it with one as well
+            rdma_ptr<uint64_t> slot = rdma_ptr<uint64_t>(my_inbox.id(), my_inbox.address() + i * sizeof(uint64_t));
+            if (pool->template CompareAndSwap<uint64_t>(slot, raw, 0) != raw) continue;
+            pool->template Deallocate<T>(rdma_ptr<T>(raw));
+            count++;
+        }
+        return count;
+    }
+
+    void destroy(capability* pool){
+        drain(pool);
+        pool->template Deallocate<inbox_t>(my_inbox);
+    }
+};
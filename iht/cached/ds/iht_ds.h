@@ -1,7 +1,9 @@
 #pragma once
 
+#include <atomic>
 #include <random>
 #include <remus/rdma/rdma.h>
+#include <dcache/cache_hash.h>
 
 #include "../../common.h"
 #include <cassert>
@@ -62,6 +64,74 @@ public:
   }
 };
 
+/// A cache of calcified PLists (every bucket is P_UNLOCKED), shared by the threads of a node
+/// A calcified PList never changes again, so a copy never has to be invalidated and entries are only added (until the cache is full)
+/// Lock-free: an open-addressed table keyed by the remote address of the PList (so it covers every depth).
+/// A slot is claimed with a CAS on its key and the copy is published with a release store of its value (null until then, a miss)
+template <class T>
+class CalcifiedCache {
+  /// How many slots are searched for an address before giving up
+  static constexpr int MAX_PROBE = 32;
+
+  struct alignas(16) slot_t {
+    std::atomic<uint64_t> key; // the raw remote pointer (0 if empty)
+    std::atomic<T*> value;     // the local copy (null until published)
+  };
+
+  slot_t* slots;
+  uint64_t capacity;
+
+  inline uint64_t home(uint64_t raw) {
+    return fastrange(mix13(raw >> 6), capacity);
+  }
+
+public:
+  CalcifiedCache(uint64_t capacity) : capacity(capacity) {
+    slots = new slot_t[capacity];
+    for (uint64_t i = 0; i < capacity; i++){
+      slots[i].key.store(0, std::memory_order_relaxed);
+      slots[i].value.store(nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  /// The copy of the PList at raw (or nullptr)
+  T* find(uint64_t raw) {
+    uint64_t i = home(raw);
+    for (int probe = 0; probe < MAX_PROBE; probe++){
+      uint64_t key = slots[i].key.load(std::memory_order_acquire);
+      if (key == raw) return slots[i].value.load(std::memory_order_acquire);
+      if (key == 0) return nullptr;
+      i = i + 1 == capacity ? 0 : i + 1;
+    }
+    return nullptr;
+  }
+
+  /// Add the copy of the PList at raw. The cache owns the copy (allocated with malloc) if it returns true
+  /// @return false if the PList is already cached (or being cached) or the cache is full around its slot
+  bool add(uint64_t raw, T* copy) {
+    uint64_t i = home(raw);
+    for (int probe = 0; probe < MAX_PROBE; probe++){
+      uint64_t key = slots[i].key.load(std::memory_order_acquire);
+      if (key == 0 && slots[i].key.compare_exchange_strong(key, raw, std::memory_order_acq_rel)){
+        slots[i].value.store(copy, std::memory_order_release);
+        return true;
+      }
+      // lost the slot to another PList, or found this one
+      if (key == raw) return false;
+      i = i + 1 == capacity ? 0 : i + 1;
+    }
+    return false;
+  }
+
+  ~CalcifiedCache() {
+    for (uint64_t i = 0; i < capacity; i++){
+      T* copy = slots[i].value.load(std::memory_order_relaxed);
+      if (copy != nullptr) free(copy);
+    }
+    delete[] slots;
+  }
+};
+
 template <class K, class V, int ELIST_SIZE, int PLIST_SIZE> class TunedRdmaIHT {
 private:
   Peer self_;
@@ -227,7 +297,7 @@ private:
     // 2) We use count-1 to ensure the bucket count is co-prime with the other plist bucket counts
     //    B/C of the property: A key maps to a suboptimal set of values when modding by 2A given "k mod A = Y" (where Y becomes the parent bucket)
     //    This happens because the hashing function maintains divisibility.
-    return prehash % (count - 1);
+    return fastrange(prehash, count - 1);
   }
 
   /// Rehash function - will add more capacity
@@ -263,17 +333,9 @@ private:
     return new_p;
   }
 
-  // Cache for three layers
-  // todo: replace for std::array?
-  // make three different depths of PList caches
-  PList** layer_pointers[3]; 
-  bool* is_cached_pointers[3];
-  PList* layer_1[1]; 
-  bool is_l1_cached[1] = {false};
-  PList* layer_2[PLIST_SIZE];
-  bool is_l2_cached[PLIST_SIZE];
-  PList* layer_3[PLIST_SIZE * PLIST_SIZE * 2];
-  bool is_l3_cached[PLIST_SIZE * PLIST_SIZE * 2];
+  // The calcified PLists (shared with the other threads of the node)
+  CalcifiedCache<PList>* plist_cache_;
+  bool owns_cache_;
   
   // preallocated memory for RDMA operations (avoiding frequent allocations)
   remote_lock temp_lock;
@@ -281,71 +343,35 @@ private:
   remote_elist temp_elist;
   // N.B. I don't bother creating preallocated PLists since we're hoping to cache them anyways :)
 
-  /// @brief Try to fetch the cached value for a remote pointer. Optimizations break this function
+  /// @brief Try to fetch the cached copy of a PList
+  /// @param ptr the remote PList
+  /// @param depth the depth of the PList (the root is depth 1). Only depths up to the cache depth are cached
   /// If it is cached, then it returns a non null
-  PList* __attribute__ ((optimize("0"))) fetch_cache(int* bucket_path) [[gnu::optimize(0)]] {
-    // Bucket path:
-    // [-1 -1 -1] -- root level (depth 1)
-    // [n -1 -1] -- depth 2
-    // [n1 n2 -1] -- depth 3
-    int sizes[3] = {1, PLIST_SIZE, 2 * PLIST_SIZE * PLIST_SIZE};
-    int bucket_of_cache = 0;
-    bool* is_cached_list;
-    PList** caches_list;
-    int count = PLIST_SIZE;
-
-    for(int i = 0; i < 8; i++){
-      // Calculate the cache list and the bucket in such list
-      is_cached_list = this->is_cached_pointers[i];
-      caches_list = this->layer_pointers[i];
-      if (i == cache_depth_) return nullptr;
-      if (bucket_path[i] == -1) break;
-      bucket_of_cache = (bucket_of_cache * sizes[i]) + bucket_path[i];
-      count *= 2;
-    }
-    if (is_cached_list[bucket_of_cache])
-      return caches_list[bucket_of_cache];
-    else 
-      return nullptr;
+  inline PList* fetch_cache(remote_plist ptr, size_t depth) {
+    if (depth > (size_t) cache_depth_) return nullptr;
+    return plist_cache_->find(ptr.raw());
   }
 
   /// @brief Check if a PList is fully calcified, if so cache it
+  /// @param ptr the remote PList
+  /// @param read the PList as read
+  /// @param depth the depth of the PList (the root is depth 1)
   /// @return if it was cached
-  bool try_cache(remote_plist root_ptr, int* bucket_path) {
-    // Bucket path:
-    // [-1 -1 -1] -- root level (depth 1)
-    // [n -1 -1] -- depth 2
-    // [n1 n2 -1] -- depth 3
-    // [n1 n2 n3] -- don't cache
-    const int sizes[3] = {1, PLIST_SIZE, 2 * PLIST_SIZE * PLIST_SIZE};
-    int bucket_of_cache = 0;
-    bool* is_cached_list;
-    PList** caches_list;
-    int count = PLIST_SIZE;
-    for(int i = 0; i < 8; i++){
-      // Calculate the cache list and the bucket in such list
-      is_cached_list = this->is_cached_pointers[i];
-      caches_list = this->layer_pointers[i];
-      if (i == cache_depth_) return false; // todo: max_depth of caching is 2
-      if (bucket_path[i] == -1) break;
-      bucket_of_cache = (bucket_of_cache * sizes[i]) + bucket_path[i];
-      count *= 2;
-    }
-    // If cached, return false
-    if (is_cached_list[bucket_of_cache]) return false;
-
-    // Check if the pointer is cache-able
-    for (int i = 0; i < count - 1; i++){
-      if (root_ptr->buckets[i].lock != P_UNLOCKED)
+  bool try_cache(remote_plist ptr, remote_plist read, size_t depth) {
+    if (depth > (size_t) cache_depth_) return false;
+    size_t count = PLIST_SIZE << (depth - 1);
+    // Check if the pointer is cache-able (level_hash never uses the last bucket)
+    for (size_t i = 0; i < count - 1; i++){
+      if (read->buckets[i].lock != P_UNLOCKED)
         return false;
     }
     // If we made it here, we have a calcified plist, and thus we save it
     PList* cached_plist = (PList*) malloc(sizeof(plist_pair_t) * count);
-    for(int i = 0; i < count; i++){
-      cached_plist->buckets[i] = root_ptr->buckets[i];
+    memcpy((void*) cached_plist, (void*) std::to_address(read), sizeof(plist_pair_t) * count);
+    if (!plist_cache_->add(ptr.raw(), cached_plist)){
+      free(cached_plist);
+      return false;
     }
-    caches_list[bucket_of_cache] = cached_plist;
-    is_cached_list[bucket_of_cache] = true;
     return true;
   }
 
@@ -374,16 +400,15 @@ private:
     ctx.depth = 1;
     ctx.count = PLIST_SIZE;
     ctx.parent_ptr = root;
-    int bucket_path[8] = { -1, -1, -1, -1, -1, -1, -1, -1 };
 
     // start at root
-    PList* cache = fetch_cache(bucket_path);
+    PList* cache = fetch_cache(root, 1);
 
     // make curr cached or not
     if (cache == nullptr){
       remote_plist root_red = pool->Read<PList>(root);
       ctx.curr = CachedPList(root_red, 0);
-      if (try_cache(root_red, bucket_path)){
+      if (try_cache(root, root_red, 1)){
         REMUS_TRACE("Cached at depth:{} key:{} (ROOT)", ctx.depth, key);
       }
     } else {
@@ -393,16 +418,15 @@ private:
 
     while (true) {
       ctx.bucket = level_hash(key, ctx.depth, ctx.count);
-      bucket_path[ctx.depth - 1] = (int) ctx.bucket;
       // Normal descent
       if (ctx.curr->buckets[ctx.bucket].lock == P_UNLOCKED){
         auto bucket_base = static_cast<remote_plist>(ctx.curr->buckets[ctx.bucket].base);
         ctx.curr.deallocate(pool);
-        PList* cache = fetch_cache(bucket_path);
+        PList* cache = fetch_cache(bucket_base, ctx.depth + 1);
         if (cache == nullptr){
           remote_plist curr_red = pool->ExtendedRead<PList>(bucket_base, 1 << ctx.depth);
           ctx.curr = CachedPList(curr_red, ctx.depth);
-          if (try_cache(curr_red, bucket_path)){
+          if (try_cache(bucket_base, curr_red, ctx.depth + 1)){
             REMUS_TRACE("Cached at depth:{} key:{} bucket:{}", ctx.depth + 1, key, ctx.bucket);
           }
         } else {
@@ -454,19 +478,13 @@ private:
   }
 
 public:
-  TunedRdmaIHT(Peer& self, CacheDepth::CacheDepth cache_depth, rdma_capability_thread* pool) : self_(std::move(self)), cache_depth_(cache_depth) {
-    this->layer_pointers[0] = this->layer_1;
-    this->layer_pointers[1] = this->layer_2;
-    this->layer_pointers[2] = this->layer_3;
-    for(int i = 0; i < PLIST_SIZE; i++){
-      this->is_l2_cached[i] = false;
-    }
-    for(int i = 0; i < PLIST_SIZE * PLIST_SIZE * 2; i++){
-      this->is_l3_cached[i] = false;
-    }
-    this->is_cached_pointers[0] = this->is_l1_cached;
-    this->is_cached_pointers[1] = this->is_l2_cached;
-    this->is_cached_pointers[2] = this->is_l3_cached;
+  /// The cache of calcified PLists. Create one per node and share it with every thread's IHT
+  typedef CalcifiedCache<PList> PListCache;
+
+  /// @param plist_cache the cache of calcified PLists shared by the threads of the node. If null, the IHT caches by itself
+  TunedRdmaIHT(Peer& self, CacheDepth::CacheDepth cache_depth, rdma_capability_thread* pool, PListCache* plist_cache = nullptr)
+  : self_(std::move(self)), cache_depth_(cache_depth), plist_cache_(plist_cache), owns_cache_(plist_cache == nullptr) {
+    if (owns_cache_) plist_cache_ = new PListCache(1 << 12);
     // I want to make sure we are choosing PLIST_SIZE and ELIST_SIZE to best use the space (b/c of alignment)
     if ((PLIST_SIZE * sizeof(plist_pair_t)) % 64 != 0) {
       // PList must use all its space to obey the space requirements
@@ -494,16 +512,8 @@ public:
     pool->Deallocate<remote_baseptr>(temp_ptr, 8);
     pool->Deallocate<EList>(temp_elist);
 
-    // if l1 is cached, free it
-    if (is_l1_cached[0]) free(layer_1[0]);
-    // if l2 is cached, free it
-    for(int i = 0; i < PLIST_SIZE; i++){
-      if (is_l2_cached[i]) free(layer_2[i]);
-    }
-    // if l3 is cached, free it
-    for(int i = 0; i < PLIST_SIZE * PLIST_SIZE * 2; i++){
-      if (is_l3_cached[i]) free(layer_3[i]);
-    }
+    // a shared cache is freed by whoever created it
+    if (owns_cache_) delete plist_cache_;
   }
 
   /// @brief Create a fresh iht
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <type_traits>
+#if defined(__SSE4_2__)
+#include <immintrin.h>
+#endif
+
+#include <dcache/cache_hash.h>
+
+/// Keys and hash policies for the IHT
+/// A key is an integer or a FixedKey (any trivially copyable type with ==, != and < works)
+/// Each hash policy provides
+/// - hash(key, seed): a well-mixed 64-bit hash of the key (the IHT seeds it with the level, so every level hashes differently)
+/// - name: used for printing
+namespace key_hash {
+
+/// A fixed-size binary key (i.e. a 16-byte ID). Compared as bytes
+template <int N>
+struct FixedKey {
+  uint8_t bytes[N];
+
+  /// A key holding x in its first 8 bytes. The other bytes are a pattern of x, so a hash has to read all of them
+  static FixedKey from_int(uint64_t x){
+    FixedKey key;
+    for (int i = 0; i < N; i++) key.bytes[i] = i < 8 ? (uint8_t) (x >> (i * 8)) : (uint8_t) (x >> ((i % 8) * 8)) ^ (uint8_t) i;
+    return key;
+  }
+
+  uint64_t to_int() const {
+    uint64_t x = 0;
+    for (int i = 0; i < 8 && i < N; i++) x |= (uint64_t) bytes[i] << (i * 8);
+    return x;
+  }
+
+  bool operator==(const FixedKey& other) const { return memcmp(bytes, other.bytes, N) == 0; }
+  bool operator!=(const FixedKey& other) const { return memcmp(bytes, other.bytes, N) != 0; }
+  bool operator<(const FixedKey& other) const { return memcmp(bytes, other.bytes, N) < 0; }
+};
+
+/// Make a key from a number (i.e. for the benchmark's integer key space)
+template <typename K>
+inline K from_int(uint64_t x){
+  if constexpr (std::is_integral_v<K>) return (K) x;
+  else return K::from_int(x);
+}
+
+/// The number a key was made from
+template <typename K>
+inline uint64_t to_int(const K& key){
+  if constexpr (std::is_integral_v<K>) return (uint64_t) key;
+  else return key.to_int();
+}
+
+namespace detail {
+  inline uint64_t read8(const uint8_t* p){ uint64_t v; memcpy(&v, p, 8); return v; }
+  inline uint64_t read4(const uint8_t* p){ uint32_t v; memcpy(&v, p, 4); return v; }
+
+  inline void wymum(uint64_t* a, uint64_t* b){
+    __uint128_t r = (__uint128_t) *a * *b;
+    *a = (uint64_t) r;
+    *b = (uint64_t) (r >> 64);
+  }
+
+  inline uint64_t wymix(uint64_t a, uint64_t b){
+    wymum(&a, &b);
+    return a ^ b;
+  }
+}
+
+/// The original hash. std::hash of an integer key (or the words of a binary key) with the mix13 finalizer
+struct Mix13Hash {
+  static constexpr const char* name = "mix13";
+
+  template <typename K>
+  static inline uint64_t hash(const K& key, uint64_t seed){
+    if constexpr (std::is_integral_v<K>) {
+      return mix13(std::hash<K>()(key) ^ seed);
+    } else {
+      const uint8_t* p = (const uint8_t*) &key;
+      uint64_t h = seed;
+      size_t i = 0;
+      for (; i + 8 <= sizeof(K); i += 8) h = mix13(h ^ detail::read8(p + i));
+      for (; i < sizeof(K); i++) h = mix13(h ^ p[i]);
+      return h;
+    }
+  }
+};
+
+/// wyhash (final version 4) over the bytes of the key
+struct WyHash {
+  static constexpr const char* name = "wyhash";
+  static constexpr uint64_t secret[4] = {0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull};
+
+  template <typename K>
+  static inline uint64_t hash(const K& key, uint64_t seed){
+    using namespace detail;
+    const uint8_t* p = (const uint8_t*) &key;
+    constexpr size_t len = sizeof(K);
+    seed ^= wymix(seed ^ secret[0], secret[1]);
+    uint64_t a, b;
+    if constexpr (len <= 16) {
+      if constexpr (len >= 4) {
+        a = (read4(p) << 32) | read4(p + ((len >> 3) << 2));
+        b = (read4(p + len - 4) << 32) | read4(p + len - 4 - ((len >> 3) << 2));
+      } else {
+        a = ((uint64_t) p[0] << 16) | ((uint64_t) p[len >> 1] << 8) | p[len - 1];
+        b = 0;
+      }
+    } else {
+      size_t i = len;
+      if (i > 48) {
+        uint64_t see1 = seed, see2 = seed;
+        do {
+          seed = wymix(read8(p) ^ secret[1], read8(p + 8) ^ seed);
+          see1 = wymix(read8(p + 16) ^ secret[2], read8(p + 24) ^ see1);
+          see2 = wymix(read8(p + 32) ^ secret[3], read8(p + 40) ^ see2);
+          p += 48;
+          i -= 48;
+        } while (i > 48);
+        seed ^= see1 ^ see2;
+      }
+      while (i > 16) {
+        seed = wymix(read8(p) ^ secret[1], read8(p + 8) ^ seed);
+        i -= 16;
+        p += 16;
+      }
+      a = read8(p + i - 16);
+      b = read8(p + i - 8);
+    }
+    a ^= secret[1];
+    b ^= seed;
+    wymum(&a, &b);
+    return wymix(a ^ secret[0] ^ len, b ^ secret[1]);
+  }
+};
+
+/// CRC32C over the bytes of the key (with the SSE4.2 crc32 instruction if enabled, see ARCH_FLAGS) and the mix13 finalizer
+/// A CRC is cheap but only 32 bits and linear, so the finalizer spreads it over the high bits fastrange uses
+struct Crc32cHash {
+  static constexpr const char* name = "crc32c";
+
+  template <typename K>
+  static inline uint64_t hash(const K& key, uint64_t seed){
+    const uint8_t* p = (const uint8_t*) &key;
+    uint64_t crc = (uint32_t) seed ^ 0xFFFFFFFF;
+    size_t i = 0;
+#if defined(__SSE4_2__)
+    for (; i + 8 <= sizeof(K); i += 8) crc = _mm_crc32_u64(crc, detail::read8(p + i));
+    for (; i < sizeof(K); i++) crc = _mm_crc32_u8((uint32_t) crc, p[i]);
+#else
+    for (; i < sizeof(K); i++) {
+      crc ^= p[i];
+      for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+    }
+#endif
+    return mix13(((seed >> 32) << 32) ^ (crc ^ 0xFFFFFFFF));
+  }
+};
+
+}
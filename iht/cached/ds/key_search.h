@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#if defined(__SSE4_2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+/// Key search kernels for the nodes of the data structures (B+tree key lines and IHT ELists)
+/// The instruction set is selected at compile time (AVX2, then SSE4.2, then scalar). Build with ARCH_FLAGS to enable them
+/// - count_less: the number of keys less than key in an array (for a sorted array, the first index where key <= keys[index])
+/// - find_key: the index of key in an array of {key, value} pairs
+namespace key_search {
+
+/// 32 and 64-bit integer keys can be compared as a vector
+template <typename K>
+inline constexpr bool vectorizable = std::is_integral_v<K> && (sizeof(K) == 4 || sizeof(K) == 8);
+
+/// The number of keys in keys[0, n) that are less than key
+template <typename K>
+inline int count_less(const K* keys, int n, K key){
+  int i = 0;
+  int count = 0;
+  if constexpr (vectorizable<K>) {
+#if defined(__SSE4_2__) || defined(__AVX2__)
+    // the compares are signed, so unsigned keys are shifted into the signed range
+    constexpr uint64_t bias = std::is_unsigned_v<K> ? (uint64_t) 1 << (sizeof(K) * 8 - 1) : 0;
+#endif
+#if defined(__AVX2__)
+    if constexpr (sizeof(K) == 4) {
+      __m256i b = _mm256_set1_epi32((int32_t) bias);
+      __m256i k = _mm256_xor_si256(_mm256_set1_epi32((int32_t) key), b);
+      for (; i + 8 <= n; i += 8){
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*) (keys + i)), b);
+        count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(k, v))));
+      }
+    } else {
+      __m256i b = _mm256_set1_epi64x((int64_t) bias);
+      __m256i k = _mm256_xor_si256(_mm256_set1_epi64x((int64_t) key), b);
+      for (; i + 4 <= n; i += 4){
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*) (keys + i)), b);
+        count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(k, v))));
+      }
+    }
+#elif defined(__SSE4_2__)
+    if constexpr (sizeof(K) == 4) {
+      __m128i b = _mm_set1_epi32((int32_t) bias);
+      __m128i k = _mm_xor_si128(_mm_set1_epi32((int32_t) key), b);
+      for (; i + 4 <= n; i += 4){
+        __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (keys + i)), b);
+        count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(k, v))));
+      }
+    } else {
+      __m128i b = _mm_set1_epi64x((int64_t) bias);
+      __m128i k = _mm_xor_si128(_mm_set1_epi64x((int64_t) key), b);
+      for (; i + 2 <= n; i += 2){
+        __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (keys + i)), b);
+        count += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(k, v))));
+      }
+    }
+#endif
+  }
+  for (; i < n; i++) count += keys[i] < key;
+  return count;
+}
+
+/// The index of the first pair in pairs[0, n) with pair.key == key (or -1)
+/// Pairs of a 32-bit key and a 32-bit value (or 64 and 64) are compared as a vector (the key must be the first member)
+template <typename Pair, typename K>
+inline int find_key(const Pair* pairs, int n, K key){
+  int i = 0;
+  if constexpr (vectorizable<K> && sizeof(Pair) == 2 * sizeof(K) && std::is_standard_layout_v<Pair>) {
+    static_assert(offsetof(Pair, key) == 0, "The key must be the first member of the pair");
+#if defined(__AVX2__)
+    if constexpr (sizeof(K) == 4) {
+      // every pair is a 64-bit lane with the key in the low half
+      __m256i low = _mm256_set1_epi64x(0xFFFFFFFF);
+      __m256i k = _mm256_set1_epi64x((uint32_t) key);
+      for (; i + 4 <= n; i += 4){
+        __m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i*) (pairs + i)), low);
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, k)));
+        if (mask != 0) return i + __builtin_ctz(mask);
+      }
+    } else {
+      // two pairs per vector, the keys are the even lanes
+      __m256i k = _mm256_set1_epi64x((int64_t) key);
+      for (; i + 2 <= n; i += 2){
+        __m256i v = _mm256_loadu_si256((const __m256i*) (pairs + i));
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, k))) & 0b0101;
+        if (mask != 0) return i + (__builtin_ctz(mask) >> 1);
+      }
+    }
+#elif defined(__SSE4_2__)
+    if constexpr (sizeof(K) == 4) {
+      __m128i low = _mm_set1_epi64x(0xFFFFFFFF);
+      __m128i k = _mm_set1_epi64x((uint32_t) key);
+      for (; i + 2 <= n; i += 2){
+        __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i*) (pairs + i)), low);
+        int mask = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(v, k)));
+        if (mask != 0) return i + __builtin_ctz(mask);
+      }
+    } else {
+      __m128i k = _mm_set1_epi64x((int64_t) key);
+      for (; i + 1 <= n; i += 1){
+        __m128i v = _mm_loadu_si128((const __m128i*) (pairs + i));
+        if (_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(v, k))) & 0b01) return i;
+      }
+    }
+#endif
+  }
+  for (; i < n; i++) if (pairs[i].key == key) return i;
+  return -1;
+}
+
+}
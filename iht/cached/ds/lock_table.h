@@ -0,0 +1,158 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <remus/logging/logging.h>
+#include <remus/rdma/rdma.h>
+#include <dcache/cache_hash.h>
+
+using namespace remus::rdma;
+using std::vector;
+
+/// Locks for the nodes of a data structure, kept apart from the nodes (like Sherman's on-chip lock table)
+/// Locking a node in its own version word changes a cached object, so every lock and unlock invalidates the node in every peer's cache.
+/// Instead, the lock of a node is a slot in the lock table of the memory node holding it, chosen by hashing the node's address. The tables are never cached
+/// - tables: kNumOfLock 64-bit slots per node (0 is free), taken with a CAS. Nodes colliding on a slot share the lock
+/// - local: a lock word per remote slot for the threads of this node, so only one of them competes for a slot remotely.
+///   A thread unlocking a slot hands it to a waiting thread of this node instead of freeing it (at most kMaxHandOverTime times in a row, so the other nodes get their turn)
+/// Locking a slot doesn't validate the node, the caller checks that the node didn't change since it was read.
+/// A thread can lock a slot it already holds (i.e. a parent and child colliding), it is freed with the last unlock
+/// One per node, shared by its threads
+template <typename capability, int MAX_NODES = 16>
+class LockTable {
+public:
+    /// The size of Sherman's lock table (define::kLockChipMemSize bytes of 64-bit locks)
+    static constexpr uint64_t kNumOfLock = (256 * 1024) / sizeof(uint64_t);
+    /// Sherman's limit on consecutive local handovers (define::kMaxHandOverTime)
+    static constexpr uint64_t kMaxHandOverTime = 8;
+
+private:
+    /// How long a thread waits for another thread of this node to unlock a slot before giving up (the caller will retry)
+    static constexpr int LOCAL_SPIN = 1 << 12;
+
+    // The local lock word of a slot
+    static constexpr uint64_t HELD = 1; // a thread of this node holds the slot
+    static constexpr uint64_t HANDED = 2; // the slot is still locked remotely, for the next thread of this node
+    static constexpr int HANDOVER_SHIFT = 8;
+    static constexpr uint64_t HANDOVERS = (uint64_t) 0xFF << HANDOVER_SHIFT; // consecutive handovers
+    static constexpr uint64_t WAITER = (uint64_t) 1 << 32; // count of the threads of this node waiting for the slot
+
+    /// A slot the thread holds and how many of its locks share it
+    struct held_t {
+        std::atomic<uint64_t>* word;
+        int count;
+    };
+    static inline thread_local vector<held_t> held;
+
+    rdma_ptr<uint64_t> mine;
+    vector<rdma_ptr<uint64_t>> tables; // by node id
+    std::atomic<uint64_t>* local; // MAX_NODES tables of kNumOfLock words
+    std::mutex init_lock;
+
+    inline uint64_t slot(uint64_t address){
+        return fastrange(mix13(address >> 6), kNumOfLock);
+    }
+
+    inline rdma_ptr<uint64_t> remote(uint16_t node, uint64_t s){
+        return rdma_ptr<uint64_t>(node, tables[node].address() + s * sizeof(uint64_t));
+    }
+
+    /// Take the local word of a slot. Sets handed if the slot is still locked remotely (so we don't have to CAS it)
+    bool lock_local(std::atomic<uint64_t>& word, bool& handed){
+        uint64_t w = word.fetch_add(WAITER, std::memory_order_relaxed) + WAITER;
+        for(int spin = 0; ; spin++){
+            if ((w & HELD) == 0){
+                // take it, with the handover if there is one
+                if (word.compare_exchange_weak(w, ((w - WAITER) | HELD) & ~HANDED, std::memory_order_acquire, std::memory_order_relaxed)){
+                    handed = (w & HANDED) != 0;
+                    return true;
+                }
+                continue;
+            }
+            if (spin >= LOCAL_SPIN){
+                // give up, unless the slot was unlocked meanwhile (so a slot handed to the waiters is never left behind)
+                if (word.compare_exchange_weak(w, w - WAITER, std::memory_order_relaxed, std::memory_order_relaxed)) return false;
+                continue;
+            }
+            w = word.load(std::memory_order_relaxed);
+        }
+    }
+
+public:
+    LockTable(capability* pool){
+        static_assert(kNumOfLock * sizeof(uint64_t) <= (1 << 20), "The pool can't allocate more than 1MB at once");
+        mine = pool->template Allocate<uint64_t>(kNumOfLock);
+        memset((void*) mine.get(), 0, kNumOfLock * sizeof(uint64_t));
+        local = new std::atomic<uint64_t>[MAX_NODES * kNumOfLock];
+        for(uint64_t i = 0; i < MAX_NODES * kNumOfLock; i++) local[i].store(0, std::memory_order_relaxed);
+    }
+
+    /// The address of the lock table to share with the other nodes
+    uint64_t root(){
+        return mine.raw();
+    }
+
+    /// Add the lock tables of the other nodes (can be called by every thread)
+    void init(vector<uint64_t> peer_roots){
+        init_lock.lock();
+        for(uint64_t raw : peer_roots){
+            rdma_ptr<uint64_t> p = rdma_ptr<uint64_t>(raw);
+            REMUS_ASSERT(p.id() < MAX_NODES, "At most {} nodes can share lock tables", MAX_NODES);
+            if (p.id() >= tables.size()) tables.resize(p.id() + 1, nullptr);
+            tables[p.id()] = p;
+        }
+        init_lock.unlock();
+    }
+
+    /// Try to lock the slot of an (unmarked) node. Fails if a thread of another node holds the slot, or a thread of this node held it for too long
+    template <typename T>
+    bool lock(capability* pool, rdma_ptr<T> node){
+        REMUS_ASSERT_DEBUG(node.id() < tables.size() && tables[node.id()] != nullptr, "No lock table for node {}", node.id());
+        uint64_t s = slot(node.address());
+        std::atomic<uint64_t>& word = local[node.id() * kNumOfLock + s];
+        for(held_t& h : held){
+            if (h.word != &word) continue;
+            h.count++;
+            return true;
+        }
+        bool handed;
+        if (!lock_local(word, handed)) return false;
+        if (!handed && pool->template CompareAndSwap<uint64_t>(remote(node.id(), s), 0, 1) != 0){
+            word.fetch_and(~HELD, std::memory_order_release);
+            return false;
+        }
+        held.push_back(held_t{&word, 1});
+        return true;
+    }
+
+    /// Unlock the slot of an (unmarked) node, handing it over to a waiting thread of this node if there is one
+    /// @param prealloc memory for the write that frees the slot
+    template <typename T>
+    void unlock(capability* pool, rdma_ptr<T> node, rdma_ptr<uint64_t> prealloc){
+        uint64_t s = slot(node.address());
+        std::atomic<uint64_t>& word = local[node.id() * kNumOfLock + s];
+        auto h = held.begin();
+        while(h != held.end() && h->word != &word) h++;
+        REMUS_ASSERT_DEBUG(h != held.end(), "Unlocking a slot that isn't held");
+        if (--h->count != 0) return;
+        held.erase(h);
+
+        uint64_t w = word.load(std::memory_order_relaxed);
+        while((w & ~(WAITER - 1)) != 0 && ((w & HANDOVERS) >> HANDOVER_SHIFT) < kMaxHandOverTime){
+            uint64_t handed = (((w & ~HELD) | HANDED) + ((uint64_t) 1 << HANDOVER_SHIFT));
+            if (word.compare_exchange_weak(w, handed, std::memory_order_release, std::memory_order_relaxed)) return;
+        }
+        // nobody is waiting (or we handed it over too often), free the slot before unlocking locally
+        pool->template Write<uint64_t>(remote(node.id(), s), 0, prealloc, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
+        word.fetch_and(~(HELD | HANDOVERS), std::memory_order_release);
+    }
+
+    void destroy(capability* pool){
+        pool->template Deallocate<uint64_t>(mine, kNumOfLock);
+        delete[] local;
+    }
+};
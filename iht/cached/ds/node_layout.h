@@ -0,0 +1,415 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+
+#include "key_hash.h"
+#include "key_search.h"
+
+/// Layouts of the B+tree's nodes in memory (a policy of RdmaBPTree)
+/// A node is read with one RDMA read that can interleave with a write of the node, so every layout detects a torn read.
+/// Each layout provides an Inner<K, SIZE> (SIZE keys, SIZE + 1 pointers) and a Leaf<K, V, SIZE> (SIZE keys and values, a range and a next pointer) with
+/// - the version word first, so a node is locked with a CAS on its address (LOCK_BIT is the lock)
+/// - is_valid(ignore_lock): if the node isn't torn (and isn't locked, unless ignore_lock)
+/// - increment_version (also unlocks), lock and unlock
+/// - seal: makes a modified node valid. The tree seals a node before writing it
+/// - the keys (key_at, set_key and count_less), the raw pointers (an rdma_ptr's raw) and the values
+/// - name: used for printing and picking the layout (see --node_layout)
+namespace node_layout {
+
+static constexpr uint64_t LOCK_BIT = (uint64_t) 1 << 63;
+
+/// n rounded up to fill whole 8-byte words with T (so an array of T followed by 64-bit fields has no padding)
+template <typename T>
+constexpr int padded(int n){
+  constexpr int per_word = sizeof(T) >= 8 ? 1 : 8 / sizeof(T);
+  return (n + per_word - 1) / per_word * per_word;
+}
+
+/// The original layout. Every cache line starts with a copy of the version, so a read is torn if the versions differ (like FaRM)
+/// Keeps a node valid without sealing, but the keys of a node are split across lines (key_at is a div and a mod and a search is a vector per line)
+struct LineVersions {
+  static constexpr const char* name = "line";
+
+  template <class K, int SIZE>
+  struct Inner {
+    static constexpr int KLINE_SIZE = 56 / sizeof(K);
+    static constexpr int PLINE_SIZE = 7;
+    static constexpr int KLINES = (SIZE + KLINE_SIZE) / KLINE_SIZE;
+    static constexpr int PLINES = (SIZE + 1 + PLINE_SIZE) / PLINE_SIZE;
+
+    /// A line with keys
+    struct kline {
+      long version;
+      K keys[KLINE_SIZE];
+    };
+
+    /// A line with ptrs
+    struct pline {
+      long version;
+      uint64_t ptrs[PLINE_SIZE];
+    };
+
+    kline key_lines[KLINES];
+    pline ptr_lines[PLINES];
+
+    Inner(){
+      for(int i = 0; i < KLINES; i++) key_lines[i].version = 0;
+      for(int i = 0; i < PLINES; i++) ptr_lines[i].version = 0;
+    }
+
+    bool is_valid(bool ignore_lock) const {
+      long base = key_lines[0].version;
+      if (ignore_lock) base = base & ~LOCK_BIT;
+      for(int i = 0; i < KLINES; i++){
+        if (key_lines[i].version != base) return false;
+      }
+      for(int i = 0; i < PLINES; i++){
+        if (ptr_lines[i].version != base) return false;
+      }
+      return true;
+    }
+
+    long version() const {
+      return key_lines[0].version & ~LOCK_BIT;
+    }
+
+    void increment_version(){
+      key_lines[0].version = (key_lines[0].version & ~LOCK_BIT) + 1;
+      for(int i = 1; i < KLINES; i++) key_lines[i].version++;
+      for(int i = 0; i < PLINES; i++) ptr_lines[i].version++;
+    }
+
+    void lock(){
+      key_lines[0].version = (key_lines[0].version | LOCK_BIT);
+    }
+
+    void unlock(){
+      key_lines[0].version = (key_lines[0].version & ~LOCK_BIT);
+    }
+
+    void seal(){}
+
+    K key_at(int index) const {
+      return key_lines[index / KLINE_SIZE].keys[index % KLINE_SIZE];
+    }
+
+    void set_key(int index, K key){
+      key_lines[index / KLINE_SIZE].keys[index % KLINE_SIZE] = key;
+    }
+
+    /// The keys of a line are contiguous, so each line is searched as a vector
+    int count_less(K key) const {
+      int count = 0;
+      for(int i = 0; i * KLINE_SIZE < SIZE; i++){
+        int n = std::min(KLINE_SIZE, SIZE - i * KLINE_SIZE);
+        count += key_search::count_less(key_lines[i].keys, n, key);
+        // the keys are sorted, so the rest of the lines are greater or equal
+        if (key <= key_lines[i].keys[n - 1]) break;
+      }
+      return count;
+    }
+
+    uint64_t ptr_at(int index) const {
+      return ptr_lines[index / PLINE_SIZE].ptrs[index % PLINE_SIZE];
+    }
+
+    void set_ptr(int index, uint64_t ptr){
+      ptr_lines[index / PLINE_SIZE].ptrs[index % PLINE_SIZE] = ptr;
+    }
+  };
+
+  template <class K, class V, int SIZE>
+  struct Leaf {
+    static constexpr int KLINE_SIZE = 56 / sizeof(K);
+    static constexpr int VLINE_SIZE = 56 / sizeof(V);
+    static constexpr int HLINE_SIZE = 40 / sizeof(V);
+    static constexpr int KLINES = (SIZE + KLINE_SIZE) / KLINE_SIZE;
+    static constexpr int VLINES = (SIZE + VLINE_SIZE - HLINE_SIZE) / VLINE_SIZE;
+
+    /// A hybrid line for the range and next ptr
+    struct hline {
+      long version;
+      V values[HLINE_SIZE];
+      K key_low; // lower bound (cannot be eq)
+      K key_high; // upper bound (can be eq)
+      uint64_t next;
+    };
+
+    /// A line with keys
+    struct kline {
+      long version;
+      K keys[KLINE_SIZE];
+    };
+
+    /// A line with values
+    struct vline {
+      long version;
+      V values[VLINE_SIZE];
+    };
+
+    kline key_lines[KLINES];
+    vline value_lines[VLINES];
+    hline last_line;
+
+    Leaf(){
+      for(int i = 0; i < KLINES; i++) key_lines[i].version = 0;
+      for(int i = 0; i < VLINES; i++) value_lines[i].version = 0;
+      last_line.version = 0;
+    }
+
+    bool is_valid(bool ignore_lock) const {
+      long base = key_lines[0].version;
+      if (ignore_lock) base = base & ~LOCK_BIT;
+      for(int i = 1; i < KLINES; i++){
+        if (key_lines[i].version != base) return false;
+      }
+      for(int i = 0; i < VLINES; i++){
+        if (value_lines[i].version != base) return false;
+      }
+      if (last_line.version != base) return false;
+      return true;
+    }
+
+    long version() const {
+      return key_lines[0].version & ~LOCK_BIT;
+    }
+
+    void increment_version(){
+      key_lines[0].version = (key_lines[0].version & ~LOCK_BIT) + 1;
+      for(int i = 1; i < KLINES; i++) key_lines[i].version++;
+      for(int i = 0; i < VLINES; i++) value_lines[i].version++;
+      last_line.version++;
+    }
+
+    void lock(){
+      key_lines[0].version = (key_lines[0].version | LOCK_BIT);
+    }
+
+    void unlock(){
+      key_lines[0].version = (key_lines[0].version & ~LOCK_BIT);
+    }
+
+    void seal(){}
+
+    K key_low() const { return last_line.key_low; }
+    K key_high() const { return last_line.key_high; }
+
+    void set_range(K key_low, K key_high){
+      last_line.key_low = key_low;
+      last_line.key_high = key_high;
+    }
+
+    uint64_t next() const { return last_line.next; }
+    void set_next(uint64_t next){ last_line.next = next; }
+
+    K key_at(int index) const {
+      return key_lines[index / KLINE_SIZE].keys[index % KLINE_SIZE];
+    }
+
+    void set_key(int index, K key){
+      key_lines[index / KLINE_SIZE].keys[index % KLINE_SIZE] = key;
+    }
+
+    /// The keys of a line are contiguous, so each line is searched as a vector
+    int count_less(K key) const {
+      int count = 0;
+      for(int i = 0; i * KLINE_SIZE < SIZE; i++){
+        int n = std::min(KLINE_SIZE, SIZE - i * KLINE_SIZE);
+        count += key_search::count_less(key_lines[i].keys, n, key);
+        // the keys are sorted, so the rest of the lines are greater or equal
+        if (key <= key_lines[i].keys[n - 1]) break;
+      }
+      return count;
+    }
+
+    V value_at(int index) const {
+      if ((index / VLINE_SIZE) >= VLINES) return last_line.values[index % VLINE_SIZE];
+      else return value_lines[index / VLINE_SIZE].values[index % VLINE_SIZE];
+    }
+
+    void set_value(int index, V value){
+      if ((index / VLINE_SIZE) >= VLINES) last_line.values[index % VLINE_SIZE] = value;
+      else value_lines[index / VLINE_SIZE].values[index % VLINE_SIZE] = value;
+    }
+  };
+};
+
+/// A checksum of the whole node after the version word, so the keys, pointers and values are contiguous arrays
+/// A read is torn if the checksum doesn't match. Validating hashes the node (CRC32C is fast with ARCH_FLAGS, wyhash without) and a modified node has to be sealed.
+/// The checksum is seeded with the version, but not the lock bit (it's locked and unlocked in place), so a body is only valid with its own version
+/// (the delta records of a leaf are merged by the version they were appended to)
+template <class Hash = key_hash::Crc32cHash>
+struct Checksum {
+  static constexpr const char* name = "checksum";
+
+  template <class K, int SIZE>
+  struct Inner {
+    /// The keys are padded to whole words, so the checksummed body has no padding
+    static constexpr int KEYS = padded<K>(SIZE);
+
+    struct body_t {
+      uint64_t ptrs[SIZE + 1];
+      K keys[KEYS];
+    };
+    static_assert(std::has_unique_object_representations_v<body_t>, "The checksum can't cover padding");
+
+    long version_;
+    uint64_t checksum;
+    body_t body;
+
+    Inner() : version_(0), checksum(0) {
+      for(int i = SIZE; i < KEYS; i++) body.keys[i] = 0;
+    }
+
+    bool is_valid(bool ignore_lock) const {
+      if (!ignore_lock && (version_ & LOCK_BIT) != 0) return false;
+      return checksum == Hash::hash(body, version());
+    }
+
+    long version() const { return version_ & ~LOCK_BIT; }
+    void increment_version(){ version_ = (version_ & ~LOCK_BIT) + 1; }
+    void lock(){ version_ = version_ | LOCK_BIT; }
+    void unlock(){ version_ = version_ & ~LOCK_BIT; }
+    void seal(){ checksum = Hash::hash(body, version()); }
+
+    K key_at(int index) const { return body.keys[index]; }
+    void set_key(int index, K key){ body.keys[index] = key; }
+    int count_less(K key) const { return key_search::count_less(body.keys, SIZE, key); }
+
+    uint64_t ptr_at(int index) const { return body.ptrs[index]; }
+    void set_ptr(int index, uint64_t ptr){ body.ptrs[index] = ptr; }
+  };
+
+  template <class K, class V, int SIZE>
+  struct Leaf {
+    static constexpr int KEYS = padded<K>(SIZE);
+    static constexpr int VALUES = padded<V>(SIZE);
+
+    struct body_t {
+      uint64_t next;
+      K key_low; // lower bound (cannot be eq)
+      K key_high; // upper bound (can be eq)
+      K keys[KEYS];
+      V values[VALUES];
+    };
+    static_assert(std::has_unique_object_representations_v<body_t>, "The checksum can't cover padding");
+
+    long version_;
+    uint64_t checksum;
+    body_t body;
+
+    Leaf() : version_(0), checksum(0) {
+      for(int i = SIZE; i < KEYS; i++) body.keys[i] = 0;
+      for(int i = SIZE; i < VALUES; i++) body.values[i] = 0;
+    }
+
+    bool is_valid(bool ignore_lock) const {
+      if (!ignore_lock && (version_ & LOCK_BIT) != 0) return false;
+      return checksum == Hash::hash(body, version());
+    }
+
+    long version() const { return version_ & ~LOCK_BIT; }
+    void increment_version(){ version_ = (version_ & ~LOCK_BIT) + 1; }
+    void lock(){ version_ = version_ | LOCK_BIT; }
+    void unlock(){ version_ = version_ & ~LOCK_BIT; }
+    void seal(){ checksum = Hash::hash(body, version()); }
+
+    K key_low() const { return body.key_low; }
+    K key_high() const { return body.key_high; }
+    void set_range(K key_low, K key_high){
+      body.key_low = key_low;
+      body.key_high = key_high;
+    }
+
+    uint64_t next() const { return body.next; }
+    void set_next(uint64_t next){ body.next = next; }
+
+    K key_at(int index) const { return body.keys[index]; }
+    void set_key(int index, K key){ body.keys[index] = key; }
+    int count_less(K key) const { return key_search::count_less(body.keys, SIZE, key); }
+
+    V value_at(int index) const { return body.values[index]; }
+    void set_value(int index, V value){ body.values[index] = value; }
+  };
+};
+
+/// The version is in the first and the last word of the node, with contiguous arrays in between. A read is torn if they differ
+/// Validating is one compare, but it relies on the NIC reading and writing a node in increasing address order (which RDMA doesn't promise across cache lines)
+struct HeaderFooter {
+  static constexpr const char* name = "header_footer";
+
+  template <class K, int SIZE>
+  struct Inner {
+    long version_;
+    K keys[SIZE];
+    uint64_t ptrs[SIZE + 1];
+    long footer;
+
+    Inner() : version_(0), footer(0) {}
+
+    bool is_valid(bool ignore_lock) const {
+      long base = version_;
+      if (ignore_lock) base = base & ~LOCK_BIT;
+      return footer == base;
+    }
+
+    long version() const { return version_ & ~LOCK_BIT; }
+    void increment_version(){ footer = version_ = (version_ & ~LOCK_BIT) + 1; }
+    void lock(){ version_ = version_ | LOCK_BIT; }
+    void unlock(){ version_ = version_ & ~LOCK_BIT; }
+    void seal(){}
+
+    K key_at(int index) const { return keys[index]; }
+    void set_key(int index, K key){ keys[index] = key; }
+    int count_less(K key) const { return key_search::count_less(keys, SIZE, key); }
+
+    uint64_t ptr_at(int index) const { return ptrs[index]; }
+    void set_ptr(int index, uint64_t ptr){ ptrs[index] = ptr; }
+  };
+
+  template <class K, class V, int SIZE>
+  struct Leaf {
+    long version_;
+    uint64_t next_;
+    K key_low_; // lower bound (cannot be eq)
+    K key_high_; // upper bound (can be eq)
+    K keys[SIZE];
+    V values[SIZE];
+    long footer;
+
+    Leaf() : version_(0), footer(0) {}
+
+    bool is_valid(bool ignore_lock) const {
+      long base = version_;
+      if (ignore_lock) base = base & ~LOCK_BIT;
+      return footer == base;
+    }
+
+    long version() const { return version_ & ~LOCK_BIT; }
+    void increment_version(){ footer = version_ = (version_ & ~LOCK_BIT) + 1; }
+    void lock(){ version_ = version_ | LOCK_BIT; }
+    void unlock(){ version_ = version_ & ~LOCK_BIT; }
+    void seal(){}
+
+    K key_low() const { return key_low_; }
+    K key_high() const { return key_high_; }
+    void set_range(K key_low, K key_high){
+      key_low_ = key_low;
+      key_high_ = key_high;
+    }
+
+    uint64_t next() const { return next_; }
+    void set_next(uint64_t next){ next_ = next; }
+
+    K key_at(int index) const { return keys[index]; }
+    void set_key(int index, K key){ keys[index] = key; }
+    int count_less(K key) const { return key_search::count_less(keys, SIZE, key); }
+
+    V value_at(int index) const { return values[index]; }
+    void set_value(int index, V value){ values[index] = value; }
+  };
+};
+
+}
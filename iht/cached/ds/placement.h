@@ -0,0 +1,190 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <remus/logging/logging.h>
+#include <remus/rdma/rdma.h>
+
+using namespace remus::rdma;
+using std::vector;
+
+/// Where a data structure places the objects it creates
+namespace Placement {
+  enum Policy {
+    /// On the node creating the object
+    Local,
+    /// On a home node chosen by hashing the object's position (i.e. the bucket)
+    Home,
+    /// Round-robin across the nodes
+    RoundRobin,
+    /// On the node that accessed the position the most (from sampled access counts)
+    Accessor,
+  };
+
+  inline Policy from_string(const std::string& name){
+    if (name == "local") return Local;
+    if (name == "home") return Home;
+    if (name == "round_robin") return RoundRobin;
+    if (name == "accessor") return Accessor;
+    REMUS_FATAL("Unknown placement policy {} (local, home, round_robin, accessor)", name);
+  }
+}
+
+/// The objects of a node that the other nodes can place their objects in (the pool can only allocate locally)
+/// - depot: a stock of empty objects allocated by the node. The owner refills the empty slots and the others take an object with a CAS on its slot
+/// - rows: sampled access counts of the positions (i.e. buckets) the node owns, one counter per accessing node
+/// Objects taken from a depot are owned by the node they came from, so they have to be deallocated by it (i.e. with a ReturnInbox)
+/// One per node, shared by its threads
+template <typename T, typename capability, int SLOTS = 64, int ROWS = 4096, int MAX_NODES = 16>
+class ObjectPlacement {
+    struct alignas(64) row_t {
+        uint64_t counts[MAX_NODES];
+    };
+    struct alignas(64) shared_t {
+        uint64_t depot[SLOTS];
+        row_t rows[ROWS];
+    };
+
+    Placement::Policy policy;
+    uint16_t self;
+    vector<uint16_t> nodes; // every node of the clique (including self)
+    rdma_ptr<shared_t> mine;
+    vector<rdma_ptr<shared_t>> shared; // by node id
+    std::mutex init_lock;
+    std::atomic<uint64_t> next; // for round-robin
+
+    static inline uint64_t mix(uint64_t x){
+        x ^= (x >> 33);
+        x *= 0xff51afd7ed558ccd;
+        x ^= (x >> 33);
+        x *= 0xc4ceb9fe1a85ec53;
+        x ^= (x >> 33);
+        return x;
+    }
+
+    /// The counter of node for a position (positions are hashed into the rows of the owner)
+    rdma_ptr<uint64_t> counter(uint16_t owner, uint64_t position, uint16_t node){
+        rdma_ptr<shared_t> s = shared[owner];
+        uint64_t row = mix(position) % ROWS;
+        return rdma_ptr<uint64_t>(s.id(), s.address() + offsetof(shared_t, rows) + row * sizeof(row_t) + node * sizeof(uint64_t));
+    }
+
+    rdma_ptr<uint64_t> depot_slot(rdma_ptr<shared_t> s, int i){
+        return rdma_ptr<uint64_t>(s.id(), s.address() + i * sizeof(uint64_t));
+    }
+
+public:
+    ObjectPlacement(capability* pool, Placement::Policy policy, uint16_t self, vector<uint16_t> nodes)
+    : policy(policy), self(self), nodes(std::move(nodes)), next(self) {
+        static_assert(sizeof(shared_t) <= (1 << 20), "The pool can't allocate more than 1MB at once");
+        REMUS_ASSERT(this->nodes.size() <= MAX_NODES, "At most {} nodes can be placed on", MAX_NODES);
+        mine = pool->template Allocate<shared_t>();
+        memset((void*) mine.get(), 0, sizeof(shared_t));
+    }
+
+    Placement::Policy get_policy(){
+        return policy;
+    }
+
+    /// The address of the shared objects to share with the other nodes
+    uint64_t root(){
+        return mine.raw();
+    }
+
+    /// Add the shared objects of the other nodes (can be called by every thread)
+    void init(vector<uint64_t> peer_roots){
+        init_lock.lock();
+        for(uint64_t raw : peer_roots){
+            rdma_ptr<shared_t> p = rdma_ptr<shared_t>(raw);
+            if (p.id() >= shared.size()) shared.resize(p.id() + 1, nullptr);
+            shared[p.id()] = p;
+        }
+        init_lock.unlock();
+    }
+
+    /// Choose the node for a new object at a position. The position identifies where the object is linked from
+    /// @param owner the node owning the position (i.e. the node of the PList holding the bucket)
+    uint16_t choose(capability* pool, uint16_t owner, uint64_t position){
+        switch (policy) {
+        case Placement::Home:
+            return nodes[mix(position) % nodes.size()];
+        case Placement::RoundRobin:
+            return nodes[next.fetch_add(1) % nodes.size()];
+        case Placement::Accessor: {
+            if (owner >= shared.size() || shared[owner] == nullptr) return self;
+            rdma_ptr<row_t> row = rdma_ptr<row_t>(counter(owner, position, 0).raw());
+            rdma_ptr<row_t> local = pool->template Read<row_t>(row);
+            uint16_t best = self;
+            uint64_t best_count = 0;
+            for(uint16_t node : nodes){
+                if (local->counts[node] > best_count) {
+                    best = node;
+                    best_count = local->counts[node];
+                }
+            }
+            pool->template Deallocate<row_t>(local);
+            return best;
+        }
+        default:
+            return self;
+        }
+    }
+
+    /// Count a (sampled) access of this node to a position. Only counted for the Accessor policy
+    void sample(capability* pool, uint16_t owner, uint64_t position){
+        if (policy != Placement::Accessor || owner >= shared.size() || shared[owner] == nullptr) return;
+        rdma_ptr<uint64_t> c = counter(owner, position, self);
+        uint64_t expected = 0;
+        while (true){
+            uint64_t v = pool->template CompareAndSwap<uint64_t>(c, expected, expected + 1);
+            if (v == expected) return;
+            expected = v;
+        }
+    }
+
+    /// Take an empty object from the depot of node. Returns nullptr if the depot is empty
+    rdma_ptr<T> take(capability* pool, uint16_t node){
+        if (node >= shared.size() || shared[node] == nullptr) return nullptr;
+        rdma_ptr<shared_t> s = shared[node];
+        // read the depot once to find the full slots
+        rdma_ptr<uint64_t> local = pool->template ExtendedRead<uint64_t>(depot_slot(s, 0), SLOTS);
+        rdma_ptr<T> result = nullptr;
+        for(int i = 0; i < SLOTS && result == nullptr; i++){
+            uint64_t raw = local.get()[i];
+            if (raw == 0) continue;
+            if (pool->template CompareAndSwap<uint64_t>(depot_slot(s, i), raw, 0) == raw) result = rdma_ptr<T>(raw);
+        }
+        pool->template Deallocate<uint64_t>(local, SLOTS);
+        return result;
+    }
+
+    /// Fill the empty slots of this node's depot with new objects. Only worth it if other nodes place objects here
+    void refill(capability* pool){
+        if (policy == Placement::Local) return;
+        for(int i = 0; i < SLOTS; i++){
+            if (((volatile uint64_t*) mine->depot)[i] != 0) continue;
+            rdma_ptr<T> obj = pool->template Allocate<T>();
+            *obj = T();
+            // peers CAS the slots with RDMA atomics, so fill it with one as well
+            if (pool->template CompareAndSwap<uint64_t>(depot_slot(mine, i), 0, obj.raw()) != 0){
+                pool->template Deallocate<T>(obj);
+            }
+        }
+    }
+
+    void destroy(capability* pool){
+        for(int i = 0; i < SLOTS; i++){
+            uint64_t raw = ((volatile uint64_t*) mine->depot)[i];
+            if (raw == 0) continue;
+            if (pool->template CompareAndSwap<uint64_t>(depot_slot(mine, i), raw, 0) != raw) continue;
+            pool->template Deallocate<T>(rdma_ptr<T>(raw));
+        }
+        pool->template Deallocate<shared_t>(mine);
+    }
+};
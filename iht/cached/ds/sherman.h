@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <climits>
 #include <cstdint>
 #include <ostream>
@@ -17,7 +18,10 @@
 #include "../sherman/sherman_root.h"
 
 #include "../../common.h"
+#include "key_search.h"
+#include "lock_table.h"
 #include <optional>
+#include <vector>
 #include <remus/rdma/rdma_ptr.h>
 
 using namespace remus::rdma;
@@ -35,6 +39,9 @@ private:
   static const int SIZE = (DEGREE * 2) + 1;
   static const uint64_t LOCK_BIT = (uint64_t) 1 << 63;
   static std::atomic<bool> is_leader_gen;
+  /// How often an empty leaf tries to lock its neighbor before it is written back unmerged.
+  /// The merge holds the leaf and its parent, so it can't wait: the neighbor's holder may need the parent, or share a slot of the lock table
+  static const int MERGE_ATTEMPTS = 16;
   bool is_leader = false;
 
   static const int VLINE_SIZE = 56 / sizeof(V);
@@ -170,6 +177,18 @@ public:
       return key_lines[index / KLINE_SIZE].keys[index % KLINE_SIZE];
     }
 
+    /// The number of keys less than key. The keys of a line are contiguous, so each line is searched as a vector
+    int count_less(K key) const {
+      int count = 0;
+      for(int i = 0; i * KLINE_SIZE < SIZE; i++){
+        int n = std::min(KLINE_SIZE, SIZE - i * KLINE_SIZE);
+        count += key_search::count_less(key_lines[i].keys, n, key);
+        // the keys are sorted, so the rest of the lines are greater or equal
+        if (key <= key_lines[i].keys[n - 1]) break;
+      }
+      return count;
+    }
+
     void set_key(int index, K key) {
       key_lines[index / KLINE_SIZE].keys[index % KLINE_SIZE] = key;
     }
@@ -324,6 +343,18 @@ public:
       return key_lines[index / KLINE_SIZE].keys[index % KLINE_SIZE];
     }
 
+    /// The number of keys less than key. The keys of a line are contiguous, so each line is searched as a vector
+    int count_less(K key) const {
+      int count = 0;
+      for(int i = 0; i * KLINE_SIZE < SIZE; i++){
+        int n = std::min(KLINE_SIZE, SIZE - i * KLINE_SIZE);
+        count += key_search::count_less(key_lines[i].keys, n, key);
+        // the keys are sorted, so the rest of the lines are greater or equal
+        if (key <= key_lines[i].keys[n - 1]) break;
+      }
+      return count;
+    }
+
     void set_key(int index, K key) {
       key_lines[index / KLINE_SIZE].keys[index % KLINE_SIZE] = key;
     }
@@ -347,6 +378,7 @@ private:
   using EBRNode = EBRObjectPoolAccompany<BNode, BLeaf, 100, capability>;
   using Cache = RemoteCacheImpl<capability>;
   using Index = IndexCache<BNode, DEGREE, K>;
+  using Locks = LockTable<capability>;
   
   Peer self_;
   rdma_ptr<BRoot> root;
@@ -355,6 +387,8 @@ private:
   ShermanRoot<K>* backup_index;
   EBRLeaf* ebr_leaf;
   EBRNode* ebr_node;
+  /// The table of the node locks (nullptr to lock the nodes in their version words)
+  Locks* locks;
 
   template <typename T> inline bool is_local(rdma_ptr<T> ptr) {
     return ptr.id() == self_.id;
@@ -372,17 +406,42 @@ private:
   /// returns true if we can acquire the version of the node
   template <class ptr_t>
   bool try_acquire(capability* pool, rdma_ptr<ptr_t> node, long version){
+    if (locks != nullptr){
+      // lock the node's slot, then check the node is unlocked and didn't change since we read it
+      rdma_ptr<uint64_t> word = static_cast<rdma_ptr<uint64_t>>(node);
+      if (!locks->lock(pool, word)) return false;
+      if (*pool->template Read<uint64_t>(word, temp_lock) == (version & ~LOCK_BIT)) return true;
+      locks->unlock(pool, word, temp_lock);
+      return false;
+    }
     // swap the first 8 bytes (the lock) from unlocked to locked
     uint64_t v = pool->template CompareAndSwap<uint64_t>(static_cast<rdma_ptr<uint64_t>>(node), version & ~LOCK_BIT, version | LOCK_BIT);
     if (v == (version & ~LOCK_BIT)) return true; // I think the lock bit will never be set in this scenario since we'd detect a broken read primarily
     return false;
   }
 
+  /// Release a lock without modifying the node
   template <class ptr_t>
   void release(capability* pool, rdma_ptr<ptr_t> node, long version){
+    if (locks != nullptr){
+      locks->unlock(pool, static_cast<rdma_ptr<uint64_t>>(node), temp_lock);
+      return;
+    }
+    release_in_node(pool, node, version);
+  }
+
+  /// Release the lock bit in the node by writing back its version (i.e. a new neighbor that was written locked)
+  template <class ptr_t>
+  void release_in_node(capability* pool, rdma_ptr<ptr_t> node, long version){
     pool->template Write<uint64_t>(static_cast<rdma_ptr<uint64_t>>(node), version, temp_lock, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
   }
 
+  /// Release the lock of a node we wrote with an incremented version (which already released a lock in the node)
+  template <class ptr_t>
+  inline void release_written(capability* pool, rdma_ptr<ptr_t> node){
+    if (locks != nullptr) locks->unlock(pool, static_cast<rdma_ptr<uint64_t>>(node), temp_lock);
+  }
+
   enum ReadBehavior {
     IGNORE_LOCK = 0,
     LOOK_FOR_SPLIT_MERGE = 1,
@@ -419,19 +478,8 @@ private:
   template <class SRC>
   int search_node(const SRC* origin, K key) {
     if (key > origin->key_at(SIZE - 1)) return -1;
-    int low = 0;
-    int high = SIZE - 1;
-    int mid;
-    while(low != high){
-      mid = (low + high) / 2;
-      if (key == origin->key_at(mid))
-        return mid;
-      else if (key < origin->key_at(mid))
-        high = mid;
-      else
-        low = mid + 1;
-    }
-    return low; // low = mid = high (but mid hasn't been updated)
+    // the keys are sorted, so the first index where key <= key_at(index) is the number of keys less than key
+    return origin->count_less(key);
     /* reference for equivalence
     for(int i = 0; i < SIZE; i++) if (key <= origin->key_at(i)) return i;
     */
@@ -557,6 +605,8 @@ private:
     node.increment_version(); // increment version before writing
     cache->template Write<BRoot>(parent_p.remote_origin(), parent, prealloc_root_w);      
     cache->template Write<BNode>(node_p.remote_origin(), node, prealloc_node_w);
+    release_written(pool, parent_p.remote_origin());
+    release_written(pool, node_p.remote_origin());
   }
 
   /// Move
@@ -605,6 +655,8 @@ private:
     node.increment_version();
     cache->template Write<BRoot>(parent_p.remote_origin(), parent, prealloc_root_w);
     cache->template Write<BLeaf>(node_p.remote_origin(), node, prealloc_leaf_w);
+    release_written(pool, parent_p.remote_origin());
+    release_written(pool, node_p.remote_origin());
   }
 
   /// Not at root
@@ -643,6 +695,8 @@ private:
     // unmark parent and node in conjuction with splitting
     cache->template Write<BNode>(parent_p.remote_origin(), parent, prealloc_node_w);
     cache->template Write<BNode>(node_p.remote_origin(), node, prealloc_node_w);
+    release_written(pool, parent_p.remote_origin());
+    release_written(pool, node_p.remote_origin());
   }
 
   /// At leaf. Try to split the leaf into two and move a key to the parent
@@ -684,6 +738,7 @@ private:
     node.increment_version();
 
     cache->template Write<BNode>(parent_p.remote_origin(), parent, prealloc_node_w);
+    release_written(pool, parent_p.remote_origin());
     // leave the leaf unmodified and locked for further use
     return node;
   }
@@ -737,6 +792,8 @@ private:
       leaf_one->set_key(size_one, leaf_two->key_at(i));
       leaf_one->set_value(size_one, leaf_two->value_at(i));
     }
+    // a late reader of leaf_two (i.e. a scan following a stale next pointer) finds it out of range, so it retraverses
+    leaf_two->set_range(leaf_two->key_high(), leaf_two->key_high());
     shift_down(parent, bucket_one);
     leaf_two->mark_deleted();
     return one_gone;
@@ -768,6 +825,7 @@ private:
               effect(&leaf_updated, search_node<BLeaf>(&leaf_updated, key));
               leaf_updated.increment_version();
               cache->template Write<BLeaf>(leaf.remote_origin(), leaf_updated, prealloc_leaf_w, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
+              release_written(pool, leaf.remote_origin());
               return leaf;
             } else {
               // retry if we cannot acquire lock
@@ -832,6 +890,7 @@ private:
             leaf_updated.increment_version();
             release<BRoot>(pool, curr_root.remote_origin(), curr_root->version());
             cache->template Write<BLeaf>(next_leaf.remote_origin(), leaf_updated, prealloc_leaf_w);
+            release_written(pool, next_leaf.remote_origin());
           }
         }
 
@@ -866,6 +925,8 @@ private:
             new_curr.mark_deleted();
             new_curr.increment_version();
             cache->template Write<BNode>(curr.remote_origin(), new_curr);
+            release_written(pool, curr_root.remote_origin());
+            release_written(pool, curr.remote_origin());
             ebr_node->deallocate(curr.remote_origin()); // deallocate the unlinked node
           } else {
             release<BRoot>(pool, curr_root.remote_origin(), curr_root->version()); // continue traversing, we failed to lower a level
@@ -935,6 +996,9 @@ private:
                 cache->template Write<BNode>(curr.remote_origin(), empty_node, prealloc_node_w);
                 cache->template Write<BNode>(merging_node.remote_origin(), merged_node, prealloc_node_w);
                 cache->template Write<BNode>(parent.remote_origin(), parent_of_merge, prealloc_node_w);
+                release_written(pool, curr.remote_origin());
+                release_written(pool, merging_node.remote_origin());
+                release_written(pool, parent.remote_origin());
                 // re-read the parent and continue
                 curr = reliable_read<BNode>(parent.remote_origin(), LOOK_FOR_SPLIT_MERGE);
                 bucket = search_node<BNode>(curr, key);
@@ -980,6 +1044,7 @@ private:
           effect(&leaf_updated, search_node<BLeaf>(&leaf_updated, key));
           leaf_updated.increment_version();
           cache->template Write<BLeaf>(leaf.remote_origin(), leaf_updated, prealloc_leaf_w, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
+          release_written(pool, leaf.remote_origin());
           return leaf;
         } else {
           if (try_acquire<BNode>(pool, curr.remote_origin(), curr->version())){
@@ -997,12 +1062,14 @@ private:
                 effect(&next_leaf_local, search_node<BLeaf>(next_leaf_local_const, key)); // modify the next
                 next_leaf_local.increment_version();
                 cache->template Write<BLeaf>(next_leaf, next_leaf_local, prealloc_leaf_w, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
+                release_written(pool, leaf.remote_origin());
                 return leaf;
               } else {
                 // key goes into current, unlock next
-                release<BLeaf>(pool, next_leaf, 0);
+                release_in_node<BLeaf>(pool, next_leaf, 0);
                 effect(&leaf_updated, bucket);
                 cache->template Write<BLeaf>(leaf.remote_origin(), leaf_updated, prealloc_leaf_w, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
+                release_written(pool, leaf.remote_origin());
                 return leaf;
               }
             } else if (leaf->key_at(0) == SENTINEL && curr->key_at(0) != SENTINEL){
@@ -1018,15 +1085,15 @@ private:
               }
 
               CachedObject<BLeaf> merging_leaf;
-              bool do_merge = true;
-              while(true){ // aggressively acquire the node since we only compete with simple insert/remove
-                merging_leaf = reliable_read<BLeaf>(merge_leaf_ptr, WILL_NEED_ACQUIRE, prealloc_leaf_r2);
-                if (merging_leaf->key_at(SIZE - 1) != SENTINEL) {
-                  do_merge = false; // give up because merging will cause inserts to fail!
+              bool do_merge = false;
+              for(int attempt = 0; attempt < MERGE_ATTEMPTS; attempt++){
+                // don't wait on the neighbor's lock, its holder might be waiting on ours
+                merging_leaf = reliable_read<BLeaf>(merge_leaf_ptr, IGNORE_LOCK, prealloc_leaf_r2);
+                if (merging_leaf->key_at(SIZE - 1) != SENTINEL) break; // give up because merging will cause inserts to fail!
+                if (try_acquire(pool, merging_leaf.remote_origin(), merging_leaf->version())){
+                  do_merge = true;
                   break;
                 }
-                // ? if we add linearizable range queries, we prob need to re-traverse instead to prevent deadlock!
-                if (try_acquire(pool, merging_leaf.remote_origin(), merging_leaf->version())) break;
               }
 
               if (!do_merge){
@@ -1035,6 +1102,7 @@ private:
                 effect(&leaf_updated, search_node<BLeaf>(&leaf_updated, key));
                 leaf_updated.increment_version();
                 cache->template Write<BLeaf>(leaf.remote_origin(), leaf_updated, prealloc_leaf_w, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
+                release_written(pool, leaf.remote_origin());
                 release<BNode>(pool, curr.remote_origin(), curr->version()); // release parent
                 return leaf;
               }
@@ -1059,6 +1127,9 @@ private:
                 cache->template Write<BLeaf>(merging_leaf.remote_origin(), merged_leaf, prealloc_leaf_w, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
                 cache->template Write<BNode>(curr.remote_origin(), parent_of_merge, prealloc_node_w, internal::RDMAWriteBehavior::RDMAWriteWithNoAck);
               }
+              release_written(pool, leaf.remote_origin());
+              release_written(pool, merging_leaf.remote_origin());
+              release_written(pool, curr.remote_origin());
               return leaf;
             } else {
               REMUS_ASSERT(false, "Unreachable");
@@ -1077,8 +1148,9 @@ private:
   }
 
 public:
-  ShermanBPTree(Peer& self, Cache* cache, Index* index, capability* pool, EBRLeaf* leaf, EBRNode* node, bool print_info = false) 
-  : self_(std::move(self)), cache(cache), index(index), ebr_leaf(leaf), ebr_node(node) {
+  /// @param locks a lock table shared by the node's threads, so locking a node doesn't invalidate it in every cache (nullptr to lock the nodes in their version words)
+  ShermanBPTree(Peer& self, Cache* cache, Index* index, capability* pool, EBRLeaf* leaf, EBRNode* node, bool print_info = false, Locks* locks = nullptr) 
+  : self_(std::move(self)), cache(cache), index(index), ebr_leaf(leaf), ebr_node(node), locks(locks) {
     if (print_info){
       REMUS_INFO("Sentinel = {}", SENTINEL);
       REMUS_INFO("Struct Memory (BNode): {} % 64 = {}", sizeof(BNode), sizeof(BNode) % 64);
@@ -1201,6 +1273,43 @@ public:
     return prev_value;
   }
 
+  /// @brief Visit the keys in [lo, hi] in order. Descends once and then follows the leaves to the right
+  /// Each leaf is read whole (a torn read is re-read). Like count, it isn't linearizable with concurrent updates
+  /// @param pool the capability providing one-sided RDMA
+  /// @param lo the lowest key to visit
+  /// @param hi the highest key to visit
+  /// @param visit called with each key and value
+  /// @return the number of keys visited
+  int scan(capability* pool, K lo, K hi, function<void(K, V)> visit) {
+    int visited = 0;
+    K from = lo; // the lowest key we haven't covered yet
+    CachedObject<BLeaf> leaf = traverse(pool, from, false, function([=](BLeaf*, int){}));
+    while(true){
+      int bucket = search_node<BLeaf>(leaf, from);
+      for(int i = bucket; i != -1 && i < SIZE && leaf->key_at(i) != SENTINEL && leaf->key_at(i) <= hi; i++){
+        visit(leaf->key_at(i), leaf->value_at(i));
+        visited++;
+      }
+      if (leaf->key_high() >= hi || leaf->get_next() == nullptr) break;
+      from = leaf->key_high() + 1;
+      leaf = reliable_read<BLeaf>(leaf->get_next(), IGNORE_LOCK, prealloc_leaf_r2);
+      // the next leaf was merged away or a concurrent merge moved from behind us, find its leaf again
+      if (!leaf->key_in_range(from)) leaf = traverse(pool, from, false, function([=](BLeaf*, int){}));
+    }
+    ebr_leaf->match_version(pool);
+    return visited;
+  }
+
+  /// @brief The keys and values in [lo, hi] in order
+  /// @param pool the capability providing one-sided RDMA
+  /// @param lo the lowest key
+  /// @param hi the highest key
+  std::vector<std::pair<K, V>> scan(capability* pool, K lo, K hi) {
+    std::vector<std::pair<K, V>> pairs;
+    scan(pool, lo, hi, function([&](K key, V value){ pairs.push_back({key, value}); }));
+    return pairs;
+  }
+
   /// @brief Populate only works when we have numerical keys. Will add data
   /// @param pool the capability providing one-sided RDMA
   /// @param op_count the number of values to insert. Recommended in total to do key_range / 2
@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <barrier>
 #include <cstdint>
 #include <protos/workloaddriver.pb.h>
+#include <random>
 #include <remus/logging/logging.h>
 #include <remus/util/cli.h>
 #include <remus/util/tcp/tcp.h>
@@ -21,9 +23,24 @@
 using namespace remus::util;
 using namespace remus::rdma;
 
-typedef RdmaIHT<int, int, CNF_ELIST_SIZE, CNF_PLIST_SIZE> KVStore;
+/// The clients run on an int key space with int values. The keys are made into K with key_hash::from_int and the values are cast
+template <class V>
+inline optional<int> as_client(std::optional<V> value){
+    if (!value.has_value()) return std::nullopt;
+    return (int) value.value();
+}
+
+template <class V>
+inline vector<optional<int>> as_client(const vector<std::optional<V>>& values){
+    vector<optional<int>> result;
+    result.reserve(values.size());
+    for(const std::optional<V>& value : values) result.push_back(as_client(value));
+    return result;
+}
 
-inline void iht_run(BenchmarkParams& params, rdma_capability* capability, RemoteCache* cache, Peer& host, Peer& self){
+template <class K, class V, class Hash>
+inline void iht_run_keyed(BenchmarkParams& params, rdma_capability* capability, RemoteCache* cache, Peer& host, Peer& self, std::vector<Peer> peers){
+    using KVStore = RdmaIHT<K, V, CNF_ELIST_SIZE, CNF_PLIST_SIZE, Hash>;
     // Create a list of client and server  threads
     std::vector<std::thread> threads;
     if (params.node_id == 0){
@@ -35,11 +52,24 @@ inline void iht_run(BenchmarkParams& params, rdma_capability* capability, Remote
 
             // Collect and redistribute the CacheStore pointers
             collect_distribute(socket_handle, params);
+            // Collect and redistribute the EList inbox pointers
+            collect_distribute(socket_handle, params);
+            // Collect and redistribute the EList placement pointers
+            collect_distribute(socket_handle, params);
 
             // Create a root ptr to the IHT
             Peer p = Peer();
-            KVStore iht = KVStore(p, CacheDepth::None, nullptr, pool);
-            rdma_ptr<anon_ptr> root_ptr = iht.InitAsFirst(pool);
+            rdma_ptr<anon_ptr> root_ptr;
+            if (params.bulk_load){
+                // Load half of the key range (the same as the clients would populate). The PLists are marked for the clients' cache depth
+                KVStore iht = KVStore(p, params.cache_depth, nullptr, pool);
+                std::vector<std::pair<K, V>> pairs = bulk_pairs<K, V>(params);
+                root_ptr = iht.InitFromBulk(pool, pairs);
+                REMUS_INFO("[SERVER THREAD] -- Bulk-loaded {} keys", pairs.size());
+            } else {
+                KVStore iht = KVStore(p, CacheDepth::None, nullptr, pool);
+                root_ptr = iht.InitAsFirst(pool);
+            }
             // Send the root pointer over
             tcp::message ptr_message = tcp::message(root_ptr.raw());
             socket_handle->send_to_all(&ptr_message);
@@ -68,6 +98,20 @@ inline void iht_run(BenchmarkParams& params, rdma_capability* capability, Remote
     // If the endpoint cant connect, it will just wait and retry later
     std::this_thread::sleep_for(std::chrono::milliseconds(10));
 
+    /// Create the reclamation of rehashed ELists
+    auto ebr_pool = capability->RegisterThread();
+    typename KVStore::EBR* ebr = new typename KVStore::EBR(ebr_pool, params.thread_count);
+    ebr->Init(capability, self.id, peers);
+    typename KVStore::Inbox* inbox = new typename KVStore::Inbox(ebr_pool);
+    /// Create the placement of new ELists
+    std::vector<uint16_t> nodes;
+    for(Peer& p : peers) nodes.push_back(p.id);
+    typename KVStore::Placer* placer = new typename KVStore::Placer(ebr_pool, Placement::from_string(params.placement), self.id, nodes);
+    /// Choose the cached PLists by access frequency (shared by the threads, like the cache)
+    typename KVStore::Admission* admission = params.cache_budget > 0 ? new typename KVStore::Admission(params.cache_budget) : nullptr;
+
+    /// The root of the structure the clients run on (to key the cache snapshot to it)
+    uint64_t structure_root = 0;
     // Barrier to start all the clients at the same time
     std::barrier client_sync = std::barrier(params.thread_count);
     WorkloadDriverResult workload_results[params.thread_count];
@@ -76,6 +120,7 @@ inline void iht_run(BenchmarkParams& params, rdma_capability* capability, Remote
             // Get pool
             rdma_capability_thread* pool = capability->RegisterThread();
             tcp::EndpointManager* endpoint = endpoint_managers[thread_index];
+            ebr->RegisterThread();
 
             // initialize thread's thread_local pool
             RemoteCache::pool = pool; 
@@ -86,10 +131,26 @@ inline void iht_run(BenchmarkParams& params, rdma_capability* capability, Remote
             }));
             cache->init(peer_roots, params.node_count - 1);
 
-            std::shared_ptr<KVStore> iht = std::make_shared<KVStore>(self, params.cache_depth, cache, pool);
+            // Exchange the inboxes that reclaimed ELists are returned to
+            vector<uint64_t> peer_inboxes;
+            map_reduce(endpoint, params, inbox->root(), std::function<void(uint64_t)>([&](uint64_t data){
+                peer_inboxes.push_back(data);
+            }));
+            inbox->init(peer_inboxes);
+
+            // Exchange the depots and access counts that ELists are placed with
+            vector<uint64_t> peer_placements;
+            map_reduce(endpoint, params, placer->root(), std::function<void(uint64_t)>([&](uint64_t data){
+                peer_placements.push_back(data);
+            }));
+            placer->init(peer_placements);
+            placer->refill(pool);
+
+            std::shared_ptr<KVStore> iht = std::make_shared<KVStore>(self, params.cache_depth, cache, pool, ebr, inbox, placer, admission);
             // Get the data from the server to init the IHT
             tcp::message ptr_message;
             endpoint->recv_server(&ptr_message);
+            if (thread_index == 0) structure_root = ptr_message.get_first();
             iht->InitFromPointer(rdma_ptr<anon_ptr>(ptr_message.get_first()));
 
             REMUS_DEBUG("Creating client");
@@ -104,26 +165,50 @@ inline void iht_run(BenchmarkParams& params, rdma_capability* capability, Remote
                         }
                         // capability->RegisterThread();
                         ExperimentManager::ClientArriveBarrier(endpoint);
-                        delta += iht->populate(pool, param1, param2, param3, [=](int key){ return key; });
+                        if (!params.bulk_load){
+                            delta += iht->populate(pool, param1, param2, param3, [=](int key){ return (V) key; });
+                        } else if (params.node_id == 0 && thread_index == 0){
+                            // account for the bulk-load once
+                            delta += bulk_pairs<K, V>(params).size();
+                        }
                         ExperimentManager::ClientArriveBarrier(endpoint);
+                        if (params.cache_snapshot){
+                            // warm up with the lines saved by the last run of this structure (split across the threads)
+                            cache->prefetch_lines("cache_lines_" + std::to_string(params.node_id) + ".txt", ptr_message.get_first(), thread_index, params.thread_count);
+                        }
                         populate_amount = iht->count(pool);
                         ExperimentManager::ClientArriveBarrier(endpoint);
                         cache->print_metrics();
                         cache->reset_metrics();
                     } else if (code == Get){
-                        return iht->contains(pool, param1);
+                        return as_client(iht->contains(pool, key_hash::from_int<K>(param1)));
                     } else if (code == Remove){
-                        auto res = iht->remove(pool, param1);
+                        auto res = iht->remove(pool, key_hash::from_int<K>(param1));
                         if (res != std::nullopt) delta--;
-                        return res;
+                        return as_client(res);
                     } else if (code == Insert){
-                        auto res = iht->insert(pool, param1, param2);
+                        auto res = iht->insert(pool, key_hash::from_int<K>(param1), (V) param2);
                         if (res == std::nullopt) delta++;
-                        return res;
+                        return as_client(res);
                     } else {
                         REMUS_WARN("No valid code");
                     }
                     return optional<int>();
+                },
+                [&](MapCodes code, const vector<int>& keys, const vector<int>& values){
+                    vector<K> iht_keys;
+                    for(int k : keys) iht_keys.push_back(key_hash::from_int<K>(k));
+                    if (code == Get){
+                        return as_client(iht->multi_contains(pool, iht_keys));
+                    } else if (code == Insert){
+                        vector<V> iht_values = vector<V>(values.begin(), values.end());
+                        auto res = iht->multi_insert(pool, iht_keys, iht_values);
+                        for (auto& r : res) if (r == std::nullopt) delta++;
+                        return as_client(res);
+                    } else {
+                        REMUS_WARN("No valid code");
+                    }
+                    return vector<optional<int>>();
                 }
             );
             using client_t = Client<Map_Op<int, int>>;
@@ -162,11 +247,43 @@ inline void iht_run(BenchmarkParams& params, rdma_capability* capability, Remote
         t->join();
     }
     delete_endpoints(endpoint_managers, params);
+    if (params.cache_snapshot) cache->dump_lines("cache_lines_" + std::to_string(params.node_id) + ".txt", structure_root);
 
     save_result("iht_result.csv", workload_results, params, params.thread_count);
 }
 
+template <class K, class V>
+inline void iht_run_hashed(BenchmarkParams& params, rdma_capability* capability, RemoteCache* cache, Peer& host, Peer& self, std::vector<Peer> peers){
+    if (params.hash == key_hash::Mix13Hash::name){
+        iht_run_keyed<K, V, key_hash::Mix13Hash>(params, capability, cache, host, self, peers);
+    } else if (params.hash == key_hash::WyHash::name){
+        iht_run_keyed<K, V, key_hash::WyHash>(params, capability, cache, host, self, peers);
+    } else if (params.hash == key_hash::Crc32cHash::name){
+        iht_run_keyed<K, V, key_hash::Crc32cHash>(params, capability, cache, host, self, peers);
+    } else {
+        REMUS_FATAL("Unknown hash {} (mix13, wyhash, crc32c)", params.hash);
+    }
+}
+
+/// Run the iht with the key size and hash from the params. Binary keys are paired with 64-bit values
+inline void iht_run(BenchmarkParams& params, rdma_capability* capability, RemoteCache* cache, Peer& host, Peer& self, std::vector<Peer> peers){
+    switch (params.key_size) {
+    case 4:
+        iht_run_hashed<int, int>(params, capability, cache, host, self, peers);
+        break;
+    case 16:
+        iht_run_hashed<key_hash::FixedKey<16>, uint64_t>(params, capability, cache, host, self, peers);
+        break;
+    case 32:
+        iht_run_hashed<key_hash::FixedKey<32>, uint64_t>(params, capability, cache, host, self, peers);
+        break;
+    default:
+        REMUS_FATAL("Unsupported key size {} (4, 16, 32)", params.key_size);
+    }
+}
+
 inline void bulk_time(BenchmarkParams& params, rdma_capability* capability, RemoteCache* cache, Peer& host, Peer& self){
+    using KVStore = RdmaIHT<int, int, CNF_ELIST_SIZE, CNF_PLIST_SIZE>;
     // Get pool
     rdma_capability_thread* pool = capability->RegisterThread();
     // initialize thread's thread_local pool
@@ -69,6 +69,9 @@ inline void iht2_run(BenchmarkParams& params, rdma_capability* capability, Remot
     // If the endpoint cant connect, it will just wait and retry later
     std::this_thread::sleep_for(std::chrono::milliseconds(10));
 
+    // The calcified PLists cached by the threads of this node
+    KVStoreTuned::PListCache* plist_cache = new KVStoreTuned::PListCache(1 << 16);
+
     // Barrier to start all the clients at the same time
     std::barrier client_sync = std::barrier(params.thread_count);
     WorkloadDriverResult workload_results[params.thread_count];
@@ -87,7 +90,7 @@ inline void iht2_run(BenchmarkParams& params, rdma_capability* capability, Remot
             // }));
             // cache->init(peer_roots, params.node_count - 1);
 
-            std::shared_ptr<KVStoreTuned> iht = std::make_shared<KVStoreTuned>(self, params.cache_depth, pool);
+            std::shared_ptr<KVStoreTuned> iht = std::make_shared<KVStoreTuned>(self, params.cache_depth, pool, plist_cache);
             // Get the data from the server to init the IHT
             tcp::message ptr_message;
             endpoint->recv_server(&ptr_message);
@@ -159,6 +162,7 @@ inline void iht2_run(BenchmarkParams& params, rdma_capability* capability, Remot
         t->join();
     }
     delete_endpoints(endpoint_managers, params);
+    delete plist_cache;
 
     save_result("iht_tuned_result.csv", workload_results, params, params.thread_count);
 }
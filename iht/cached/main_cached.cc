@@ -34,7 +34,20 @@ auto ARGS = {
     I64_ARG("--key_lb", "The lower limit of the key range for operations"),
     I64_ARG("--key_ub", "The upper limit of the key range for operations"),
     I64_ARG_OPT("--cache_depth", "The depth of the cache for the data structure", 0),
+    I64_ARG_OPT("--cache_replicas", "The number of replicas of the cache in the process (one per NUMA node)", 1),
+    BOOL_ARG_OPT("--cache_snapshot", "If the cache should prefetch the hot lines saved by the last run on the same structure, and save them at the end"),
+    I64_ARG_OPT("--batch_size", "How many contains and inserts to batch into one multi-key operation (only for the iht). The clients log the latency of the batched operations", 1),
+    BOOL_ARG_OPT("--bulk_load", "If the iht or btree should be bulk-loaded before the clients start, instead of populated by them"),
+    I64_ARG_OPT("--key_size", "The size of the keys in bytes: 4 (int), 16 or 32 (binary keys with 64-bit values). Only for the iht", 4),
+    STR_ARG_OPT("--hash", "The hash of the keys: mix13, wyhash or crc32c (only for the iht)", "mix13"),
+    I64_ARG_OPT("--cache_budget", "How many bytes of PLists to cache, chosen by access frequency with the cache depth as the ceiling (0 caches every PList up to the depth). Only for the iht", 0),
+    BOOL_ARG_OPT("--lock_table", "If the node locks of the btree and sherman are kept in a hashed lock table in each node's memory, instead of in the (cached) nodes"),
+    STR_ARG_OPT("--node_layout", "How the btree's nodes are laid out and checked for torn reads: line (a version per cache line), checksum (crc32c) or header_footer", "line"),
+    BOOL_ARG_OPT("--leaf_deltas", "If the btree appends small inserts and removes to its leaves as delta records, rewriting a leaf only once its records are full"),
+    I64_ARG_OPT("--index_cache_mb", "How many MB sherman's index cache of inner nodes can use (to compare with the RemoteCache at equal memory)", 1000),
+    STR_ARG_OPT("--placement", "Which node new ELists are placed on: local, home, round_robin or accessor (only for the iht)", "local"),
     STR_ARG("--structure", "The type of data structure to benchmark"), // rdmask, btree, iht
+    I64_ARG_OPT("--degree", "The degree of the btree's nodes: 4, 8, 12, 16, 32 or 64 (only for the btree and sherman)", 12),
     STR_ARG("--distribution", "The distribution of operations"), // uniform, skew90, skew95, skew99
 };
 
@@ -66,6 +79,18 @@ int main(int argc, char **argv) {
 
     // Extract the args to variables
     BenchmarkParams params = BenchmarkParams(args);
+    params.cache_snapshot = args.bget("--cache_snapshot");
+    params.batch_size = args.iget("--batch_size");
+    params.placement = args.sget("--placement");
+    params.bulk_load = args.bget("--bulk_load");
+    params.key_size = args.iget("--key_size");
+    params.hash = args.sget("--hash");
+    params.cache_budget = args.iget("--cache_budget");
+    params.lock_table = args.bget("--lock_table");
+    params.node_layout = args.sget("--node_layout");
+    params.leaf_deltas = args.bget("--leaf_deltas");
+    params.degree = args.iget("--degree");
+    params.index_cache_mb = args.iget("--index_cache_mb");
     REMUS_INFO("Running {} with cache depth {}", params.structure, params.cache_depth);
 
     // Check node count
@@ -104,9 +129,11 @@ int main(int argc, char **argv) {
 
     // Create our remote cache (can initialize the cache space with any pool)
     auto pool = capability->RegisterThread();
-    RemoteCache* cache = new RemoteCache(pool, self.id, 10000);
+    CacheOptions cache_options;
+    cache_options.replicas = args.iget("--cache_replicas");
+    RemoteCache* cache = new RemoteCache(pool, self.id, 10000, cache_options);
     if (params.structure == "iht"){
-        iht_run(params, capability, cache, host, self);
+        iht_run(params, capability, cache, host, self, peers);
     } else if (params.structure == "iht_tmp"){
         bulk_time(params, capability, cache, host, self);
     } else if (params.structure == "iht_tuned"){
@@ -337,33 +337,16 @@ public:
     }
 
     void* get(int key, int* accesses){
-        int bottomLevel = 0;
-        bool marked = false;
-        Node* pred = head;
-        Node* curr = nullptr;
-        Node* succ = nullptr;
-        for(int level = MAX_LEVEL - 1; level >= bottomLevel; level--){
-            curr = Unmark(pred->next[level].load());
-            while(true){
-                succ = IsMarked(curr->next[level].load(), &marked);
-                while(marked){
-                    curr = Unmark(pred->next[level].load());
-                    succ = IsMarked(curr->next[level].load(), &marked);
-                }
-                if (curr->is_less_than(key)){
-                    pred = curr;
-                    curr = succ;
-                } else {
-                    break;
-                }
-            }
-        }
-        if (curr->is_equal(key)){
-            if (accesses != nullptr){
-                *accesses = curr->accesses.fetch_add(1);
-            }
+        // find unlinks the removed nodes on the way. Waiting for their remover to unlink them can spin forever
+        // (i.e. a node marked after an insert linked it at a level the remover already passed)
+        Node* preds[MAX_LEVEL];
+        Node* succs[MAX_LEVEL];
+        bool found = find(key, key + 1, preds, succs);
+        Node* curr = succs[0];
+        if (found && accesses != nullptr){
+            *accesses = curr->accesses.fetch_add(1);
         }
-        void* result = curr->is_equal(key) ? curr->value : nullptr;
+        void* result = found ? curr->value : nullptr;
         local_ebr->match_version();
         return result;
     }
@@ -1,6 +1,12 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <remus/logging/logging.h>
 #include <remus/rdma/rdma.h>
 // #include "random.h"
 #include "skiplist_api.h"
@@ -52,62 +58,189 @@ static inline unsigned long long asm_rdtsc(void) {
 
 inline void compiler_barrier() { asm volatile("" ::: "memory"); }
 
+/// The behavior of an IndexCache, counted per thread (like CacheMetrics)
+struct IndexCacheMetrics {
+  /// found a cached inner node covering the key
+  int hits;
+  /// no cached inner node covered the key
+  int misses;
+  /// cached an inner node
+  int adds;
+  /// couldn't cache an inner node, because its range was cached or no slot was free
+  int rejected_adds;
+  /// evicted a cached inner node to make room
+  int evictions;
+  /// invalidated a cached inner node (i.e. it was stale)
+  int invalidations;
+
+  IndexCacheMetrics(){
+    hits = 0;
+    misses = 0;
+    adds = 0;
+    rejected_adds = 0;
+    evictions = 0;
+    invalidations = 0;
+  }
+
+  std::string as_string() {
+    std::string ss = "";
+    ss += "<IndexMetrics>\n";
+    ss += "  <Hits = " + std::to_string(hits) + "/>\n";
+    ss += "  <Misses = " + std::to_string(misses) + "/>\n";
+    ss += "  <Adds = " + std::to_string(adds) + "/>\n";
+    ss += "  <RejectedAdds = " + std::to_string(rejected_adds) + "/>\n";
+    ss += "  <Evictions = " + std::to_string(evictions) + "/>\n";
+    ss += "  <Invalidations = " + std::to_string(invalidations) + "/>\n";
+    ss += "</IndexMetrics>\n";
+    return ss;
+  }
+};
+
+/// Sherman's index cache of inner nodes, by key range
+/// - slab: the copies of the nodes, preallocated for the budget. An entry costs a copy and a skiplist node, so the budget bounds both
+///   (and comparing with a RemoteCache of the same size is fair). An evicted slot is reused right away, a reader detects it by the slot's version (a seqlock)
+/// - clock: a hand sweeps the used slots, halving the access frequency of every slot it passes, and evicts the least frequently used slot of a window (clock/LFU)
 template <class T, int DEGREE, typename Key>
 class IndexCache {
 private:
   // using CacheSkipList = SkipList<T>;
   using CacheSkipList = LockFreeSkiplist;
   static const int SIZE = (DEGREE * 2) + 1;
+  /// How many used slots the clock hand looks at to pick a victim
+  static const int EVICT_WINDOW = 8;
+  /// The access frequency saturates, so a hot slot is demoted after a few sweeps
+  static const uint32_t MAX_FREQ = 255;
+
+  struct slot_meta {
+    std::atomic<uint32_t> freq;
+    std::atomic<uint32_t> version; // odd while the copy is written
+    std::atomic<bool> used; // the slot's copy is (or is about to be) in the skiplist
+  };
+
   uint64_t cache_size; // MB;
-  std::atomic<int64_t> skiplist_room_entries;
-  std::atomic<int64_t> skiplist_success_adds;
   int64_t all_page_cnt;
-  LocalEBR<T, 1000>* local_ebr;
+  T* slab;
+  slot_meta* meta;
+  std::atomic<int64_t> next_slot; // slots past it were never used
+  std::atomic<int64_t> clock_hand;
+  std::atomic<int64_t> cached; // for the statistics
+  std::atomic<int64_t> success_adds;
 
   WRLock free_lock;
+  std::vector<T*> free_slots;
 
   // SkipList
   CacheSkipList *skiplist;
 
-  void evict_one(){
-    uint64_t freq1, freq2;
-    auto e1 = get_a_random_entry(freq1);
-    auto e2 = get_a_random_entry(freq2);
+  static inline thread_local IndexCacheMetrics metrics;
 
-    if (freq1 < freq2) {
-      invalidate(e1);
-    } else {
-      invalidate(e2);
+  inline slot_meta& meta_of(const T* page){
+    return meta[page - slab];
+  }
+
+  /// Get a free slot: a never used one or an evicted one. Returns nullptr if there is none
+  T* allocate_slot(){
+    if (next_slot.load(std::memory_order_relaxed) < all_page_cnt){
+      int64_t s = next_slot.fetch_add(1, std::memory_order_relaxed);
+      if (s < all_page_cnt) return &slab[s];
+    }
+    T* page = nullptr;
+    free_lock.wLock();
+    if (!free_slots.empty()){
+      page = free_slots.back();
+      free_slots.pop_back();
     }
+    free_lock.wUnlock();
+    return page;
+  }
+
+  /// Evict the least frequently used slot in a window of the clock. Returns false if there was no used slot to evict
+  bool evict_one(){
+    int64_t used_slots = std::min(next_slot.load(std::memory_order_relaxed), all_page_cnt);
+    if (used_slots == 0) return false;
+    T* victim = nullptr;
+    uint32_t victim_freq = UINT32_MAX;
+    int seen = 0;
+    for(int64_t i = 0; i < used_slots && seen < EVICT_WINDOW; i++){
+      int64_t s = clock_hand.fetch_add(1, std::memory_order_relaxed) % used_slots;
+      if (!meta[s].used.load(std::memory_order_relaxed)) continue;
+      seen++;
+      uint32_t freq = meta[s].freq.load(std::memory_order_relaxed);
+      meta[s].freq.store(freq / 2, std::memory_order_relaxed); // age as the hand passes
+      if (freq < victim_freq) {
+        victim = &slab[s];
+        victim_freq = freq;
+        if (freq == 0) break;
+      }
+    }
+    if (victim == nullptr) return false;
+    if (invalidate(victim)) metrics.evictions++;
+    return true;
+  }
+
+  void free_slot(T* page){
+    meta_of(page).used.store(false, std::memory_order_relaxed);
+    free_lock.wLock();
+    free_slots.push_back(page);
+    free_lock.wUnlock();
+  }
+
+  /// Free a slot that was removed from the skiplist
+  void release_slot(T* page){
+    cached.fetch_sub(1, std::memory_order_relaxed);
+    free_slot(page);
   }
+
 public:
   IndexCache(int cache_size, int thread_count) : cache_size(cache_size) {
     uint64_t memory_size = define::MB * cache_size;
     skiplist = new CacheSkipList(thread_count);
-    all_page_cnt = memory_size / sizeof(T);
-    REMUS_INFO("!CHECKME! {} {} {}", memory_size, sizeof(T), all_page_cnt);
-    skiplist_room_entries.store(all_page_cnt);
-    skiplist_success_adds.store(0);
-    local_ebr = new LocalEBR<T, 1000>(thread_count);
+    all_page_cnt = memory_size / (sizeof(T) + sizeof(Node) + sizeof(slot_meta));
+    REMUS_INFO("Index cache of {} MB holds {} nodes of {} bytes", cache_size, all_page_cnt, sizeof(T));
+    // the pages of the slab are only touched once used
+    slab = (T*) malloc(sizeof(T) * all_page_cnt);
+    meta = new slot_meta[all_page_cnt];
+    for(int64_t i = 0; i < all_page_cnt; i++){
+      meta[i].freq.store(0, std::memory_order_relaxed);
+      meta[i].version.store(0, std::memory_order_relaxed);
+      meta[i].used.store(false, std::memory_order_relaxed);
+    }
+    next_slot.store(0);
+    clock_hand.store(0);
+    cached.store(0);
+    success_adds.store(0);
   }
 
   ~IndexCache(){
     delete skiplist;
+    delete[] meta;
+    free(slab);
   }
 
   bool add_to_cache(const T* page){
-    T* data = (T*) malloc(sizeof(T));
+    T* data = allocate_slot();
+    if (data == nullptr && evict_one()) data = allocate_slot();
+    if (data == nullptr) {
+      // another thread took the evicted slot
+      metrics.rejected_adds++;
+      return false;
+    }
+    slot_meta& m = meta_of(data);
+    m.version.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
     *data = *page;
+    m.version.fetch_add(1, std::memory_order_release);
+    m.freq.store(1, std::memory_order_relaxed);
+    m.used.store(true, std::memory_order_relaxed);
     if (add_entry(page->key_low(), page->key_high(), data)) {
-      skiplist_success_adds.fetch_add(1);
-      auto v = skiplist_room_entries.fetch_sub(1);
-      if (v <= 0) {
-        evict_one();
-      }
-      local_ebr->match_version();
+      cached.fetch_add(1, std::memory_order_relaxed);
+      success_adds.fetch_add(1, std::memory_order_relaxed);
+      metrics.adds++;
       return true;
     }
-    local_ebr->match_version();
+    // never published, so the slot is free again
+    free_slot(data);
+    metrics.rejected_adds++;
     return false;
   }
 
@@ -115,26 +248,37 @@ public:
     int accesses = -1;
     T* page = find_entry(k, &accesses);
     if (accesses == -1 || page == nullptr) {
-      local_ebr->match_version();
+      metrics.misses++;
       return false;
     }
-    if (!page->key_in_range(k)) {
-      local_ebr->match_version();
+    // the slot might be evicted and reused while we read it, so check its version didn't change
+    slot_meta& m = meta_of(page);
+    uint32_t version = m.version.load(std::memory_order_acquire);
+    if ((version & 1) != 0 || !page->key_in_range(k)) {
+      metrics.misses++;
       return false;
     }
 
     bool find = false;
+    rdma_ptr<T> found;
     for (int i = 0; i < SIZE; ++i) {
       if (k <= page->key_at(i)) {
         find = true;
-        *addr = page->ptr_at(i);
+        found = page->ptr_at(i);
         break;
       }
     }
     if (!find) {
-      *addr = page->ptr_at(SIZE);
+      found = page->ptr_at(SIZE);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (m.version.load(std::memory_order_relaxed) != version) {
+      metrics.misses++;
+      return false;
     }
-    local_ebr->match_version();
+    *addr = found;
+    if (m.freq.load(std::memory_order_relaxed) < MAX_FREQ) m.freq.fetch_add(1, std::memory_order_relaxed);
+    metrics.hits++;
     return true;
   }
 
@@ -142,18 +286,6 @@ public:
     return skiplist->insert(from, to, data);
   }
 
-  T* get_a_random_entry(uint64_t &freq){
-    uint32_t seed = asm_rdtsc();
-  retry:
-    auto k = rand_r(&seed) % (1000ull * define::MB);
-    int accesses = -1;
-    T* page = find_entry(k, &accesses);
-    if (accesses == -1 || page == nullptr) goto retry;
-  
-    freq = accesses;
-    return page;
-  }
-
   /// Return data or nullptr
   T* find_entry(const Key &k, int* accesses){
     void* data = skiplist->get(k, accesses);
@@ -168,8 +300,8 @@ public:
   bool invalidate(const Key& key) {
     void* result = skiplist->remove(key, key);
     if (result != nullptr) {
-      skiplist_room_entries.fetch_add(1);
-      local_ebr->deallocate((T*) result);
+      metrics.invalidations++;
+      release_slot((T*) result);
     }
     return result;
   }
@@ -177,18 +309,30 @@ public:
   bool invalidate(T* data) {
     void* result = skiplist->remove(data->key_low(), data->key_high());
     if (result != nullptr) {
-      skiplist_room_entries.fetch_add(1);
-      local_ebr->deallocate((T*) result);
+      release_slot((T*) result);
     }
     return result;
   }
 
+  /// Print the thread's metrics
+  void print_metrics(){
+    REMUS_INFO("{}", metrics.as_string());
+  }
+
+  void reset_metrics(){
+    metrics = IndexCacheMetrics();
+  }
+
+  IndexCacheMetrics get_metrics(){
+    return metrics;
+  }
+
   void statistics(){
     long number_of_nodes = skiplist->count();
-    int per_node = sizeof(skiplist_node) + sizeof(T) + sizeof(int) * 3;
+    int per_node = sizeof(Node) + sizeof(T) + sizeof(slot_meta);
     REMUS_INFO("!CHECKME! sizeof(for each entry) {}", per_node);
-    printf("[skiplist adds: %ld]  [skiplist load: %ld] [count: %ld] [size: %ld KB]\n", skiplist_success_adds.load(), 
-      all_page_cnt - skiplist_room_entries.load(), number_of_nodes, number_of_nodes * per_node / 1000);
+    printf("[skiplist adds: %ld]  [skiplist load: %ld/%ld] [count: %ld] [size: %ld KB]\n", success_adds.load(), 
+      cached.load(), all_page_cnt, number_of_nodes, number_of_nodes * per_node / 1000);
   }
 
   void bench(){
@@ -201,4 +345,4 @@ public:
     }
     t.end_print(loop);
   }
-};
\ No newline at end of file
+};
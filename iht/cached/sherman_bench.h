@@ -26,10 +26,11 @@
 using namespace remus::util;
 using namespace remus::rdma;
 
-inline void sherman_run(BenchmarkParams& params, rdma_capability* capability, RemoteCache* cache, Peer& host, Peer& self, std::vector<Peer> peers){
-    using BTree = ShermanBPTree<int, 12, rdma_capability_thread>; // todo: increment size more?
-    using Cache = IndexCache<BTree::BNode, 12, int>;
-    Cache* index = new Cache(1000, params.thread_count); // just like in sherman
+template <int DEGREE>
+inline void sherman_run_degree(BenchmarkParams& params, rdma_capability* capability, RemoteCache* cache, Peer& host, Peer& self, std::vector<Peer> peers){
+    using BTree = ShermanBPTree<int, DEGREE, rdma_capability_thread>;
+    using Cache = IndexCache<typename BTree::BNode, DEGREE, int>;
+    Cache* index = new Cache(params.index_cache_mb, params.thread_count); // just like in sherman
 
     // Create a list of client and server  threads
     std::vector<std::thread> threads;
@@ -42,6 +43,10 @@ inline void sherman_run(BenchmarkParams& params, rdma_capability* capability, Re
 
             // Collect and redistribute the CacheStore pointers
             collect_distribute(socket_handle, params);
+            if (params.lock_table){
+                // Collect and redistribute the lock table pointers
+                collect_distribute(socket_handle, params);
+            }
 
             // Create a root ptr to the IHT
             Peer p = Peer();
@@ -76,8 +81,8 @@ inline void sherman_run(BenchmarkParams& params, rdma_capability* capability, Re
     std::this_thread::sleep_for(std::chrono::milliseconds(10));
 
     /// Create an ebr object
-    using EBRLeaf = EBRObjectPool<BTree::BLeaf, 100, rdma_capability_thread>;
-    using EBRNode = EBRObjectPoolAccompany<BTree::BNode, BTree::BLeaf, 100, rdma_capability_thread>;
+    using EBRLeaf = EBRObjectPool<typename BTree::BLeaf, 100, rdma_capability_thread>;
+    using EBRNode = EBRObjectPoolAccompany<typename BTree::BNode, typename BTree::BLeaf, 100, rdma_capability_thread>;
     auto ebr_pool = capability->RegisterThread();
     EBRLeaf* ebr_leaf = new EBRLeaf(ebr_pool, params.thread_count);
     for(int i = 0; i < peers.size(); i++){
@@ -86,6 +91,8 @@ inline void sherman_run(BenchmarkParams& params, rdma_capability* capability, Re
     ebr_leaf->Init(capability, self.id, peers);
     REMUS_INFO("Init ebr");
     EBRNode* ebr_node = new EBRNode(ebr_leaf);
+    /// Create the table of the node locks (shared by the threads, like the cache)
+    LockTable<rdma_capability_thread>* locks = params.lock_table ? new LockTable<rdma_capability_thread>(ebr_pool) : nullptr;
 
     // Barrier to start all the clients at the same time
     std::barrier client_sync = std::barrier(params.thread_count);
@@ -107,7 +114,16 @@ inline void sherman_run(BenchmarkParams& params, rdma_capability* capability, Re
             }));
             cache->init(peer_roots, params.node_count - 1);
 
-            std::shared_ptr<BTree> btree = std::make_shared<BTree>(self, cache, index, pool, ebr_leaf, ebr_node);
+            if (locks != nullptr){
+                // Exchange the lock tables of the node locks
+                vector<uint64_t> peer_locks;
+                map_reduce(endpoint, params, locks->root(), std::function<void(uint64_t)>([&](uint64_t data){
+                    peer_locks.push_back(data);
+                }));
+                locks->init(peer_locks);
+            }
+
+            std::shared_ptr<BTree> btree = std::make_shared<BTree>(self, cache, index, pool, ebr_leaf, ebr_node, false, locks);
             // Get the data from the server to init the btree
             tcp::message ptr_message;
             endpoint->recv_server(&ptr_message);
@@ -132,6 +148,7 @@ inline void sherman_run(BenchmarkParams& params, rdma_capability* capability, Re
                         ExperimentManager::ClientArriveBarrier(endpoint);
                         cache->print_metrics();
                         cache->reset_metrics();
+                        index->reset_metrics();
                     } else if (code == Get){
                         return btree->contains(pool, param1);
                     } else if (code == Remove){
@@ -156,6 +173,7 @@ inline void sherman_run(BenchmarkParams& params, rdma_capability* capability, Re
             StatusVal<WorkloadDriverResult> output = client_t::Run(std::move(client), thread_index, populate_frac);
             REMUS_ASSERT(output.status.t == StatusType::Ok && output.val.has_value(), "Client run failed");
             workload_results[thread_index] = output.val.value();
+            index->print_metrics();
 
             // Check expected size
             int all_delta = 0;
@@ -190,6 +208,8 @@ inline void sherman_run(BenchmarkParams& params, rdma_capability* capability, Re
         t->join();
     }
     delete_endpoints(endpoint_managers, params);
+    // every node's clients passed the last barrier, so no peer locks a slot of this table anymore
+    if (locks != nullptr) locks->destroy(ebr_pool);
 
     save_result("sherman_result.csv", workload_results, params, params.thread_count);
     
@@ -197,6 +217,32 @@ inline void sherman_run(BenchmarkParams& params, rdma_capability* capability, Re
     delete index;
 }
 
+/// Run sherman with the degree from the params. Every degree is a precompiled instantiation
+inline void sherman_run(BenchmarkParams& params, rdma_capability* capability, RemoteCache* cache, Peer& host, Peer& self, std::vector<Peer> peers){
+    switch (params.degree) {
+    case 4:
+        sherman_run_degree<4>(params, capability, cache, host, self, peers);
+        break;
+    case 8:
+        sherman_run_degree<8>(params, capability, cache, host, self, peers);
+        break;
+    case 12:
+        sherman_run_degree<12>(params, capability, cache, host, self, peers);
+        break;
+    case 16:
+        sherman_run_degree<16>(params, capability, cache, host, self, peers);
+        break;
+    case 32:
+        sherman_run_degree<32>(params, capability, cache, host, self, peers);
+        break;
+    case 64:
+        sherman_run_degree<64>(params, capability, cache, host, self, peers);
+        break;
+    default:
+        REMUS_FATAL("Unsupported degree {} (4, 8, 12, 16, 32 or 64)", params.degree);
+    }
+}
+
 inline void sherman_run_tmp(BenchmarkParams& params, CountingPool* pool, RemoteCacheImpl<CountingPool>* cache, Peer& host, Peer& self, std::vector<Peer> peers){
     using BTreeLocal = ShermanBPTree<int, 12, CountingPool>; // todo: increment size more?
     using Cache = IndexCache<BTreeLocal::BNode, 12, int>;
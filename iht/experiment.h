@@ -58,6 +58,30 @@ public:
 
     /// The cache depth of the data structure
     CacheDepth::CacheDepth cache_depth;
+    /// If the cache should prefetch the lines saved by the last run and save its lines at the end (only used by the cached benchmarks)
+    bool cache_snapshot = false;
+    /// How many contains and inserts a client batches into one multi-key operation (1 to run them one at a time). Only used by maps with a batch API
+    int batch_size = 1;
+    /// Where new objects of the data structure are placed (local, home, round_robin or accessor). Only used by the iht
+    std::string placement = "local";
+    /// If the data structure is populated with a bulk-load before the clients start, instead of by the clients. Only used by the iht and the btree
+    bool bulk_load = false;
+    /// The size of the keys in bytes (4 for int keys, 16 or 32 for binary keys with 64-bit values). Only used by the iht
+    int key_size = 4;
+    /// The hash of the keys (mix13, wyhash or crc32c). Only used by the iht
+    std::string hash = "mix13";
+    /// How many bytes of PLists the iht keeps in the cache, chosen by access frequency (0 to cache every PList up to the cache depth). Only used by the iht
+    int cache_budget = 0;
+    /// If the node locks are kept in a hashed lock table in each node's memory, instead of in the nodes (so locking doesn't invalidate cached nodes). Only used by the btree and sherman
+    bool lock_table = false;
+    /// The degree of the btree's nodes (4, 8, 12, 16, 32 or 64, each compiled in). Only used by the btree and sherman
+    int degree = 12;
+    /// How the btree's nodes are laid out and checked for torn reads (line, checksum or header_footer, see node_layout.h). Only used by the btree
+    std::string node_layout = "line";
+    /// If the btree's leaves take small inserts and removes as delta records, instead of rewriting the leaf on every update. Only used by the btree
+    bool leaf_deltas = false;
+    /// How many MB Sherman's index cache of inner nodes can use (define::kIndexCacheSize by default). Only used by sherman
+    int index_cache_mb = 1000;
 
     BenchmarkParams() = default;
 
@@ -100,6 +124,11 @@ public:
                 break;
         }
     }
+
+    /// If the structure is built from nodes of a degree (so the degree is recorded with its results)
+    bool has_degree() const {
+        return structure == "btree" || structure == "sherman";
+    }
 };
 
 class Result {
@@ -111,7 +140,7 @@ public:
     Result(BenchmarkParams params_, WorkloadDriverResult result_) : params(params_), result(std::move(result_)) {}
 
     static const std::string result_as_string_header() {
-        return "node_id,structure,distribution,runtime,unlimited_stream,op_count,region_size,thread_count,node_count,qp_per_conn,contains,insert,remove,lb,ub,cache_depth,count,runtime_ns,units,mean,stdev,min,p50,p90,p95,p99,p999,max,units_2,mean_2,stdev_2,min_2,p50_2,p90_2,p95_2,p99_2,p999_2,max_2,\n";
+        return "node_id,structure,distribution,runtime,unlimited_stream,op_count,region_size,thread_count,node_count,qp_per_conn,contains,insert,remove,lb,ub,cache_depth,degree,count,runtime_ns,units,mean,stdev,min,p50,p90,p95,p99,p999,max,units_2,mean_2,stdev_2,min_2,p50_2,p90_2,p95_2,p99_2,p999_2,max_2,\n";
     }
 
     std::string result_as_string(){
@@ -132,6 +161,7 @@ public:
         builder += std::to_string(params.key_lb) + ",";
         builder += std::to_string(params.key_ub) + ",";
         builder += std::to_string(params.cache_depth) + ",";
+        builder += (params.has_degree() ? std::to_string(params.degree) : "") + ",";
         builder += std::to_string(result.ops.try_get_counter()->counter) + ",";
         builder += std::to_string(result.runtime.try_get_stopwatch()->runtime_ns) + ",";
         builder += result.qps.try_get_summary()->units + ",";
@@ -177,6 +207,7 @@ public:
             builder += "\t\tkey_lb: " + std::to_string(params.key_lb) + "\n";
             builder += "\t\tkey_ub: " + std::to_string(params.key_ub) + "\n";
             builder += "\t\tcache_depth: " + std::to_string(params.cache_depth) + "\n";
+            if (params.has_degree()) builder += "\t\tdegree: " + std::to_string(params.degree) + "\n";
             builder += "\t}\n";
             builder += result.serialize();
             return builder + "}";
@@ -1,10 +1,12 @@
 #pragma once
 
+#include <algorithm>
 #include <barrier>
 #include <chrono>
 #include <optional>
 #include <random>
 #include <utility>
+#include <vector>
 
 #include <remus/workload/workload_driver.h>
 #include <remus/logging/logging.h>
@@ -45,6 +47,8 @@ enum MapCodes {
 class MapAPI {
   public:
     function<optional<int>(MapCodes, int, int, int)> conditions;
+    /// The batch api of the map (empty if the map doesn't have one)
+    function<vector<optional<int>>(MapCodes, const vector<int>&, const vector<int>&)> batch_conditions;
 
     /// First function is insert(key, value)
     /// Second function is get(key)
@@ -52,6 +56,23 @@ class MapAPI {
     /// Fourth function is prepare(op_count, key_lb, key_ub), which is used to register the thread and populate the map
     MapAPI(function<optional<int>(MapCodes, int, int, int)> conditions) : conditions(std::move(conditions)) {}
 
+    /// Same as above, with a batch api
+    /// Get is multi_get(keys) and Insert is multi_insert(keys, values)
+    MapAPI(function<optional<int>(MapCodes, int, int, int)> conditions, function<vector<optional<int>>(MapCodes, const vector<int>&, const vector<int>&)> batch_conditions)
+      : conditions(std::move(conditions)), batch_conditions(std::move(batch_conditions)) {}
+
+    bool batched(){
+      return batch_conditions != nullptr;
+    }
+
+    vector<optional<int>> multi_get(const vector<int>& keys){
+      return batch_conditions(Get, keys, {});
+    }
+
+    vector<optional<int>> multi_insert(const vector<int>& keys, const vector<int>& values){
+      return batch_conditions(Insert, keys, values);
+    }
+
     optional<int> get(int key){
       return conditions(Get, key, 0, 0);
     }
@@ -237,6 +258,25 @@ public:
   // Runs the next operation
   Status Apply(const Operation &op) {
     count++;
+    if (batch_size > 1 && op.op_type != REMOVE) {
+      // Buffer the contains and inserts, running them as a batch when it is full
+      // A batch runs its contains before its inserts, so a contains of a key with a buffered insert runs after a flush
+      if (op.op_type == CONTAINS) {
+        if (find(pending_inserts.begin(), pending_inserts.end(), op.key) != pending_inserts.end()) flush();
+        pending_gets.push_back(op.key);
+        pending_get_since.push_back(chrono::steady_clock::now());
+      } else if (op.op_type == INSERT) {
+        pending_inserts.push_back(op.key);
+        pending_values.push_back(op.value);
+        pending_insert_since.push_back(chrono::steady_clock::now());
+      } else {
+        REMUS_FATAL("Expected CONTAINS, INSERT, or REMOVE operation.");
+      }
+      if (pending_gets.size() + pending_inserts.size() >= batch_size) flush();
+      return Status::Ok();
+    }
+    // Keep the order of the operations of the thread
+    flush();
     optional<int> res;
     switch (op.op_type) {
     case (CONTAINS):
@@ -282,12 +322,60 @@ public:
   //        a barrier, then why not just make a barrier?
   remus::util::Status Stop() {
     REMUS_DEBUG("CLIENT :: Stopping client...");
+    flush();
+    report_batched_latency();
     do_stop_();
     ExperimentManager::ClientArriveBarrier(endpoint_);
     return Status::Ok();
   }
 
 private:
+  /// @brief Run the buffered contains and inserts as a batch
+  /// Each buffered operation's latency is recorded once its batch completes
+  void flush() {
+    if (!pending_gets.empty()) {
+      vector<optional<int>> res = map_->multi_get(pending_gets);
+      for (size_t i = 0; i < res.size(); i++) {
+        if (res[i].has_value()) {
+          REMUS_ASSERT(res[i].value() == pending_gets[i], "Invalid result of contains operation {}!={}", res[i].value(), pending_gets[i]);
+        }
+      }
+      record_latency(pending_get_since);
+      pending_gets.clear();
+    }
+    if (!pending_inserts.empty()) {
+      vector<optional<int>> res = map_->multi_insert(pending_inserts, pending_values);
+      for (size_t i = 0; i < res.size(); i++) {
+        if (res[i].has_value()) {
+          REMUS_ASSERT(res[i].value() == pending_inserts[i], "Invalid result of insert operation {}!={}", res[i].value(), pending_inserts[i]);
+        }
+      }
+      record_latency(pending_insert_since);
+      pending_inserts.clear();
+      pending_values.clear();
+    }
+  }
+
+  /// @brief Record the latency of the operations submitted at since, which just completed (and clear since)
+  void record_latency(vector<chrono::steady_clock::time_point>& since) {
+    chrono::steady_clock::time_point done = chrono::steady_clock::now();
+    for (chrono::steady_clock::time_point t : since) {
+      batched_latency_ns.push_back(chrono::duration_cast<chrono::nanoseconds>(done - t).count());
+    }
+    since.clear();
+  }
+
+  /// @brief Log the latency of the buffered operations, from their submission until their batch completed
+  /// (the driver's latency times the calls to Apply, which charges a whole batch to the operation that flushes it)
+  void report_batched_latency() {
+    if (batched_latency_ns.empty()) return;
+    sort(batched_latency_ns.begin(), batched_latency_ns.end());
+    auto at = [&](double p){ return batched_latency_ns[min(batched_latency_ns.size() - 1, (size_t) (p * batched_latency_ns.size()))]; };
+    double mean = 0;
+    for (long l : batched_latency_ns) mean += (double) l / batched_latency_ns.size();
+    REMUS_INFO("CLIENT :: Batched latency (ns) of {} operations: mean={} p50={} p99={} max={}", batched_latency_ns.size(), mean, at(0.5), at(0.99), batched_latency_ns.back());
+  }
+
   /// @brief Private constructor of client
   /// @param server the "server"-peer that is responsible for coordination among clients
   /// @param endpoint a EndpointManager instance that can be owned by the client.
@@ -298,6 +386,7 @@ private:
     : host_(host), endpoint_(ep), params_(params), barrier_(barr), map_(map), do_stop_(do_stop){
       if (params.unlimited_stream) progression = 100000;
       else progression = max(20.0, params_.op_count * params_.thread_count * 0.01);
+      batch_size = map->batched() ? max(1, params.batch_size) : 1;
     }
 
   int count = 0;
@@ -318,4 +407,15 @@ private:
   /// @brief The number of operations to do before debug-printing the number of completed operations
   /// This is useful in debugging since I can see around how many operations have been done (if at all) before crashing
   int progression;
+
+  /// @brief The number of contains and inserts to run as a batch (1 if the map doesn't have a batch api)
+  size_t batch_size;
+  /// @brief The buffered contains and inserts (and when they were submitted)
+  vector<int> pending_gets;
+  vector<int> pending_inserts;
+  vector<int> pending_values;
+  vector<chrono::steady_clock::time_point> pending_get_since;
+  vector<chrono::steady_clock::time_point> pending_insert_since;
+  /// @brief The latency of every buffered operation
+  vector<long> batched_latency_ns;
 };
\ No newline at end of file
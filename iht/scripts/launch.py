@@ -49,6 +49,7 @@ parser.add_argument('--thread_count', type=int, default=1, help="The number of t
 parser.add_argument('--node_count', type=int, default=1, help="The number of nodes to use in the experiment. Will use node0-nodeN")
 parser.add_argument('--qp_per_conn', type=int, default=30, help="The number of queue pairs to use in the experiment MAX")
 parser.add_argument('--cache_depth', type=int, default=0, help="The depth of which to cache layers in the IHT")
+parser.add_argument('--degree', type=int, choices=[4, 8, 12, 16, 32, 64], default=12, help="The degree of the btree's nodes (btree and sherman)")
 parser.add_argument('--structure', choices=['iht', 'btree', 'skiplist', 'iht_tmp', 'sherman', 'multi', 'iht_tuned'], required=True, help="The data structure")
 exp_result = {
     "iht": "iht_result.csv", 
@@ -60,6 +61,8 @@ exp_result = {
     "iht_tuned": "iht_tuned_result.csv"
 }
 ARGS = parser.parse_args()
+# The structures built from nodes of a degree (the others don't take --degree)
+degree_structures = ["btree", "sherman"]
 
 # Get parent folder name
 dir = os.path.abspath("../..")
@@ -88,6 +91,8 @@ def process_exp_flags(node_id):
                 params += f" --{param} " + str(mapper[param]).lower()
             if mapper['unlimited_stream']:
                 params += f" --unlimited_stream "
+            if ARGS.structure in degree_structures:
+                params += " --degree " + str(mapper.get("degree", ARGS.degree))
         params += " --structure " + str(ARGS.structure)
     else:
         one_to_ones = ["runtime", "op_count", "region_size", "thread_count", "node_count", "qp_per_conn", "cache_depth", "structure", "distribution"]
@@ -95,6 +100,8 @@ def process_exp_flags(node_id):
             params += f" --{param} " + str(eval(f"ARGS.{param}")).lower()
         if ARGS.unlimited_stream:
             params += f" --unlimited_stream "
+        if ARGS.structure in degree_structures:
+            params += " --degree " + str(ARGS.degree)
         contains, insert, remove = ARGS.op_distribution.split("-")
         if int(contains) + int(insert) + int(remove) != 100:
             print("Must specify values that add to 100 in op_distribution")